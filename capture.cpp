@@ -0,0 +1,239 @@
+/**
+ * @file capture.cpp
+ * @brief Triggered packet capture: a TPACKET_V3 ring written to pcap without copying packets
+ */
+#include <arpa/inet.h>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+#include "capture.h"
+#include "monitorClock.h"
+
+// Ring geometry; the kernel hands over whole blocks and retires a partly filled
+// one after RING_BLOCK_TIMEOUT_MS so a quiet link still reaches the file
+const unsigned RING_BLOCK_SIZE = 1 << 20;
+const unsigned RING_BLOCKS = 8;
+const unsigned RING_FRAME_SIZE = 2048;
+const unsigned RING_BLOCK_TIMEOUT_MS = 100;
+const unsigned PCAP_SNAPLEN = 262144;
+const size_t MAX_IOVECS = 1024; // IOV_MAX on Linux
+
+// pcap file format with nanosecond timestamps, as TPACKET_V3 reports them
+const uint32_t PCAP_NANOSECOND_MAGIC = 0xa1b23c4d;
+const uint32_t LINKTYPE_ETHERNET = 1;
+const uint32_t LINKTYPE_RAW = 101;
+const int ARPHRD_NONE_TYPE = 65534; // Layer 3 devices such as tun
+
+struct PcapFileHeader {
+    uint32_t magic;
+    uint16_t versionMajor, versionMinor;
+    int32_t thisZone;
+    uint32_t sigFigs;
+    uint32_t snapLen;
+    uint32_t linkType;
+};
+
+struct PcapRecordHeader {
+    uint32_t seconds, nanoseconds;
+    uint32_t capturedLength, originalLength;
+};
+
+/**
+ * @brief The socket, ring and file of one capture, released when it ends
+ */
+struct CaptureSession {
+    int socketFd = -1;
+    int fileFd = -1;
+    char* ring = static_cast<char*>(MAP_FAILED);
+    std::vector<PcapRecordHeader> headers; // One per packet of the block being written
+    std::vector<struct iovec> iovecs;
+
+    ~CaptureSession() {
+        if (ring != MAP_FAILED) {
+            munmap(ring, static_cast<size_t>(RING_BLOCK_SIZE) * RING_BLOCKS);
+        }
+        if (socketFd >= 0) {
+            close(socketFd);
+        }
+        if (fileFd >= 0) {
+            close(fileFd);
+        }
+    }
+};
+
+/**
+ * @brief Throws a runtime_error naming the failed step and errno
+ * @param what Step that failed
+ */
+[[noreturn]] void captureFailed(const std::string& what) {
+    throw std::runtime_error("!!! capture.cpp !!!- " + what + ": " + std::string(strerror(errno)));
+}
+
+/**
+ * @brief Writes a batch of iovecs completely
+ * @param fd Output file
+ * @param iovecs Buffers to write
+ * @param count Number of buffers
+ * @param bytes Total size of the buffers
+ */
+void writeAll(int fd, const struct iovec* iovecs, size_t count, size_t bytes) {
+    ssize_t written = writev(fd, iovecs, static_cast<int>(count));
+    if (written != static_cast<ssize_t>(bytes)) {
+        captureFailed("Failed to write pcap");
+    }
+}
+
+/**
+ * @brief Writes the packets of one ring block, pointing writev straight into the ring
+ * @param session Capture session
+ * @param block Block owned by user space
+ * @param maxBytes File size limit
+ * @param result Running totals, updated
+ * @return false once the size limit stopped the capture
+ */
+bool writeBlock(CaptureSession& session, const struct tpacket_block_desc* block, unsigned long long maxBytes,
+                CaptureResult& result) {
+    uint32_t packets = block->hdr.bh1.num_pkts;
+    session.headers.resize(packets);
+    session.iovecs.clear();
+    size_t batchBytes = 0;
+    bool room = true;
+    const char* position = reinterpret_cast<const char*>(block) + block->hdr.bh1.offset_to_first_pkt;
+    for (uint32_t p = 0; p < packets; ++p) {
+        const struct tpacket3_hdr* packet = reinterpret_cast<const struct tpacket3_hdr*>(position);
+        size_t recordBytes = sizeof(PcapRecordHeader) + packet->tp_snaplen;
+        if (result.bytes + batchBytes + recordBytes > maxBytes) {
+            room = false;
+            break;
+        }
+        PcapRecordHeader& header = session.headers[p];
+        header = {packet->tp_sec, packet->tp_nsec, packet->tp_snaplen, packet->tp_len};
+        session.iovecs.push_back({&header, sizeof(header)});
+        session.iovecs.push_back({const_cast<char*>(position) + packet->tp_mac, packet->tp_snaplen});
+        batchBytes += recordBytes;
+        ++result.packets;
+        if (session.iovecs.size() == MAX_IOVECS) {
+            writeAll(session.fileFd, session.iovecs.data(), session.iovecs.size(), batchBytes);
+            result.bytes += batchBytes;
+            batchBytes = 0;
+            session.iovecs.clear();
+        }
+        position += packet->tp_next_offset;
+    }
+    if (!session.iovecs.empty()) {
+        writeAll(session.fileFd, session.iovecs.data(), session.iovecs.size(), batchBytes);
+        result.bytes += batchBytes;
+    }
+    return room;
+}
+
+/**
+ * @brief Captures the packets of an interface into a pcap file
+ * @details Opens a TPACKET_V3 receive ring, writes every retired block to the file
+ *          with writev (packet data is never copied in user space) and tears the
+ *          ring down when the time or size limit is reached.
+ * @param interface Name of the interface
+ * @param limits When to stop
+ * @param path pcap file to create; an existing file or symlink there is never
+ *             followed or overwritten, since the name in CAPTURE_DIRECTORY is predictable
+ * @param result Receives what was captured
+ * @throws runtime_error if the ring or the file cannot be set up or written, or the path exists
+ */
+void capturePackets(const char* interface, const CaptureLimits& limits, const char* path, CaptureResult& result) {
+    CaptureSession session;
+    result = CaptureResult();
+    unsigned ifindex = if_nametoindex(interface);
+    if (ifindex == 0) {
+        captureFailed(std::string("No interface ") + interface);
+    }
+
+    // Protocol 0 receives nothing until bind(), so no other interface's packets land in the ring
+    session.socketFd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, 0);
+    if (session.socketFd < 0) {
+        captureFailed("Packet socket creation failed");
+    }
+    int version = TPACKET_V3;
+    if (setsockopt(session.socketFd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+        captureFailed("TPACKET_V3 unavailable");
+    }
+    struct tpacket_req3 request;
+    memset(&request, 0, sizeof(request));
+    request.tp_block_size = RING_BLOCK_SIZE;
+    request.tp_block_nr = RING_BLOCKS;
+    request.tp_frame_size = RING_FRAME_SIZE;
+    request.tp_frame_nr = RING_BLOCK_SIZE / RING_FRAME_SIZE * RING_BLOCKS;
+    request.tp_retire_blk_tov = RING_BLOCK_TIMEOUT_MS;
+    if (setsockopt(session.socketFd, SOL_PACKET, PACKET_RX_RING, &request, sizeof(request)) < 0) {
+        captureFailed("Receive ring setup failed");
+    }
+    session.ring = static_cast<char*>(mmap(nullptr, static_cast<size_t>(RING_BLOCK_SIZE) * RING_BLOCKS,
+                                           PROT_READ | PROT_WRITE, MAP_SHARED, session.socketFd, 0));
+    if (session.ring == MAP_FAILED) {
+        captureFailed("Receive ring mapping failed");
+    }
+    struct sockaddr_ll address;
+    memset(&address, 0, sizeof(address));
+    address.sll_family = AF_PACKET;
+    address.sll_protocol = htons(ETH_P_ALL);
+    address.sll_ifindex = static_cast<int>(ifindex);
+    if (bind(session.socketFd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        captureFailed(std::string("Failed to bind to ") + interface);
+    }
+
+    session.fileFd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (session.fileFd < 0) {
+        captureFailed(std::string("Failed to create ") + path);
+    }
+    char typePath[64 + IFNAMSIZ];
+    int arpType = 0;
+    snprintf(typePath, sizeof(typePath), "/sys/class/net/%s/type", interface);
+    FILE* typeFile = fopen(typePath, "r");
+    if (typeFile != nullptr) {
+        if (fscanf(typeFile, "%d", &arpType) != 1) {
+            arpType = 0;
+        }
+        fclose(typeFile);
+    }
+    PcapFileHeader fileHeader = {PCAP_NANOSECOND_MAGIC, 2, 4, 0, 0, PCAP_SNAPLEN,
+                                 arpType == ARPHRD_NONE_TYPE ? LINKTYPE_RAW : LINKTYPE_ETHERNET};
+    struct iovec headerIovec = {&fileHeader, sizeof(fileHeader)};
+    writeAll(session.fileFd, &headerIovec, 1, sizeof(fileHeader));
+    result.bytes = sizeof(fileHeader);
+
+    double deadline = g_clock->monotonic() + limits.seconds;
+    unsigned current = 0;
+    bool room = true;
+    while (room) {
+        struct tpacket_block_desc* block =
+            reinterpret_cast<struct tpacket_block_desc*>(session.ring + static_cast<size_t>(current) * RING_BLOCK_SIZE);
+        double remaining = deadline - g_clock->monotonic();
+        if (remaining <= 0.0) {
+            break;
+        }
+        if ((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+            struct pollfd ready = {session.socketFd, POLLIN | POLLERR, 0};
+            poll(&ready, 1, static_cast<int>(remaining * 1000.0) + 1);
+            continue;
+        }
+        room = writeBlock(session, block, limits.maxBytes, result);
+        __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        current = (current + 1) % RING_BLOCKS;
+    }
+
+    struct tpacket_stats_v3 stats;
+    socklen_t statsLength = sizeof(stats);
+    if (getsockopt(session.socketFd, SOL_PACKET, PACKET_STATISTICS, &stats, &statsLength) == 0) {
+        result.drops = stats.tp_drops;
+    }
+}
@@ -0,0 +1,32 @@
+/**
+ * @file capture.h
+ * @brief Bounded packet capture to pcap from an AF_PACKET TPACKET_V3 ring
+ * @details Nothing is opened until a capture starts and everything is torn down
+ *          when it ends, so an idle monitor pays nothing for it. intfMonitor runs
+ *          captures in a forked child so sampling continues meanwhile.
+ */
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+const char* const CAPTURE_DIRECTORY = "/tmp";
+
+/**
+ * @brief When a capture stops, whichever limit is reached first
+ */
+struct CaptureLimits {
+    double seconds;
+    unsigned long long maxBytes; // Size of the pcap file
+};
+
+/**
+ * @brief What a capture wrote
+ */
+struct CaptureResult {
+    unsigned long long packets = 0;
+    unsigned long long bytes = 0; // Size of the pcap file
+    unsigned long long drops = 0; // Packets the ring had no room for
+};
+
+void capturePackets(const char* interface, const CaptureLimits& limits, const char* path, CaptureResult& result);
+
+#endif // CAPTURE_H
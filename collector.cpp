@@ -0,0 +1,825 @@
+/**
+ * @file collector.cpp
+ * @brief Collection engine: reads interface statistics from sysfs and restores downed links
+ * @details Used by intfMonitor and, through libnetwatch.a, by embedding agents.
+ */
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <linux/net_namespace.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <set>
+#include <stdexcept>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "collector.h"
+#include "monitorClock.h"
+#include "probes.h"
+
+const int BUFFER_SIZE = 512;
+const size_t INTERRUPTS_READ_SIZE = 64 * 1024; // First read buffer; 128-CPU hosts need a few times this
+const int INTERRUPT_COLUMN = 11;              // " %10u", the kernel's format for one CPU's count
+
+/**
+ * @brief Lists the devices an interface is stacked on (VLAN parent, bond slaves, bridge ports)
+ * @param interface Name of the network interface
+ * @return Names of the lower devices linked as lower_<dev> in sysfs
+ */
+std::vector<std::string> getLowerDevices(const std::string& interface) {
+    std::vector<std::string> lowers;
+    std::string path = "/sys/class/net/" + interface;
+    DIR* dir = opendir(path.c_str());
+    if (dir == nullptr) {
+        return lowers;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (strncmp(entry->d_name, "lower_", 6) == 0) {
+            lowers.push_back(entry->d_name + 6);
+        }
+    }
+    closedir(dir);
+    return lowers;
+}
+
+/**
+ * @brief Orders an interface and everything below it so lower devices come first
+ * @param interface Name of the network interface at the top of the subtree
+ * @param visited Devices already placed, guards against shared lowers and cycles
+ * @param order Reference to vector receiving the devices in restore order
+ */
+void orderRestoreSubtree(const std::string& interface, std::set<std::string>& visited,
+                         std::vector<std::string>& order) {
+    if (!visited.insert(interface).second) {
+        return;
+    }
+    for (const auto& lower : getLowerDevices(interface)) {
+        orderRestoreSubtree(lower, visited, order);
+    }
+    order.push_back(interface);
+}
+
+/**
+ * @brief Sets IFF_UP on a single device, keeping its other flags
+ * @param socketFd Datagram socket used for the interface ioctls
+ * @param interface Name of the network interface to bring up
+ * @return 1 if the device was brought up, 0 if it was already up, -1 on failure
+ */
+int bringUpDevice(int socketFd, const char* interface) {
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, interface, IFNAMSIZ);
+    ifr.ifr_name[IFNAMSIZ - 1] = '\0';
+    if (ioctl(socketFd, SIOCGIFFLAGS, &ifr) < 0) {
+        return -1;
+    }
+    if (ifr.ifr_flags & IFF_UP) {
+        return 0;
+    }
+    ifr.ifr_flags |= IFF_UP;
+    return ioctl(socketFd, SIOCSIFFLAGS, &ifr) < 0 ? -1 : 1;
+}
+
+/**
+ * @brief Restores network interface to operational state
+ * @details Lower devices are brought up before the devices stacked on them, so a
+ *          bridge over a bond over VLANs comes back in one pass instead of failing
+ *          until its lowers happen to recover.
+ * @param interface Name of the network interface to restore
+ * @return 0 on success, EXIT_FAILURE on failure
+ */
+int restoreInterface(const char* interface) {
+    std::set<std::string> visited;
+    std::vector<std::string> order;
+    orderRestoreSubtree(interface, visited, order);
+    NETWATCH_PROBE2(restore__start, interface, order.size());
+
+    int socketFd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (socketFd < 0) {
+        throw std::runtime_error("!!! collector.cpp !!!- Socket creation failed: " + std::string(strerror(errno)));
+    }
+    // The monitored interface is last in the order; its lowers are best effort
+    for (size_t i = 0; i + 1 < order.size(); ++i) {
+        int result = bringUpDevice(socketFd, order[i].c_str());
+        if (result < 0) {
+            std::cerr << "!!! collector.cpp !!!- Failed to bring lower device up: '" << order[i]
+                      << "' - " << strerror(errno) << std::endl;
+        } else if (result > 0) {
+            std::cout << "Lower device " << order[i] << " of " << interface << " brought up" << std::endl;
+        }
+    }
+    if (bringUpDevice(socketFd, interface) < 0) {
+        int savedErrno = errno;
+        close(socketFd);
+        throw std::runtime_error("!!! collector.cpp !!!- Failed to bring interface up: '" + std::string(interface) +
+                                "' - " + std::string(strerror(savedErrno)));
+    }
+    close(socketFd);
+    NETWATCH_PROBE1(restore__done, interface);
+    return 0;
+}
+
+/**
+ * @brief Opens a netlink socket subscribed to link change notifications
+ * @return File descriptor of the socket, -1 if notifications are unavailable
+ */
+int openLinkNotifications() {
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0) {
+        return -1;
+    }
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = RTMGRP_LINK;
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Drains pending link notifications without blocking
+ * @param fd Socket from openLinkNotifications()
+ * @param interface Name of the monitored interface
+ * @param ifindex Last known index of the monitored interface
+ * @return true if a notification concerned the monitored interface or some were lost
+ */
+bool linkChanged(int fd, const char* interface, int ifindex) {
+    alignas(struct nlmsghdr) char buffer[8192];
+    bool changed = false;
+    ssize_t len;
+    while ((len = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+        int remaining = static_cast<int>(len);
+        for (struct nlmsghdr* nh = (struct nlmsghdr*)buffer; NLMSG_OK(nh, remaining);
+             nh = NLMSG_NEXT(nh, remaining)) {
+            if (nh->nlmsg_type != RTM_NEWLINK && nh->nlmsg_type != RTM_DELLINK) {
+                continue;
+            }
+            struct ifinfomsg* ifi = (struct ifinfomsg*)NLMSG_DATA(nh);
+            if (ifi->ifi_index == ifindex) {
+                changed = true;
+                continue;
+            }
+            // A recreated interface comes back under the same name with a new index
+            int attrLen = IFLA_PAYLOAD(nh);
+            for (struct rtattr* rta = IFLA_RTA(ifi); RTA_OK(rta, attrLen); rta = RTA_NEXT(rta, attrLen)) {
+                if (rta->rta_type == IFLA_IFNAME && strcmp((const char*)RTA_DATA(rta), interface) == 0) {
+                    changed = true;
+                }
+            }
+        }
+    }
+    if (len < 0 && errno == ENOBUFS) {
+        changed = true;
+    }
+    return changed;
+}
+
+/**
+ * @brief Resolves a sysfs symlink to the last component of its target
+ * @param path Path of the symlink
+ * @return Basename of the link target, empty if the link does not exist
+ */
+std::string readLinkBasename(const char* path) {
+    char target[BUFFER_SIZE];
+    ssize_t len = readlink(path, target, sizeof(target) - 1);
+    if (len < 0) {
+        return "";
+    }
+    target[len] = '\0';
+    const char* slash = strrchr(target, '/');
+    return slash != nullptr ? slash + 1 : target;
+}
+
+/**
+ * @brief Finds the PCI function an interface's device hangs off
+ * @details Walks up from the device until a node on the pci bus, so a virtio NIC
+ *          (device virtio0 below 0000:00:04.0) reports the PCI address too.
+ * @param interface Name of the interface
+ * @return PCI address such as "0000:00:04.0", empty for devices not on PCI
+ */
+std::string resolvePciAddress(const char* interface) {
+    char path[PATH_MAX + sizeof("/subsystem")], device[PATH_MAX];
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device", interface);
+    if (realpath(path, device) == nullptr) {
+        return "";
+    }
+    for (char* slash = strrchr(device, '/'); slash != nullptr && slash != device; slash = strrchr(device, '/')) {
+        snprintf(path, sizeof(path), "%s/subsystem", device);
+        if (readLinkBasename(path) == "pci") {
+            return slash + 1;
+        }
+        *slash = '\0';
+    }
+    return "";
+}
+
+/**
+ * @brief Sends one request to the kernel on a fresh rtnetlink socket
+ * @param request Complete request message
+ * @param reply Buffer receiving the reply, aligned for struct nlmsghdr
+ * @param capacity Size of reply
+ * @return The reply message, nullptr on failure or a netlink error
+ */
+struct nlmsghdr* rtnetlinkRequest(struct nlmsghdr* request, char* reply, size_t capacity) {
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct sockaddr_nl kernel;
+    memset(&kernel, 0, sizeof(kernel));
+    kernel.nl_family = AF_NETLINK;
+    ssize_t len = -1;
+    if (sendto(fd, request, request->nlmsg_len, 0, (struct sockaddr*)&kernel, sizeof(kernel)) >= 0) {
+        len = recv(fd, reply, capacity, 0);
+    }
+    close(fd);
+    struct nlmsghdr* nh = (struct nlmsghdr*)reply;
+    int remaining = static_cast<int>(len);
+    if (len < 0 || !NLMSG_OK(nh, remaining) || nh->nlmsg_type == NLMSG_ERROR) {
+        return nullptr;
+    }
+    return nh;
+}
+
+/**
+ * @brief Reads the link kind and the peer of a stacked or veth interface from rtnetlink
+ * @param metadata Metadata with a valid ifindex; kind, peerIfindex and peerNetnsId are filled
+ */
+void loadLinkAttributes(InterfaceMetadata& metadata) {
+    struct {
+        struct nlmsghdr header;
+        struct ifinfomsg info;
+    } request;
+    memset(&request, 0, sizeof(request));
+    request.header.nlmsg_len = sizeof(request);
+    request.header.nlmsg_type = RTM_GETLINK;
+    request.header.nlmsg_flags = NLM_F_REQUEST;
+    request.info.ifi_family = AF_UNSPEC;
+    request.info.ifi_index = metadata.ifindex;
+    alignas(struct nlmsghdr) char reply[8192];
+    struct nlmsghdr* nh = rtnetlinkRequest(&request.header, reply, sizeof(reply));
+    if (nh == nullptr || nh->nlmsg_type != RTM_NEWLINK) {
+        return;
+    }
+    int attrLen = IFLA_PAYLOAD(nh);
+    for (struct rtattr* rta = IFLA_RTA((struct ifinfomsg*)NLMSG_DATA(nh)); RTA_OK(rta, attrLen);
+         rta = RTA_NEXT(rta, attrLen)) {
+        if (rta->rta_type == IFLA_LINK) {
+            metadata.peerIfindex = *(int*)RTA_DATA(rta);
+        } else if (rta->rta_type == IFLA_LINK_NETNSID) {
+            metadata.peerNetnsId = *(int*)RTA_DATA(rta);
+        } else if (rta->rta_type == IFLA_LINKINFO) {
+            int infoLen = RTA_PAYLOAD(rta);
+            for (struct rtattr* info = (struct rtattr*)RTA_DATA(rta); RTA_OK(info, infoLen);
+                 info = RTA_NEXT(info, infoLen)) {
+                if (info->rta_type == IFLA_INFO_KIND) {
+                    metadata.kind.assign((const char*)RTA_DATA(info), strnlen((const char*)RTA_DATA(info), RTA_PAYLOAD(info)));
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Asks the kernel which id our namespace has assigned to another namespace
+ * @param attribute NETNSA_PID or NETNSA_FD
+ * @param value Process whose namespace, or namespace file descriptor, to look up
+ * @return The namespace id, -1 if none is assigned or the lookup failed
+ */
+int queryNetnsId(int attribute, uint32_t value) {
+    struct {
+        struct nlmsghdr header;
+        struct rtgenmsg family;
+        alignas(4) char attrs[RTA_SPACE(sizeof(uint32_t))];
+    } request;
+    memset(&request, 0, sizeof(request));
+    request.header.nlmsg_len = sizeof(request);
+    request.header.nlmsg_type = RTM_GETNSID;
+    request.header.nlmsg_flags = NLM_F_REQUEST;
+    request.family.rtgen_family = AF_UNSPEC;
+    struct rtattr* rta = (struct rtattr*)request.attrs;
+    rta->rta_type = attribute;
+    rta->rta_len = RTA_LENGTH(sizeof(uint32_t));
+    memcpy(RTA_DATA(rta), &value, sizeof(value));
+    alignas(struct nlmsghdr) char reply[BUFFER_SIZE];
+    struct nlmsghdr* nh = rtnetlinkRequest(&request.header, reply, sizeof(reply));
+    if (nh == nullptr || nh->nlmsg_type != RTM_NEWNSID) {
+        return -1;
+    }
+    int attrLen = nh->nlmsg_len - NLMSG_LENGTH(sizeof(struct rtgenmsg));
+    for (rta = (struct rtattr*)((char*)NLMSG_DATA(nh) + NLMSG_ALIGN(sizeof(struct rtgenmsg)));
+         RTA_OK(rta, attrLen); rta = RTA_NEXT(rta, attrLen)) {
+        if (rta->rta_type == NETNSA_NSID) {
+            return *(int*)RTA_DATA(rta);
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Names the pod or container a cgroup belongs to
+ * @details Understands the kubelet layouts (".../kubepods-besteffort-pod<uid>.slice/..."
+ *          and ".../kubepods/besteffort/pod<uid>/...") and container runtime scopes
+ *          such as "docker-<id>.scope" or "cri-containerd-<id>.scope".
+ * @param path Cgroup path from /proc/<pid>/cgroup
+ * @param pid Process in the cgroup, named when the cgroup says nothing
+ * @return Owner key with the prefix "pod:", "container:", "cgroup:" or "pid:"
+ */
+std::string describeCgroup(const std::string& path, int pid) {
+    const size_t MIN_ID_LENGTH = 32;
+    for (size_t at = path.find("pod"); at != std::string::npos; at = path.find("pod", at + 1)) {
+        if (at > 0 && (path[at - 1] == '-' || path[at - 1] == '/')) {
+            std::string uid = path.substr(at + 3, path.find_first_of("./", at + 3) - (at + 3));
+            if (uid.size() >= MIN_ID_LENGTH) {
+                std::replace(uid.begin(), uid.end(), '_', '-'); // systemd escapes '-' in slice names
+                return "pod:" + uid;
+            }
+        }
+    }
+    std::string leaf = path.substr(path.rfind('/') + 1);
+    if (leaf.size() > 6 && leaf.compare(leaf.size() - 6, 6, ".scope") == 0) {
+        leaf.resize(leaf.size() - 6);
+    }
+    std::string id = leaf.substr(leaf.rfind('-') + 1);
+    if (id.size() >= MIN_ID_LENGTH && id.find_first_not_of("0123456789abcdef") == std::string::npos) {
+        return "container:" + id.substr(0, 12);
+    }
+    if (!leaf.empty()) {
+        return "cgroup:" + leaf;
+    }
+    return "pid:" + std::to_string(pid);
+}
+
+/**
+ * @brief Names the owner of a process from its cgroup membership
+ * @param pid Process to describe
+ * @return Owner key, see describeCgroup()
+ */
+std::string describeProcess(int pid) {
+    char path[BUFFER_SIZE];
+    snprintf(path, sizeof(path), "/proc/%d/cgroup", pid);
+    std::ifstream file(path);
+    std::string line, chosen = "/";
+    int chosenRank = 0;
+    // Lines are "<hierarchy>:<controllers>:<path>"; prefer a path placed by the kubelet,
+    // then the unified hierarchy, then systemd's, skipping root paths
+    while (std::getline(file, line)) {
+        size_t colon = line.find(':', line.find(':') + 1);
+        if (colon == std::string::npos || line.compare(colon, 2, ":/") != 0 || line.size() == colon + 2) {
+            continue;
+        }
+        std::string cgroup = line.substr(colon + 1);
+        int rank = cgroup.find("kubepods") != std::string::npos ? 3
+                 : line.compare(0, 3, "0::") == 0                 ? 2
+                 : line.find(":name=systemd:") != std::string::npos ? 1 : 0;
+        if (chosenRank < rank) {
+            chosen = cgroup;
+            chosenRank = rank;
+        }
+    }
+    return describeCgroup(chosen, pid);
+}
+
+/**
+ * @brief Finds the named namespace, pod or container holding a veth peer
+ * @details Named namespaces ("ip netns add") are matched first, then the first
+ *          process found in each other namespace. With kubelet the lowest pid is
+ *          the pod's sandbox process, so the owner names the pod. Walks /proc, so
+ *          it is only called when metadata is reloaded after a link event.
+ * @param peerNetnsId Namespace id of the peer as seen from our namespace
+ * @return Owner key, empty if no namespace with that id was found
+ */
+std::string resolvePeerOwner(int peerNetnsId) {
+    char path[BUFFER_SIZE];
+    std::string owner;
+    DIR* dir = opendir("/run/netns");
+    for (struct dirent* entry; owner.empty() && dir != nullptr && (entry = readdir(dir)) != nullptr;) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/run/netns/%s", entry->d_name);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            if (queryNetnsId(NETNSA_FD, fd) == peerNetnsId) {
+                owner = "netns:" + std::string(entry->d_name);
+            }
+            close(fd);
+        }
+    }
+    if (dir != nullptr) {
+        closedir(dir);
+    }
+
+    struct stat own;
+    std::set<ino_t> checked;
+    if (stat("/proc/self/ns/net", &own) == 0) {
+        checked.insert(own.st_ino);
+    }
+    dir = owner.empty() ? opendir("/proc") : nullptr;
+    for (struct dirent* entry; owner.empty() && dir != nullptr && (entry = readdir(dir)) != nullptr;) {
+        char* end;
+        long pid = strtol(entry->d_name, &end, 10);
+        struct stat ns;
+        snprintf(path, sizeof(path), "/proc/%s/ns/net", entry->d_name);
+        if (*end != '\0' || pid <= 0 || stat(path, &ns) != 0 || !checked.insert(ns.st_ino).second) {
+            continue;
+        }
+        if (queryNetnsId(NETNSA_PID, static_cast<uint32_t>(pid)) == peerNetnsId) {
+            owner = describeProcess(static_cast<int>(pid));
+        }
+    }
+    if (dir != nullptr) {
+        closedir(dir);
+    }
+    // Keep the key a single printable token of bounded length for the report
+    for (char& c : owner) {
+        if (static_cast<unsigned char>(c - 0x21) >= 0x5e) {
+            c = '_';
+        }
+    }
+    return owner.substr(0, MAX_OWNER_NAME - 1);
+}
+
+/**
+ * @brief Lists the MSI vectors of an interface's device
+ * @details virtio devices sit below the PCI function that owns their vectors, so
+ *          its msi_irqs is used when the device itself has none.
+ * @param interface Name of the interface
+ * @param irqs Receives the vectors, ascending; empty for devices without MSI
+ */
+void loadMsiIrqs(const char* interface, std::vector<int>& irqs) {
+    char path[BUFFER_SIZE];
+    const char* const directories[] = {"device/msi_irqs", "device/../msi_irqs"};
+    irqs.clear();
+    for (const char* directory : directories) {
+        snprintf(path, sizeof(path), "/sys/class/net/%s/%s", interface, directory);
+        DIR* dir = opendir(path);
+        if (dir == nullptr) {
+            continue;
+        }
+        while (struct dirent* entry = readdir(dir)) {
+            if (isdigit(static_cast<unsigned char>(entry->d_name[0]))) {
+                irqs.push_back(atoi(entry->d_name));
+            }
+        }
+        closedir(dir);
+        std::sort(irqs.begin(), irqs.end());
+        return;
+    }
+}
+
+/**
+ * @brief Reads the slow-changing interface properties from sysfs
+ * @details The owner of a veth peer is carried over from the previous metadata
+ *          when the link and peer namespace are unchanged, so /proc is only
+ *          walked when a peer first appears or moves.
+ * @param interface Name of the interface to describe
+ * @param metadata Reference to the metadata to fill
+ */
+void loadMetadata(const char* interface, InterfaceMetadata& metadata) {
+    char path[BUFFER_SIZE];
+    std::ifstream file;
+    InterfaceMetadata previous = std::move(metadata);
+    metadata = InterfaceMetadata();
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/ifindex", interface);
+    file.open(path);
+    if (file.is_open()) {
+        file >> metadata.ifindex;
+        file.close();
+    }
+    // Reading speed fails with EINVAL while the link has no carrier
+    snprintf(path, sizeof(path), "/sys/class/net/%s/speed", interface);
+    file.open(path);
+    if (file.is_open()) {
+        if (!(file >> metadata.speedMbps) || metadata.speedMbps < 0) {
+            metadata.speedMbps = 0;
+        }
+        file.close();
+    }
+    file.clear();
+    snprintf(path, sizeof(path), "/sys/class/net/%s/mtu", interface);
+    file.open(path);
+    if (file.is_open()) {
+        file >> metadata.mtu;
+        file.close();
+    }
+    snprintf(path, sizeof(path), "/sys/class/net/%s/address", interface);
+    file.open(path);
+    if (file.is_open()) {
+        file >> metadata.address;
+        file.close();
+    }
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/driver", interface);
+    metadata.driver = readLinkBasename(path);
+    metadata.pciAddress = resolvePciAddress(interface);
+    loadMsiIrqs(interface, metadata.irqs);
+    loadLinkAttributes(metadata);
+    if (metadata.peerNetnsId >= 0) {
+        bool samePeer = previous.valid && previous.ifindex == metadata.ifindex &&
+                        previous.peerIfindex == metadata.peerIfindex && previous.peerNetnsId == metadata.peerNetnsId;
+        metadata.owner = samePeer ? previous.owner : resolvePeerOwner(metadata.peerNetnsId);
+    }
+    metadata.valid = true;
+}
+
+/**
+ * @brief Reads one value from a sysfs attribute file
+ * @param path Path of the attribute
+ * @param value Reference receiving the value, left unchanged if the file is unreadable
+ */
+template <typename T>
+void readSysfsValue(const char* path, T& value) {
+    std::ifstream file(path);
+    if (file.is_open()) {
+        file >> value;
+    }
+}
+
+/**
+ * @brief Parses the per-CPU columns of a /proc/interrupts row
+ * @details Each count is printed right-aligned in 10 characters after a space, so a
+ *          column is normally INTERRUPT_COLUMN bytes. Its last 8 characters are
+ *          converted in one 64-bit word (leading spaces read as zeros) instead of
+ *          digit by digit. A count of more than 10 digits widens its column; that
+ *          column is parsed digit by digit and the next ones are checked again.
+ * @param position First character after the "<irq>:" label
+ * @param end End of the row
+ * @param columns Number of CPU columns
+ * @param counts Receives one count per column
+ * @return false if the row has fewer columns or is malformed
+ */
+bool parseInterruptColumns(const char* position, const char* end, size_t columns, unsigned long long* counts) {
+    for (size_t c = 0; c < columns; ++c) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        if (end - position >= INTERRUPT_COLUMN && position[0] == ' ' &&
+            (position + INTERRUPT_COLUMN == end || !isdigit(static_cast<unsigned char>(position[INTERRUPT_COLUMN])))) {
+            uint64_t word;
+            memcpy(&word, position + 3, sizeof(word));
+            word = (word | 0x1010101010101010ULL) - 0x3030303030303030ULL; // ' ' and '0'..'9' become 0..9
+            unsigned high = (position[1] | 0x10) - '0', low = (position[2] | 0x10) - '0';
+            if (((word | (word + 0x7676767676767676ULL)) & 0x8080808080808080ULL) == 0 && high <= 9 && low <= 9) {
+                word = word * 10 + (word >> 8); // Pairs of digits, then groups of four, then all eight
+                word = (((word & 0x000000ff000000ffULL) * (100 + (1000000ULL << 32))) +
+                        (((word >> 16) & 0x000000ff000000ffULL) * (1 + (10000ULL << 32)))) >> 32;
+                counts[c] = (high * 10 + low) * 100000000ULL + word;
+                position += INTERRUPT_COLUMN;
+                continue;
+            }
+        }
+#endif
+        while (position < end && *position == ' ') {
+            ++position;
+        }
+        if (position == end || !isdigit(static_cast<unsigned char>(*position))) {
+            return false;
+        }
+        unsigned long long value = 0;
+        while (position < end && isdigit(static_cast<unsigned char>(*position))) {
+            value = value * 10 + (*position++ - '0');
+        }
+        counts[c] = value;
+    }
+    return true;
+}
+
+/**
+ * @brief Reads the interrupts of the interface's MSI vectors from /proc/interrupts
+ * @details Rows are listed by ascending IRQ, like the vectors, so one pass finds them
+ *          and every other row is skipped with memchr() without parsing its columns.
+ * @param collector Per-interface collector state
+ * @param sample Receives one QueueInterrupts per vector found
+ */
+void readQueueInterrupts(CollectorState& collector, InterfaceSample& sample) {
+    const std::vector<int>& irqs = collector.metadata.irqs;
+    if (irqs.empty()) {
+        return;
+    }
+    if (collector.interruptsFd < 0) {
+        collector.interruptsFd = open("/proc/interrupts", O_RDONLY | O_CLOEXEC);
+        if (collector.interruptsFd < 0) {
+            return;
+        }
+    }
+    // The file is generated on each read, so it is read whole from the start
+    std::vector<char>& text = collector.interruptsText;
+    if (text.empty()) {
+        text.resize(INTERRUPTS_READ_SIZE);
+    }
+    size_t used = 0;
+    ssize_t bytesRead;
+    lseek(collector.interruptsFd, 0, SEEK_SET);
+    while ((bytesRead = read(collector.interruptsFd, text.data() + used, text.size() - used)) > 0) {
+        used += bytesRead;
+        if (used == text.size()) {
+            text.resize(text.size() * 2);
+        }
+    }
+    const char* position = text.data();
+    const char* end = text.data() + used;
+    const char* lineEnd = static_cast<const char*>(memchr(position, '\n', used));
+    if (lineEnd == nullptr) {
+        return;
+    }
+
+    // The header names one column per online CPU: "CPU0 CPU1 ..."
+    std::vector<int>& cpus = collector.interruptCpus;
+    size_t previousColumns = cpus.size();
+    cpus.clear();
+    for (const char* cpu = position; (cpu = static_cast<const char*>(memmem(cpu, lineEnd - cpu, "CPU", 3))) != nullptr;) {
+        cpu += 3;
+        cpus.push_back(atoi(cpu));
+    }
+    size_t columns = cpus.size();
+    std::vector<unsigned long long>& previous = collector.interruptCounts;
+    bool primed = columns == previousColumns && previous.size() == irqs.size() * columns;
+    if (!primed) {
+        previous.assign(irqs.size() * columns, 0); // New vectors or CPUs brought on or offline
+    }
+    collector.interruptRow.resize(columns);
+    unsigned long long* row = collector.interruptRow.data();
+
+    size_t next = 0;
+    for (position = lineEnd + 1; position < end && next < irqs.size() && sample.irqCount < MAX_QUEUE_IRQS;
+         position = lineEnd + 1) {
+        lineEnd = static_cast<const char*>(memchr(position, '\n', end - position));
+        lineEnd = lineEnd != nullptr ? lineEnd : end;
+        while (position < lineEnd && *position == ' ') {
+            ++position;
+        }
+        // Named rows such as "NMI:" follow the numbered ones
+        if (position == lineEnd || !isdigit(static_cast<unsigned char>(*position))) {
+            break;
+        }
+        int irq = 0;
+        while (position < lineEnd && isdigit(static_cast<unsigned char>(*position))) {
+            irq = irq * 10 + (*position++ - '0');
+        }
+        while (next < irqs.size() && irqs[next] < irq) {
+            ++next; // Vector without a row, e.g. freed since the metadata was read
+        }
+        if (next == irqs.size() || irqs[next] != irq || position == lineEnd || *position != ':' ||
+            !parseInterruptColumns(position + 1, lineEnd, columns, row)) {
+            continue;
+        }
+        QueueInterrupts& queue = sample.irqs[sample.irqCount++];
+        unsigned long long* last = &previous[next * columns];
+        unsigned long long interval = 0, busiest = 0, mostEver = 0;
+        size_t busiestColumn = 0, mostEverColumn = 0;
+        queue.irq = irq;
+        queue.count = 0;
+        for (size_t c = 0; c < columns; ++c) {
+            unsigned long long delta = primed && row[c] >= last[c] ? row[c] - last[c] : 0;
+            queue.count += row[c];
+            interval += delta;
+            if (delta > busiest) {
+                busiest = delta;
+                busiestColumn = c;
+            }
+            if (row[c] > mostEver) {
+                mostEver = row[c];
+                mostEverColumn = c;
+            }
+            last[c] = row[c];
+        }
+        // Without interrupts in the interval, the CPU that has taken the most so far
+        queue.busiestCpu = cpus[interval > 0 ? busiestColumn : mostEverColumn];
+        queue.busiestShare = interval > 0 ? static_cast<unsigned>(busiest * 100 / interval) : 0;
+        ++next;
+    }
+}
+
+/**
+ * @brief Collects network interface statistics
+ * @details Restores the interface, lower devices first, when it is seen going down.
+ * @param interface Name of the interface to monitor
+ * @param collector Per-interface collector state
+ * @param sample Reference to the sample receiving the statistics
+ * @throws runtime_error if a downed interface cannot be restored
+ */
+void gatherStats(const char* interface, CollectorState& collector, InterfaceSample& sample) {
+    std::string state;
+    char path[BUFFER_SIZE];
+    NETWATCH_PROBE1(sample__read__start, interface);
+
+    memset(&sample, 0, sizeof(sample));
+    strncpy(sample.name, interface, sizeof(sample.name) - 1);
+
+    // Read interface state
+    snprintf(path, sizeof(path), "/sys/class/net/%s/operstate", interface);
+    readSysfsValue(path, state);
+    strncpy(sample.state, state.c_str(), sizeof(sample.state) - 1);
+
+    // Read carrier counts
+    snprintf(path, sizeof(path), "/sys/class/net/%s/carrier_up_count", interface);
+    readSysfsValue(path, sample.upCount);
+    snprintf(path, sizeof(path), "/sys/class/net/%s/carrier_down_count", interface);
+    readSysfsValue(path, sample.downCount);
+
+    // Refresh cached metadata only when the link has changed
+    InterfaceMetadata& metadata = collector.metadata;
+    bool notified = collector.linkNotifyFd >= 0 && linkChanged(collector.linkNotifyFd, interface, metadata.ifindex);
+    if (!metadata.valid || notified || sample.upCount != collector.lastUpCount ||
+        sample.downCount != collector.lastDownCount) {
+        loadMetadata(interface, metadata);
+        collector.interruptCounts.clear(); // The vectors may have changed
+        collector.lastUpCount = sample.upCount;
+        collector.lastDownCount = sample.downCount;
+    }
+    sample.ifindex = metadata.ifindex;
+    sample.speedMbps = metadata.speedMbps;
+    sample.mtu = metadata.mtu;
+    if (!metadata.owner.empty()) {
+        sample.peerIfindex = metadata.peerIfindex;
+        strncpy(sample.owner, metadata.owner.c_str(), sizeof(sample.owner) - 1);
+    }
+
+    // Read the transmit and receive statistics that are consumed; rates divide by the time between these reads
+    sample.sampledAt = g_clock->monotonic();
+    sample.counterMask = collector.counterMask;
+    for (int c = 0; c < NUM_COUNTERS; ++c) {
+        if ((sample.counterMask & (1u << c)) == 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/sys/class/net/%s/statistics/%s", interface, COUNTER_NAMES[c]);
+        readSysfsValue(path, sample.counters[c]);
+    }
+    readQueueInterrupts(collector, sample);
+
+    // Check interface state and restore if down
+    if (state == "down" && collector.lastState != "down") {
+        std::cout << "!!! Interface " << interface << " ("
+                  << (metadata.driver.empty() ? "virtual" : metadata.driver)
+                  << ", " << metadata.address << ", mtu " << metadata.mtu
+                  << ") is DOWN - attempting to restore !!!" << std::endl << std::endl;
+        restoreInterface(interface);
+        collector.lastState = state;
+    } else if (state != "down") {
+        collector.lastState = state;
+    }
+
+    NETWATCH_PROBE3(sample__read__done, interface, sample.counters[RX_BYTES], sample.counters[TX_BYTES]);
+}
+
+/**
+ * @brief Formats a sample as the text report intfMonitor sends to networkMonitor
+ * @details Counters outside the sample's counter mask are left out of the report,
+ *          which ends with a blank line so the receiver can tell where it ends. The
+ *          sample time travels in microseconds, so the receiver computes rates over
+ *          the collector's intervals however late or bunched the reports arrive.
+ * @param sample The collected sample
+ * @param metadata Cached metadata of the interface
+ * @param data Reference to string that will contain the formatted statistics
+ */
+void formatStats(const InterfaceSample& sample, const InterfaceMetadata& metadata, std::string& data) {
+    data = "Interface: " + std::string(sample.name) + " state: " + sample.state +
+           " up_count: " + std::to_string(sample.upCount) +
+           " down_count: " + std::to_string(sample.downCount) +
+           " sampled_us: " + std::to_string(static_cast<unsigned long long>(sample.sampledAt * 1e6));
+    // One line of receive and one of transmit counters
+    const char* separator = "\n";
+    for (int c = 0; c < NUM_COUNTERS; ++c) {
+        if (c == TX_BYTES) {
+            separator = "\n";
+        }
+        if (sample.counterMask & (1u << c)) {
+            data += separator + std::string(COUNTER_NAMES[c]) + ": " + std::to_string(sample.counters[c]);
+            separator = " ";
+        }
+    }
+    data += std::string("\n") +
+           "ifindex: " + std::to_string(metadata.ifindex) +
+           " speed: " + std::to_string(metadata.speedMbps) +
+           " mtu: " + std::to_string(metadata.mtu) +
+           " driver: " + (metadata.driver.empty() ? "-" : metadata.driver) +
+           " pci: " + (metadata.pciAddress.empty() ? "-" : metadata.pciAddress) +
+           " address: " + (metadata.address.empty() ? "-" : metadata.address);
+    // Only interfaces attributed to a pod or container carry their owner
+    if (!metadata.owner.empty()) {
+        data += " peer: " + std::to_string(metadata.peerIfindex) + " owner: " + metadata.owner;
+    }
+    data += "\n";
+    // Devices with MSI add one line: the vector count, then irq, total count, busiest CPU and its share
+    if (sample.irqCount > 0) {
+        data += "irqs: " + std::to_string(sample.irqCount);
+        for (int i = 0; i < sample.irqCount; ++i) {
+            const QueueInterrupts& queue = sample.irqs[i];
+            data += " " + std::to_string(queue.irq) + " " + std::to_string(queue.count) + " " +
+                    std::to_string(queue.busiestCpu) + " " + std::to_string(queue.busiestShare);
+        }
+        data += "\n";
+    }
+    data += "\n";
+}
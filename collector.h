@@ -0,0 +1,60 @@
+/**
+ * @file collector.h
+ * @brief Collection engine shared by intfMonitor and libnetwatch.a
+ */
+#ifndef COLLECTOR_H
+#define COLLECTOR_H
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "interfaceSample.h"
+
+/**
+ * @brief Interface properties that only change on link events
+ */
+struct InterfaceMetadata {
+    bool valid = false;
+    int ifindex = 0;
+    int speedMbps = 0;
+    int mtu = 0;
+    std::string driver;
+    std::string pciAddress;
+    std::string address;
+    std::string kind;        // rtnetlink link kind, e.g. "veth", empty for physical devices
+    int peerIfindex = 0;     // IFLA_LINK: index of the peer inside its namespace
+    int peerNetnsId = -1;    // IFLA_LINK_NETNSID: peer namespace as seen from ours, -1 if local
+    std::string owner;       // "pod:<uid>", "container:<id>", "netns:<name>" or "pid:<pid>"
+    std::vector<int> irqs;   // MSI vectors of the device, ascending; empty for virtual devices
+};
+
+/**
+ * @brief Per-interface state kept between collections
+ */
+struct CollectorState {
+    std::string lastState;   // Track last known interface state
+    InterfaceMetadata metadata;
+    int lastUpCount = -1;
+    int lastDownCount = -1;
+    int linkNotifyFd = -1;   // Netlink socket for link change notifications, -1 to poll carrier counts only
+    unsigned counterMask = ALL_COUNTERS; // Counters consumed downstream; only these are read and sent
+    int interruptsFd = -1;   // /proc/interrupts, opened on first use and reread from the start
+    std::vector<char> interruptsText;                // Read buffer, grown to fit the file
+    std::vector<int> interruptCpus;                  // CPU of each column; offline CPUs have none
+    std::vector<unsigned long long> interruptCounts; // Per vector and column at the previous sample
+    std::vector<unsigned long long> interruptRow;    // Columns of the row being parsed
+};
+
+std::vector<std::string> getLowerDevices(const std::string& interface);
+void orderRestoreSubtree(const std::string& interface, std::set<std::string>& visited,
+                         std::vector<std::string>& order);
+int bringUpDevice(int socketFd, const char* interface);
+int restoreInterface(const char* interface);
+int openLinkNotifications();
+bool linkChanged(int fd, const char* interface, int ifindex);
+void loadMetadata(const char* interface, InterfaceMetadata& metadata);
+void gatherStats(const char* interface, CollectorState& collector, InterfaceSample& sample);
+void formatStats(const InterfaceSample& sample, const InterfaceMetadata& metadata, std::string& data);
+
+#endif // COLLECTOR_H
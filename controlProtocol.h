@@ -0,0 +1,137 @@
+/**
+ * @file controlProtocol.h
+ * @brief Binary protocol between netwatchctl and networkMonitor's control socket
+ * @details A connection carries frames: a ControlHeader followed by length bytes of
+ *          payload. A request frame carries at most one request struct. A response
+ *          frame carries any number of fixed-size records of the frame's type, so a
+ *          long listing costs one header per 64 KiB rather than per record. Every
+ *          response except tail ends with CTL_DONE or CTL_ERROR; tail streams
+ *          CTL_EVENT frames until either side closes. Both ends run on the same host,
+ *          so fields are in host byte order.
+ */
+#ifndef CONTROL_PROTOCOL_H
+#define CONTROL_PROTOCOL_H
+
+#include <cstdint>
+
+#include "interfaceSample.h"
+#include "monitorState.h"
+#include "sketch.h"
+#include "talkers.h"
+
+const char* const CONTROL_SOCKET_PATH = "/tmp/networkMonitor.ctl";
+const uint16_t CONTROL_MAGIC = 0x574e; // "NW"
+const uint8_t CONTROL_VERSION = 2;
+const uint32_t MAX_CONTROL_FRAME = 64 * 1024;
+const uint32_t MIN_INTERVAL_MS = 100;
+const uint32_t MAX_INTERVAL_MS = 3600 * 1000;
+const uint32_t MAX_CAPTURE_SECONDS = 300;
+const uint32_t MAX_CAPTURE_MIB = 1024;
+const uint32_t DEFAULT_CAPTURE_MIB = 64;
+
+enum ControlType : uint8_t {
+    // Requests
+    CTL_LIST = 1,       // No payload; answered with CTL_INTERFACE records
+    CTL_RATES,          // ControlTarget, empty name for all; answered with CTL_RATE records
+    CTL_HISTORY,        // ControlHistoryRequest; answered with CTL_HISTORY_RECORD records
+    CTL_RESTORE,        // ControlTarget; forwarded to the interface's monitor
+    CTL_SET_INTERVAL,   // ControlInterval, empty name for all; forwarded to the monitors
+    CTL_TAIL,           // No payload; subscribes to CTL_EVENT records
+    CTL_CAPTURE,        // ControlCapture, empty name for all; forwarded to the monitors
+    CTL_TALKERS,        // ControlTarget, empty name for all; answered with CTL_TALKER records
+    CTL_SKETCH,         // ControlSketchRequest, empty name for all; answered with CTL_SUMMARY records
+    // Responses
+    CTL_INTERFACE = 64, // ControlInterfaceRecord
+    CTL_RATE,           // ControlRateRecord
+    CTL_HISTORY_RECORD, // ControlHistoryRecord
+    CTL_EVENT,          // ControlEventRecord
+    CTL_DONE,           // ControlDone, ends a response
+    CTL_ERROR,          // Message text, ends a response
+    CTL_TALKER,         // ControlTalkerRecord
+    CTL_SUMMARY         // ControlSummaryRecord, one per frame
+};
+
+struct ControlHeader {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t type;
+    uint32_t length; // Payload bytes following the header
+};
+
+struct ControlTarget {
+    char name[MAX_IFACE_NAME];
+};
+
+struct ControlHistoryRequest {
+    char name[MAX_IFACE_NAME];
+    int64_t from, to; // Wall-clock seconds, inclusive
+};
+
+struct ControlInterval {
+    char name[MAX_IFACE_NAME];
+    uint32_t intervalMs;
+};
+
+struct ControlCapture {
+    char name[MAX_IFACE_NAME];
+    uint32_t seconds;
+    uint32_t maxMiB; // Size limit of the pcap file
+};
+
+struct ControlSketchRequest {
+    char name[MAX_IFACE_NAME];
+    uint32_t minutes; // Intervals of SKETCH_INTERVAL seconds to merge, the current one included
+};
+
+struct ControlInterfaceRecord {
+    char name[MAX_IFACE_NAME];
+    char state[16];
+    int32_t slot;
+    int32_t ifindex;
+    int32_t speedMbps;
+    int32_t mtu;
+    int32_t resetCount;
+    int32_t wrapCount;
+    int32_t peerIfindex;
+    char owner[MAX_OWNER_NAME]; // Pod or container of a veth peer, empty if none
+};
+
+struct ControlRateRecord {
+    char name[MAX_IFACE_NAME];
+    float rates[NUM_HORIZONS][NUM_COUNTERS]; // Per second
+    float utilization[2];                    // Percent of link speed, rx and tx
+};
+
+struct ControlHistoryRecord {
+    int64_t timestamp;
+    uint32_t minuteRollup; // Nonzero for a per-minute average, zero for a raw sample
+    float rates[NUM_COUNTERS];
+};
+
+struct ControlEventRecord {
+    int64_t timestamp;
+    int32_t kind; // MonitorEventKind
+    char name[MAX_IFACE_NAME];
+    char detail[32];
+    double value[2];
+};
+
+struct ControlTalkerRecord {
+    char name[MAX_IFACE_NAME];
+    TalkerKey key;
+    float bytesPerSecond;
+    float packetsPerSecond;
+    uint32_t flows; // Flows the interface carried in the last second
+};
+
+struct ControlSummaryRecord {
+    char name[MAX_IFACE_NAME];
+    FlowSummary summary;
+};
+static_assert(sizeof(ControlSummaryRecord) <= MAX_CONTROL_FRAME, "A summary must fit in one frame");
+
+struct ControlDone {
+    uint32_t records; // Records sent, or monitors notified for restore and interval
+};
+
+#endif // CONTROL_PROTOCOL_H
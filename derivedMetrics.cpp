@@ -0,0 +1,513 @@
+/**
+ * @file derivedMetrics.cpp
+ * @brief Compilation and column-wise evaluation of derived metrics
+ */
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#include "derivedMetrics.h"
+
+DerivedState g_derived;
+
+/**
+ * @brief Recursive-descent compiler from infix expression to postfix program
+ * @details Grammar: expr = term {(+|-) term}, term = unary {(*|/) unary},
+ *          unary = -unary | primary, primary = number | counter | (expr).
+ */
+class ExpressionCompiler {
+public:
+    ExpressionCompiler(const std::string& text, DerivedMetric& metric) : m_text(text), m_metric(metric) {}
+
+    bool compile(std::string& error) {
+        expression();
+        skipSpaces();
+        if (m_error.empty() && m_position != m_text.size()) {
+            fail("unexpected '" + m_text.substr(m_position, 1) + "'");
+        }
+        error = m_error;
+        return m_error.empty();
+    }
+
+private:
+    void skipSpaces() {
+        while (m_position < m_text.size() && isspace(static_cast<unsigned char>(m_text[m_position]))) {
+            ++m_position;
+        }
+    }
+
+    bool accept(char c) {
+        skipSpaces();
+        if (m_position < m_text.size() && m_text[m_position] == c) {
+            ++m_position;
+            return true;
+        }
+        return false;
+    }
+
+    void fail(const std::string& message) {
+        if (m_error.empty()) {
+            m_error = message + " at position " + std::to_string(m_position);
+        }
+    }
+
+    void emit(DerivedOp op, int counter = 0, double constant = 0.0) {
+        m_metric.program.push_back({op, counter, constant});
+        m_depth += (op == OP_COUNTER || op == OP_CONSTANT) ? 1 : (op == OP_NEG ? 0 : -1);
+        m_metric.depth = std::max(m_metric.depth, m_depth);
+    }
+
+    void expression() {
+        term();
+        for (;;) {
+            if (accept('+')) {
+                term();
+                emit(OP_ADD);
+            } else if (accept('-')) {
+                term();
+                emit(OP_SUB);
+            } else {
+                return;
+            }
+        }
+    }
+
+    void term() {
+        unary();
+        for (;;) {
+            if (accept('*')) {
+                unary();
+                emit(OP_MUL);
+            } else if (accept('/')) {
+                unary();
+                emit(OP_DIV);
+            } else {
+                return;
+            }
+        }
+    }
+
+    void unary() {
+        if (accept('-')) {
+            unary();
+            emit(OP_NEG);
+        } else {
+            primary();
+        }
+    }
+
+    void primary() {
+        skipSpaces();
+        if (!m_error.empty()) {
+            return;
+        }
+        if (accept('(')) {
+            expression();
+            if (!accept(')')) {
+                fail("missing ')'");
+            }
+            return;
+        }
+        const char* start = m_text.c_str() + m_position;
+        if (isdigit(static_cast<unsigned char>(*start)) || *start == '.') {
+            char* end;
+            double value = strtod(start, &end);
+            m_position += end - start;
+            emit(OP_CONSTANT, 0, value);
+            return;
+        }
+        size_t length = 0;
+        while (isalnum(static_cast<unsigned char>(start[length])) || start[length] == '_') {
+            ++length;
+        }
+        std::string name(start, length);
+        int counter = std::find(COUNTER_NAMES, COUNTER_NAMES + NUM_COUNTERS, name) - COUNTER_NAMES;
+        if (length == 0 || counter == NUM_COUNTERS) {
+            fail(length == 0 ? "expected a counter, number or '('" : "unknown counter '" + name + "'");
+            return;
+        }
+        m_position += length;
+        m_metric.inputs |= 1u << counter;
+        emit(OP_COUNTER, counter);
+    }
+
+    const std::string& m_text;
+    DerivedMetric& m_metric;
+    size_t m_position = 0;
+    int m_depth = 0;
+    std::string m_error;
+};
+
+/**
+ * @brief Checks that a metric or group name is usable as a history name
+ * @param name Proposed name
+ * @return true if it is a non-empty identifier distinct from the counters
+ */
+bool validName(const std::string& name) {
+    if (name.empty() || name.size() >= MAX_IFACE_NAME ||
+        std::find(COUNTER_NAMES, COUNTER_NAMES + NUM_COUNTERS, name) != COUNTER_NAMES + NUM_COUNTERS) {
+        return false;
+    }
+    for (char c : name) {
+        if (!isalnum(static_cast<unsigned char>(c)) && c != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Compiles and registers a derived metric
+ * @param definition "name=expression" or "name=expression>threshold"
+ * @param error Receives the reason a definition is rejected
+ * @return true if the metric was added
+ */
+bool addDerivedMetric(const std::string& definition, std::string& error) {
+    size_t equals = definition.find('=');
+    DerivedMetric metric;
+    metric.name = definition.substr(0, equals);
+    if (equals == std::string::npos || !validName(metric.name) || findDerivedMetric(metric.name) >= 0) {
+        error = "expected <name>=<expression> with a new name made of letters, digits and '_'";
+        return false;
+    }
+    if (g_derived.metrics.size() == static_cast<size_t>(MAX_DERIVED_METRICS)) {
+        error = "at most " + std::to_string(MAX_DERIVED_METRICS) +
+                " derived metrics, as their values share one history record per interface";
+        return false;
+    }
+    metric.expression = definition.substr(equals + 1);
+    size_t greater = metric.expression.find('>');
+    if (greater != std::string::npos) {
+        char* end;
+        metric.threshold = strtod(metric.expression.c_str() + greater + 1, &end);
+        metric.hasThreshold = true;
+        if (*end != '\0' || end == metric.expression.c_str() + greater + 1) {
+            error = "threshold after '>' must be a number";
+            return false;
+        }
+        metric.expression.resize(greater);
+    }
+    ExpressionCompiler compiler(metric.expression, metric);
+    if (!compiler.compile(error)) {
+        return false;
+    }
+    if (g_derived.stack.size() < static_cast<size_t>(metric.depth)) {
+        g_derived.stack.resize(metric.depth);
+    }
+    g_derived.metrics.push_back(metric);
+    return true;
+}
+
+/**
+ * @brief Registers a group whose derived metrics are computed over its members' summed rates
+ * @param definition "name=member,member,...", each an interface name or an owner key
+ * @param error Receives the reason a definition is rejected
+ * @return true if the group was added
+ */
+bool addInterfaceGroup(const std::string& definition, std::string& error) {
+    size_t equals = definition.find('=');
+    InterfaceGroup group;
+    group.name = definition.substr(0, equals);
+    if (equals == std::string::npos || !validName(group.name)) {
+        error = "expected <name>=<interface or owner>,<interface or owner>,...";
+        return false;
+    }
+    if (g_derived.groups.size() == static_cast<size_t>(MAX_INTERFACE_GROUPS)) {
+        error = "at most " + std::to_string(MAX_INTERFACE_GROUPS) + " groups";
+        return false;
+    }
+    std::istringstream members(definition.substr(equals + 1));
+    std::string member;
+    while (std::getline(members, member, ',')) {
+        if (!member.empty()) {
+            group.members.push_back(member);
+        }
+    }
+    g_derived.groups.push_back(group);
+    g_derived.slotNames.assign(g_derived.slotNames.size(), std::string()); // Re-resolve membership
+    return true;
+}
+
+/**
+ * @brief Looks up a derived metric by name
+ * @param name Metric name
+ * @return Index of the metric, -1 if there is none
+ */
+int findDerivedMetric(const std::string& name) {
+    for (size_t m = 0; m < g_derived.metrics.size(); ++m) {
+        if (g_derived.metrics[m].name == name) {
+            return static_cast<int>(m);
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Counters read by any derived metric, which collectors must keep sending
+ * @return Mask of (1 << counter) bits
+ */
+unsigned derivedInputs() {
+    unsigned inputs = 0;
+    for (const DerivedMetric& metric : g_derived.metrics) {
+        inputs |= metric.inputs;
+    }
+    return inputs;
+}
+
+/**
+ * @brief Memory held by the derived metric columns, for the live state account
+ * @return Bytes
+ */
+size_t derivedStateBytes() {
+    size_t bytes = g_derived.dirty.capacity() + g_derived.dirtySlots.capacity() * sizeof(int) +
+                   g_derived.groupMask.capacity() * sizeof(unsigned) +
+                   (g_derived.slotNames.capacity() + g_derived.slotOwners.capacity()) * sizeof(std::string);
+    for (int c = 0; c < NUM_COUNTERS; ++c) {
+        bytes += (g_derived.inputs[c].capacity() + g_derived.gathered[c].capacity()) * sizeof(double);
+    }
+    for (int m = 0; m < MAX_DERIVED_METRICS; ++m) {
+        bytes += g_derived.values[m].capacity() * sizeof(double) + g_derived.above[m].capacity();
+    }
+    for (const std::vector<double>& column : g_derived.stack) {
+        bytes += column.capacity() * sizeof(double);
+    }
+    return bytes;
+}
+
+/**
+ * @brief Records the rates of a new interval and queues the slot for evaluation
+ * @param slot Monitor slot
+ * @param name Interface name
+ * @param owner Pod or container owning the interface's veth peer, empty if none
+ * @param rates Per-second rate of every counter over the interval
+ */
+void markDerivedInputs(int slot, const char* name, const char* owner, const float rates[]) {
+    if (static_cast<size_t>(slot) >= g_derived.dirty.size()) {
+        size_t slots = slot + 1;
+        for (int c = 0; c < NUM_COUNTERS; ++c) {
+            g_derived.inputs[c].resize(slots, 0.0);
+        }
+        for (int m = 0; m < MAX_DERIVED_METRICS; ++m) {
+            g_derived.values[m].resize(slots, 0.0);
+            g_derived.above[m].resize(slots, 0);
+        }
+        g_derived.groupMask.resize(slots, 0);
+        g_derived.slotNames.resize(slots);
+        g_derived.slotOwners.resize(slots);
+        g_derived.dirty.resize(slots, 0);
+    }
+    for (int c = 0; c < NUM_COUNTERS; ++c) {
+        g_derived.inputs[c][slot] = rates[c];
+    }
+    if (g_derived.slotNames[slot] != name || g_derived.slotOwners[slot] != owner) {
+        g_derived.slotNames[slot] = name;
+        g_derived.slotOwners[slot] = owner;
+        g_derived.groupMask[slot] = 0;
+        for (size_t g = 0; g < g_derived.groups.size(); ++g) {
+            const std::vector<std::string>& members = g_derived.groups[g].members;
+            if (std::find(members.begin(), members.end(), g_derived.slotNames[slot]) != members.end() ||
+                (owner[0] != '\0' && std::find(members.begin(), members.end(), g_derived.slotOwners[slot]) != members.end())) {
+                g_derived.groupMask[slot] |= 1u << g;
+            }
+        }
+    }
+    if (!g_derived.dirty[slot]) {
+        g_derived.dirty[slot] = 1;
+        g_derived.dirtySlots.push_back(slot);
+    }
+}
+
+/**
+ * @brief Forgets the interface of a slot whose monitor disconnected
+ * @details The slot leaves its groups, which are recomputed without it at the next
+ *          evaluation.
+ * @param slot Monitor slot
+ */
+void clearDerivedSlot(int slot) {
+    if (static_cast<size_t>(slot) >= g_derived.dirty.size()) {
+        return;
+    }
+    for (int c = 0; c < NUM_COUNTERS; ++c) {
+        g_derived.inputs[c][slot] = 0.0;
+    }
+    for (int m = 0; m < MAX_DERIVED_METRICS; ++m) {
+        g_derived.values[m][slot] = 0.0;
+        g_derived.above[m][slot] = 0;
+    }
+    g_derived.dirtyGroups |= g_derived.groupMask[slot];
+    g_derived.groupMask[slot] = 0;
+    g_derived.slotNames[slot].clear();
+    g_derived.slotOwners[slot].clear();
+    if (g_derived.dirty[slot]) {
+        g_derived.dirty[slot] = 0;
+        std::vector<int>& dirtySlots = g_derived.dirtySlots;
+        dirtySlots.erase(std::find(dirtySlots.begin(), dirtySlots.end(), slot));
+    }
+}
+
+/**
+ * @brief Runs one compiled metric over the gathered inputs of n slots
+ * @param metric The metric
+ * @param n Number of dirty slots
+ * @return Column holding the n results
+ */
+const std::vector<double>& runProgram(const DerivedMetric& metric, size_t n) {
+    std::vector<std::vector<double>>& stack = g_derived.stack;
+    int top = 0;
+    for (const DerivedInstruction& instruction : metric.program) {
+        double* a = top >= 2 ? stack[top - 2].data() : nullptr;
+        const double* b = top >= 1 ? stack[top - 1].data() : nullptr;
+        switch (instruction.op) {
+        case OP_COUNTER:
+            stack[top].assign(g_derived.gathered[instruction.counter].begin(),
+                              g_derived.gathered[instruction.counter].begin() + n);
+            ++top;
+            break;
+        case OP_CONSTANT:
+            stack[top].assign(n, instruction.constant);
+            ++top;
+            break;
+        case OP_ADD:
+            for (size_t i = 0; i < n; ++i) a[i] += b[i];
+            --top;
+            break;
+        case OP_SUB:
+            for (size_t i = 0; i < n; ++i) a[i] -= b[i];
+            --top;
+            break;
+        case OP_MUL:
+            for (size_t i = 0; i < n; ++i) a[i] *= b[i];
+            --top;
+            break;
+        case OP_DIV:
+            // An idle interval divides by zero; report 0 rather than inf or NaN
+            for (size_t i = 0; i < n; ++i) a[i] = b[i] != 0.0 ? a[i] / b[i] : 0.0;
+            --top;
+            break;
+        case OP_NEG:
+            for (size_t i = 0; i < n; ++i) stack[top - 1][i] = -b[i];
+            break;
+        }
+    }
+    return stack[0];
+}
+
+/**
+ * @brief Evaluates every derived metric for the slots with a new interval
+ * @details Stores one history record per updated interface and per group with an
+ *          updated or departed member, and raises EVENT_THRESHOLD when an
+ *          interface's or a group's value crosses its threshold upwards. Group
+ *          events carry slot -1 and the group's name.
+ * @param now Wall-clock time of the evaluation
+ */
+void evaluateDerivedMetrics(time_t now) {
+    std::vector<int>& dirtySlots = g_derived.dirtySlots;
+    size_t n = dirtySlots.size();
+    if ((n == 0 && g_derived.dirtyGroups == 0) || g_derived.metrics.empty()) {
+        return;
+    }
+
+    // Gather the inputs of the dirty slots into contiguous columns
+    unsigned inputs = derivedInputs();
+    for (int c = 0; c < NUM_COUNTERS; ++c) {
+        if (inputs & (1u << c)) {
+            g_derived.gathered[c].resize(n);
+            for (size_t i = 0; i < n; ++i) {
+                g_derived.gathered[c][i] = g_derived.inputs[c][dirtySlots[i]];
+            }
+        }
+    }
+
+    for (size_t m = 0; m < g_derived.metrics.size(); ++m) {
+        const DerivedMetric& metric = g_derived.metrics[m];
+        const std::vector<double>& result = runProgram(metric, n);
+        for (size_t i = 0; i < n; ++i) {
+            int slot = dirtySlots[i];
+            g_derived.values[m][slot] = result[i];
+            bool above = metric.hasThreshold && result[i] > metric.threshold;
+            if (above && !g_derived.above[m][slot]) {
+                emitEvent(EVENT_THRESHOLD, slot, g_derived.slotNames[slot].c_str(), metric.name.c_str(),
+                          result[i], metric.threshold);
+            }
+            g_derived.above[m][slot] = above;
+        }
+    }
+
+    // One record per interface holds all its derived values
+    unsigned dirtyGroups = g_derived.dirtyGroups;
+    g_derived.dirtyGroups = 0;
+    for (int slot : dirtySlots) {
+        InterfaceState& state = g_interfaceStates[slot];
+        if (state.derivedHistory == nullptr) {
+            state.derivedHistory = &g_history[g_derived.slotNames[slot] + DERIVED_HISTORY_SUFFIX];
+        }
+        HistoryRecord record;
+        memset(&record, 0, sizeof(record));
+        record.timestamp = now;
+        for (size_t m = 0; m < g_derived.metrics.size(); ++m) {
+            record.rates[m] = static_cast<float>(g_derived.values[m][slot]);
+        }
+        appendHistory(state.derivedHistory->raw, record);
+        dirtyGroups |= g_derived.groupMask[slot];
+        g_derived.dirty[slot] = 0;
+    }
+    dirtySlots.clear();
+
+    // Groups sum the latest input rates of their members, one column entry per group,
+    // and run the same programs over the sums
+    int groups[MAX_INTERFACE_GROUPS];
+    size_t groupCount = 0;
+    for (size_t g = 0; g < g_derived.groups.size(); ++g) {
+        if (dirtyGroups & (1u << g)) {
+            groups[groupCount++] = static_cast<int>(g);
+        }
+    }
+    if (groupCount == 0) {
+        return;
+    }
+    for (int c = 0; c < NUM_COUNTERS; ++c) {
+        if (inputs & (1u << c)) {
+            g_derived.gathered[c].assign(groupCount, 0.0);
+        }
+    }
+    for (size_t slot = 0; slot < g_derived.groupMask.size(); ++slot) {
+        unsigned mask = g_derived.groupMask[slot] & dirtyGroups;
+        for (size_t i = 0; mask != 0 && i < groupCount; ++i) {
+            if ((mask & (1u << groups[i])) == 0) {
+                continue;
+            }
+            for (int c = 0; c < NUM_COUNTERS; ++c) {
+                if (inputs & (1u << c)) {
+                    g_derived.gathered[c][i] += g_derived.inputs[c][slot];
+                }
+            }
+        }
+    }
+    for (size_t m = 0; m < g_derived.metrics.size(); ++m) {
+        const DerivedMetric& metric = g_derived.metrics[m];
+        const std::vector<double>& result = runProgram(metric, groupCount);
+        for (size_t i = 0; i < groupCount; ++i) {
+            InterfaceGroup& group = g_derived.groups[groups[i]];
+            group.values[m] = result[i];
+            bool above = metric.hasThreshold && result[i] > metric.threshold;
+            if (above && !group.above[m]) {
+                emitEvent(EVENT_THRESHOLD, -1, group.name.c_str(), metric.name.c_str(), result[i], metric.threshold);
+            }
+            group.above[m] = above;
+        }
+    }
+    for (size_t i = 0; i < groupCount; ++i) {
+        InterfaceGroup& group = g_derived.groups[groups[i]];
+        HistoryRecord record;
+        memset(&record, 0, sizeof(record));
+        record.timestamp = now;
+        for (size_t m = 0; m < g_derived.metrics.size(); ++m) {
+            record.rates[m] = static_cast<float>(group.values[m]);
+        }
+        if (group.history == nullptr) {
+            group.history = &g_history[group.name + GROUP_HISTORY_SUFFIX];
+        }
+        appendHistory(group.history->raw, record);
+    }
+}
@@ -0,0 +1,99 @@
+/**
+ * @file derivedMetrics.h
+ * @brief User-defined metrics computed from counter rates, per interface and per group
+ * @details A definition such as "avg_packet=rx_bytes/rx_packets" is compiled once into
+ *          a postfix program. Counter names in an expression stand for the counter's
+ *          per-second rate over the last interval. Each tick the programs run column by
+ *          column over the interfaces that delivered a new interval, so every operator
+ *          is one tight loop over contiguous values. All derived values of an interface
+ *          share one history record, stored under "<interface>#derived", so they are
+ *          rolled up, expired and budgeted like the counters. That record has one
+ *          slot per counter, which caps the number of derived metrics at NUM_COUNTERS.
+ *          A group's record is stored under "<group>@group", so a group can never
+ *          write into the history of an interface of the same name.
+ */
+#ifndef DERIVED_METRICS_H
+#define DERIVED_METRICS_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "monitorState.h"
+
+const int MAX_DERIVED_METRICS = NUM_COUNTERS; // One history record holds every derived value
+const int MAX_INTERFACE_GROUPS = 32;
+const char* const DERIVED_HISTORY_SUFFIX = "#derived";
+const char* const GROUP_HISTORY_SUFFIX = "@group";
+
+enum DerivedOp : unsigned char { OP_COUNTER, OP_CONSTANT, OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_NEG };
+
+/**
+ * @brief One step of a compiled expression
+ */
+struct DerivedInstruction {
+    DerivedOp op;
+    int counter;      // OP_COUNTER
+    double constant;  // OP_CONSTANT
+};
+
+/**
+ * @brief A compiled derived metric
+ */
+struct DerivedMetric {
+    std::string name;
+    std::string expression;
+    std::vector<DerivedInstruction> program; // Postfix
+    int depth = 0;                           // Evaluation stack needed
+    unsigned inputs = 0;                     // Counters the program reads
+    bool hasThreshold = false;               // Crossing it upwards raises EVENT_THRESHOLD
+    double threshold = 0.0;
+};
+
+/**
+ * @brief Named set of interfaces evaluated as one
+ * @details The members' counter rates are summed and the derived metrics computed
+ *          from the sums, so a ratio over a group is the ratio of its totals.
+ *          Members are interface names or owner keys such as "pod:<uid>", which
+ *          match every interface whose veth peer belongs to that pod. Thresholds
+ *          apply to the group's values like to an interface's.
+ */
+struct InterfaceGroup {
+    std::string name;
+    std::vector<std::string> members;
+    double values[MAX_DERIVED_METRICS] = {};
+    bool above[MAX_DERIVED_METRICS] = {}; // Last value was over the threshold
+    InterfaceHistory* history = nullptr;
+};
+
+/**
+ * @brief Plans, inputs and results of every derived metric, in columns indexed by slot
+ */
+struct DerivedState {
+    std::vector<DerivedMetric> metrics;
+    std::vector<InterfaceGroup> groups;
+    std::vector<double> inputs[NUM_COUNTERS];          // Rates of the last interval
+    std::vector<double> values[MAX_DERIVED_METRICS];   // Latest derived values
+    std::vector<unsigned char> above[MAX_DERIVED_METRICS]; // Last value was over the threshold
+    std::vector<unsigned> groupMask;                   // Groups each slot's interface belongs to
+    std::vector<std::string> slotNames;                // Interface groupMask was resolved for
+    std::vector<std::string> slotOwners;               // Owner of its veth peer, see InterfaceSample::owner
+    std::vector<unsigned char> dirty;                  // New interval since the last evaluation
+    std::vector<int> dirtySlots;
+    unsigned dirtyGroups = 0;                          // Groups whose members changed since the last evaluation
+    std::vector<double> gathered[NUM_COUNTERS];        // Inputs of the dirty slots, contiguous
+    std::vector<std::vector<double>> stack;            // Evaluation columns, reused every tick
+};
+
+extern DerivedState g_derived;
+
+bool addDerivedMetric(const std::string& definition, std::string& error);
+bool addInterfaceGroup(const std::string& definition, std::string& error);
+int findDerivedMetric(const std::string& name);
+unsigned derivedInputs();
+size_t derivedStateBytes();
+void markDerivedInputs(int slot, const char* name, const char* owner, const float rates[]);
+void clearDerivedSlot(int slot);
+void evaluateDerivedMetrics(time_t now);
+
+#endif // DERIVED_METRICS_H
@@ -0,0 +1,56 @@
+/**
+ * @file interfaceSample.h
+ * @brief One sample of an interface's counters, shared by collector and monitor
+ */
+#ifndef INTERFACE_SAMPLE_H
+#define INTERFACE_SAMPLE_H
+
+const int MAX_IFACE_NAME = 32;
+const int MAX_OWNER_NAME = 64;
+const int MAX_QUEUE_IRQS = 64; // MSI vectors reported per interface; further ones are left out
+
+// Counters carried in every report, in report order; names match sysfs statistics/
+enum Counter {
+    RX_BYTES, RX_DROPPED, RX_ERRORS, RX_PACKETS,
+    TX_BYTES, TX_DROPPED, TX_ERRORS, TX_PACKETS,
+    NUM_COUNTERS
+};
+const char* const COUNTER_NAMES[NUM_COUNTERS] = {
+    "rx_bytes", "rx_dropped", "rx_errors", "rx_packets",
+    "tx_bytes", "tx_dropped", "tx_errors", "tx_packets"
+};
+
+// Sets of counters, bit (1 << counter) per member
+const unsigned ALL_COUNTERS = (1u << NUM_COUNTERS) - 1;
+const unsigned UTILIZATION_COUNTERS = (1u << RX_BYTES) | (1u << TX_BYTES); // Always collected
+
+/**
+ * @brief Interrupts of one MSI vector of the interface's device, usually one queue
+ */
+struct QueueInterrupts {
+    int irq;
+    int busiestCpu;           // CPU that took most of the vector's interrupts since the previous sample
+    unsigned busiestShare;    // Percent of those interrupts it took, 0 if there were none
+    unsigned long long count; // Total over all CPUs since boot, from /proc/interrupts
+};
+
+/**
+ * @brief Counters and link properties of one interface at one point in time
+ */
+struct InterfaceSample {
+    char name[MAX_IFACE_NAME];
+    char state[16];
+    int upCount, downCount;
+    unsigned long long counters[NUM_COUNTERS];
+    unsigned counterMask; // Counters the collector read; the others are zero
+    double sampledAt;     // Collector's Clock::monotonic() just before the counters were read
+    int ifindex;
+    int speedMbps;
+    int mtu;
+    int peerIfindex;            // Index of a veth peer in another namespace, 0 if none
+    char owner[MAX_OWNER_NAME]; // Pod, container or namespace holding the peer, empty if none
+    int irqCount;               // Vectors in irqs, 0 for devices without MSI
+    QueueInterrupts irqs[MAX_QUEUE_IRQS];
+};
+
+#endif // INTERFACE_SAMPLE_H
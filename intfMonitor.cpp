@@ -4,28 +4,42 @@
  * @details This program monitors network interface statistics and reports them
  *          to a parent process via UNIX domain socket.
  */
+#include <algorithm>
 #include <cstring>
 #include <fcntl.h>
-#include <fstream>
 #include <iostream>
-#include <net/if.h>
+#include <poll.h>
 #include <signal.h>
-#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include "capture.h"
+#include "collector.h"
+#include "monitorClock.h"
+#include "perfCounters.h"
+#include "probes.h"
+
 // Constants
 const char* SOCKET_PATH = "/tmp/networkMonitor";
-const int BUFFER_SIZE = 256;
-const int MAX_IFACE_NAME = 32;
+const int BUFFER_SIZE = 4096; // Holds the longest report, owner and MAX_QUEUE_IRQS vectors included
+const double DEFAULT_INTERVAL = 1.0; // Seconds between samples until the parent changes it
+const double MIN_INTERVAL = 0.1;
+const double MAX_INTERVAL = 3600.0;
 
 // Global variables
 bool g_isActive = true;
 std::string g_interfaceStats;
-std::string g_lastState;  // Track last known interface state
+CollectorState g_collector;
+double g_interval = DEFAULT_INTERVAL;
+pid_t g_capturePid = -1; // Child running a packet capture, -1 if none
+
+// Collector stages measured with hardware counters when built with PERF=1; the
+// monitor's stages in monitorState.h keep the names Stage and g_perfStages
+enum CollectorStage { STAGE_COLLECT, STAGE_ENCODE, STAGE_SEND, NUM_COLLECTOR_STAGES };
+PerfStage g_collectorStages[NUM_COLLECTOR_STAGES] = {{"collect", 0, {}}, {"encode", 0, {}}, {"send", 0, {}}};
 
 /**
  * @brief Establishes a connection to the parent process via UNIX domain socket
@@ -50,162 +64,144 @@ int establishConnection() {
 }
 
 /**
- * @brief Restores network interface to operational state
- * @param interface Name of the network interface to restore
- * @return 0 on success, EXIT_FAILURE on failure
+ * @brief Monitors and reports interface statistics
+ * @param interfaceName Name of the interface to monitor
+ * @param socket File descriptor of the connection to parent process
  */
-int restoreInterface(const char* interface) {
-    struct ifreq ifr;
-    memset(&ifr, 0, sizeof(ifr));
-    strncpy(ifr.ifr_name, interface, IFNAMSIZ);
-    ifr.ifr_name[IFNAMSIZ - 1] = '\0';
-    ifr.ifr_flags = IFF_UP;
-    int socketFd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (socketFd < 0) {
-        throw std::runtime_error("!!! intfMonitor.cpp !!!- Socket creation failed: " + std::string(strerror(errno)));
-    }
-    int result = ioctl(socketFd, SIOCSIFFLAGS, &ifr);
-    if (result < 0) {
-        throw std::runtime_error("!!! intfMonitor.cpp !!!- Failed to bring interface up: '" + std::string(interface) +
-                                "' - " + std::string(strerror(errno)));
+void monitorInterface(const char* interfaceName, int socket) {
+    char buffer[BUFFER_SIZE];
+    InterfaceSample sample;
+    memset(buffer, 0, sizeof(buffer));
+    PERF_BEGIN(collectStart);
+    gatherStats(interfaceName, g_collector, sample);
+    PERF_END(g_collectorStages[STAGE_COLLECT], collectStart);
+    PERF_BEGIN(encodeStart);
+    formatStats(sample, g_collector.metadata, g_interfaceStats);
+    PERF_END(g_collectorStages[STAGE_ENCODE], encodeStart);
+    strncpy(buffer, g_interfaceStats.c_str(), BUFFER_SIZE - 1);
+    buffer[BUFFER_SIZE - 1] = '\0';
+    PERF_BEGIN(sendStart);
+    ssize_t sent = write(socket, buffer, strlen(buffer));
+    if (sent < 0) {
+        std::cerr << "!!! intfMonitor.cpp !!!- Failed to send data: "
+                  << strerror(errno) << std::endl;
     }
-    close(socketFd);
-    return result;
+    NETWATCH_PROBE2(send, interfaceName, sent);
+    PERF_END(g_collectorStages[STAGE_SEND], sendStart);
 }
 
 /**
- * @brief Collects network interface statistics
- * @param interface Name of the interface to monitor
- * @param data Reference to string that will contain the formatted statistics
+ * @brief Captures the interface's packets to a pcap file in a child process
+ * @details Sampling continues while the child captures; one capture runs at a time.
+ * @param interfaceName Name of the monitored interface
+ * @param socket File descriptor of the connection to parent process, closed in the child
+ * @param limits When the capture stops
  */
-void gatherStats(const char* interface, std::string& data) {
-    std::string state;
-    int upCount = 0, downCount = 0;
-    int txBytes = 0, rxBytes = 0;
-    int rxDropped = 0, rxErrors = 0;
-    int txPackets = 0, rxPackets = 0;
-    int txDropped = 0, txErrors = 0;
-    char path[BUFFER_SIZE];
-    std::ifstream file;
-
-    // Read interface state
-    snprintf(path, sizeof(path), "/sys/class/net/%s/operstate", interface);
-    file.open(path);
-    if (file.is_open()) {
-        file >> state;
-        file.close();
+void startCapture(const char* interfaceName, int socket, const CaptureLimits& limits) {
+    if (g_capturePid > 0) {
+        std::cerr << "!!! intfMonitor.cpp !!!- Capture of " << interfaceName << " already running" << std::endl;
+        return;
     }
-
-    // Read carrier counts
-    snprintf(path, sizeof(path), "/sys/class/net/%s/carrier_up_count", interface);
-    file.open(path);
-    if (file.is_open()) {
-        file >> upCount;
-        file.close();
-    }
-    snprintf(path, sizeof(path), "/sys/class/net/%s/carrier_down_count", interface);
-    file.open(path);
-    if (file.is_open()) {
-        file >> downCount;
-        file.close();
-    }
-
-    // Read transmit statistics
-    snprintf(path, sizeof(path), "/sys/class/net/%s/statistics/tx_bytes", interface);
-    file.open(path);
-    if (file.is_open()) {
-        file >> txBytes;
-        file.close();
-    }
-
-    // Read receive statistics
-    snprintf(path, sizeof(path), "/sys/class/net/%s/statistics/rx_bytes", interface);
-    file.open(path);
-    if (file.is_open()) {
-        file >> rxBytes;
-        file.close();
+    char path[BUFFER_SIZE], stamp[32];
+    time_t now = g_clock->wallTime();
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&now));
+    snprintf(path, sizeof(path), "%s/%s-%s.pcap", CAPTURE_DIRECTORY, interfaceName, stamp);
+    std::cout << std::flush; // Keep buffered output from being printed twice
+    g_capturePid = fork();
+    if (g_capturePid < 0) {
+        std::cerr << "!!! intfMonitor.cpp !!!- Failed to start capture: " << strerror(errno) << std::endl;
+    } else if (g_capturePid == 0) {
+        close(socket);
+        int status = EXIT_SUCCESS;
+        try {
+            CaptureResult result;
+            capturePackets(interfaceName, limits, path, result);
+            std::cout << "!!! Captured " << result.packets << " packets (" << result.bytes << " bytes, "
+                      << result.drops << " dropped) on " << interfaceName << " to " << path << " !!!" << std::endl;
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+            status = EXIT_FAILURE;
+        }
+        _exit(status);
     }
+}
 
-    // Read dropped packets
-    snprintf(path, sizeof(path), "/sys/class/net/%s/statistics/rx_dropped", interface);
-    file.open(path);
-    if (file.is_open()) {
-        file >> rxDropped;
-        file.close();
+/**
+ * @brief Reaps the capture child once it has finished
+ */
+void reapCapture() {
+    if (g_capturePid > 0 && waitpid(g_capturePid, nullptr, WNOHANG) == g_capturePid) {
+        g_capturePid = -1;
     }
+}
 
-    // Read errors
-    snprintf(path, sizeof(path), "/sys/class/net/%s/statistics/rx_errors", interface);
-    file.open(path);
-    if (file.is_open()) {
-        file >> rxErrors;
-        file.close();
+/**
+ * @brief Executes one command from the parent
+ * @details Commands: "restore", "interval <milliseconds>", "counters <hex mask>",
+ *          the set of counters networkMonitor consumes, and "capture <seconds> <bytes>".
+ * @param interfaceName Name of the monitored interface
+ * @param socket File descriptor of the connection to parent process
+ * @param line Command without the newline
+ */
+void executeParentCommand(const char* interfaceName, int socket, const char* line) {
+    unsigned intervalMs, counterMask, seconds;
+    unsigned long long maxBytes;
+    if (strcmp(line, "restore") == 0) {
+        std::cout << "!!! Restore of " << interfaceName << " requested !!!" << std::endl;
+        try {
+            restoreInterface(interfaceName);
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+        }
+    } else if (sscanf(line, "interval %u", &intervalMs) == 1) {
+        g_interval = std::min(MAX_INTERVAL, std::max(MIN_INTERVAL, intervalMs / 1000.0));
+    } else if (sscanf(line, "counters %x", &counterMask) == 1) {
+        g_collector.counterMask = (counterMask & ALL_COUNTERS) | UTILIZATION_COUNTERS;
+    } else if (sscanf(line, "capture %u %llu", &seconds, &maxBytes) == 2 && seconds > 0) {
+        startCapture(interfaceName, socket, {static_cast<double>(seconds), maxBytes});
+    } else {
+        std::cerr << "!!! intfMonitor.cpp !!!- Unknown command from parent: " << line << std::endl;
     }
+}
 
-    // Read packet counts
-    snprintf(path, sizeof(path), "/sys/class/net/%s/statistics/tx_packets", interface);
-    file.open(path);
-    if (file.is_open()) {
-        file >> txPackets;
-        file.close();
-    }
-    snprintf(path, sizeof(path), "/sys/class/net/%s/statistics/tx_dropped", interface);
-    file.open(path);
-    if (file.is_open()) {
-        file >> txDropped;
-        file.close();
-    }
-    snprintf(path, sizeof(path), "/sys/class/net/%s/statistics/tx_errors", interface);
-    file.open(path);
-    if (file.is_open()) {
-        file >> txErrors;
-        file.close();
-    }
-    snprintf(path, sizeof(path), "/sys/class/net/%s/statistics/rx_packets", interface);
-    file.open(path);
-    if (file.is_open()) {
-        file >> rxPackets;
-        file.close();
+/**
+ * @brief Executes the commands the parent forwarded from netwatchctl
+ * @details Commands are single short lines sent in one write each.
+ * @param interfaceName Name of the monitored interface
+ * @param socket File descriptor of the connection to parent process
+ */
+void handleParentCommands(const char* interfaceName, int socket) {
+    char buffer[BUFFER_SIZE];
+    ssize_t bytesRead = read(socket, buffer, BUFFER_SIZE - 1);
+    if (bytesRead <= 0) {
+        if (bytesRead == 0 || errno != EINTR) {
+            g_isActive = false; // Parent is gone
+        }
+        return;
     }
-
-    // Check interface state and restore if down
-    if (state == "down" && g_lastState != "down") {
-        std::cout << "!!! Interface " << interface
-                  << " is DOWN - attempting to restore !!!" << std::endl << std::endl;
-        restoreInterface(interface);
-        g_lastState = state;
-    } else if (state != "down") {
-        g_lastState = state;
+    buffer[bytesRead] = '\0';
+    for (char* line = strtok(buffer, "\n"); line != nullptr; line = strtok(nullptr, "\n")) {
+        executeParentCommand(interfaceName, socket, line);
     }
-
-    // Format statistics
-    data = "Interface: " + std::string(interface) + " state: " + state +
-           " up_count: " + std::to_string(upCount) +
-           " down_count: " + std::to_string(downCount) + "\n" +
-           "rx_bytes: " + std::to_string(rxBytes) +
-           " rx_dropped: " + std::to_string(rxDropped) +
-           " rx_errors: " + std::to_string(rxErrors) +
-           " rx_packets: " + std::to_string(rxPackets) + "\n" +
-           "tx_bytes: " + std::to_string(txBytes) +
-           " tx_dropped: " + std::to_string(txDropped) +
-           " tx_errors: " + std::to_string(txErrors) +
-           " tx_packets: " + std::to_string(txPackets) + "\n";
 }
 
 /**
- * @brief Monitors and reports interface statistics
- * @param interfaceName Name of the interface to monitor
+ * @brief Waits until the next sample is due, executing parent commands meanwhile
+ * @param interfaceName Name of the monitored interface
  * @param socket File descriptor of the connection to parent process
  */
-void monitorInterface(const char* interfaceName, int socket) {
-    char buffer[BUFFER_SIZE];
-    memset(buffer, 0, sizeof(buffer));
-    gatherStats(interfaceName, g_interfaceStats);
-    strncpy(buffer, g_interfaceStats.c_str(), BUFFER_SIZE - 1);
-    buffer[BUFFER_SIZE - 1] = '\0';
-    if (write(socket, buffer, strlen(buffer)) < 0) {
-        std::cerr << "!!! intfMonitor.cpp !!!- Failed to send data: "
-                  << strerror(errno) << std::endl;
+void waitForNextSample(const char* interfaceName, int socket) {
+    double sampledAt = g_clock->monotonic();
+    while (g_isActive) {
+        reapCapture();
+        double remaining = sampledAt + g_interval - g_clock->monotonic();
+        if (remaining <= 0.0) {
+            return;
+        }
+        struct pollfd parent = {socket, POLLIN, 0};
+        if (poll(&parent, 1, static_cast<int>(remaining * 1000.0) + 1) > 0) {
+            handleParentCommands(interfaceName, socket);
+        }
     }
 }
 
@@ -251,6 +247,7 @@ int main(int argc, char* argv[]) {
         
         // Establish connection and initialize monitoring
         int socket = establishConnection();
+        g_collector.linkNotifyFd = openLinkNotifications();
         write(socket, "ready_to_monitor", 16);
         char buffer[BUFFER_SIZE];
         int bytesRead = read(socket, buffer, BUFFER_SIZE - 1);
@@ -259,15 +256,32 @@ int main(int argc, char* argv[]) {
                                     std::string(strerror(errno)));
         }
         buffer[bytesRead] = '\0';
-        if (strcmp(buffer, "start_monitoring") != 0) {
+        // The handshake may carry a first command, e.g. the counters to collect
+        if (strncmp(buffer, "start_monitoring", 16) != 0) {
             throw std::runtime_error("Unexpected message received: " +
                                     std::string(buffer));
         }
+        if (buffer[16] == ' ') {
+            executeParentCommand(interfaceName, socket, buffer + 17);
+        }
         
         // Main monitoring loop
         while (g_isActive) {
             monitorInterface(interfaceName, socket);
-            sleep(1);
+            waitForNextSample(interfaceName, socket);
+        }
+        if (PERF_COUNTERS_ENABLED) {
+            printPerfStages(std::cout, g_collectorStages, NUM_COLLECTOR_STAGES);
+        }
+        if (g_capturePid > 0) {
+            kill(g_capturePid, SIGTERM); // Records are written whole, so the pcap stays readable
+            waitpid(g_capturePid, nullptr, 0);
+        }
+        if (g_collector.linkNotifyFd >= 0) {
+            close(g_collector.linkNotifyFd);
+        }
+        if (g_collector.interruptsFd >= 0) {
+            close(g_collector.interruptsFd);
         }
         close(socket);
         return EXIT_SUCCESS;
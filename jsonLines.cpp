@@ -0,0 +1,349 @@
+/**
+ * @file jsonLines.cpp
+ * @brief Hand-written JSON Lines serializer for samples and events
+ */
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+#include "jsonLines.h"
+
+const size_t MAX_INTEGER = 20; // Longest std::to_chars output of a 64-bit integer
+const size_t MAX_NUMBER = 24;  // Longest shortest-form std::to_chars output of a double
+const size_t MAX_ESCAPE = 6;   // A control character becomes \u00XX
+
+// Longest sample line: every string fully escaped, every number at its widest, all counters and vectors
+static_assert(256 + MAX_ESCAPE * (MAX_IFACE_NAME + sizeof(InterfaceSample::state) + MAX_OWNER_NAME) +
+              NUM_COUNTERS * (2 * 16 + MAX_INTEGER + MAX_NUMBER) +
+              MAX_QUEUE_IRQS * (33 + 3 * 11 + MAX_NUMBER) <= JSON_LINE_MAX,
+              "JSON_LINE_MAX must hold the longest sample line");
+
+/**
+ * @brief Copies a string literal
+ * @param out Output position
+ * @param text Literal, copied without its terminator
+ * @return Position after the copy
+ */
+template <size_t N>
+char* appendLiteral(char* out, const char (&text)[N]) {
+    memcpy(out, text, N - 1);
+    return out + N - 1;
+}
+
+/**
+ * @brief Copies text that needs no escaping, such as a counter name
+ * @param out Output position
+ * @param text Null-terminated text
+ * @return Position after the copy
+ */
+char* appendRaw(char* out, const char* text) {
+    size_t length = strlen(text);
+    memcpy(out, text, length);
+    return out + length;
+}
+
+/**
+ * @brief Tells whether a byte must be escaped inside a JSON string
+ * @param c Byte
+ * @return true for control characters, quotes and backslashes
+ */
+inline bool needsEscape(unsigned char c) {
+    return c < 0x20 || c == '"' || c == '\\';
+}
+
+/**
+ * @brief Appends a quoted JSON string
+ * @details The leading run without escapes, normally the whole string, is copied
+ *          in one go. Bytes from 0x80 up pass through, so UTF-8 names stay readable.
+ * @param out Output position
+ * @param text Text, null-terminated or filling capacity
+ * @param capacity Size of the array holding text
+ * @return Position after the closing quote
+ */
+char* appendString(char* out, const char* text, size_t capacity) {
+    static const char HEX[] = "0123456789abcdef";
+    size_t length = strnlen(text, capacity);
+    size_t plain = 0;
+    while (plain < length && !needsEscape(static_cast<unsigned char>(text[plain]))) {
+        ++plain;
+    }
+    *out++ = '"';
+    memcpy(out, text, plain);
+    out += plain;
+    for (size_t i = plain; i < length; ++i) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (!needsEscape(c)) {
+            *out++ = static_cast<char>(c);
+        } else if (c == '"' || c == '\\') {
+            *out++ = '\\';
+            *out++ = static_cast<char>(c);
+        } else if (c == '\n') {
+            out = appendLiteral(out, "\\n");
+        } else if (c == '\t') {
+            out = appendLiteral(out, "\\t");
+        } else {
+            out = appendLiteral(out, "\\u00");
+            *out++ = HEX[c >> 4];
+            *out++ = HEX[c & 0xf];
+        }
+    }
+    *out++ = '"';
+    return out;
+}
+
+/**
+ * @brief Appends an integer
+ * @param out Output position
+ * @param value Value
+ * @return Position after the digits
+ */
+template <typename Integer>
+char* appendInteger(char* out, Integer value) {
+    return std::to_chars(out, out + MAX_INTEGER, value).ptr;
+}
+
+/**
+ * @brief Appends a number in the shortest form that reads back exactly
+ * @param out Output position
+ * @param value Value; NaN and infinities, which JSON cannot carry, become null
+ * @return Position after the number
+ */
+char* appendNumber(char* out, double value) {
+    if (!std::isfinite(value)) {
+        return appendLiteral(out, "null");
+    }
+    return std::to_chars(out, out + MAX_NUMBER, value == 0.0 ? 0.0 : value).ptr; // No "-0"
+}
+
+/**
+ * @brief Appends a rate or percentage rounded to one decimal
+ * @details Formatted as integer tenths, several times faster than a shortest-form
+ *          double; values too large for that take appendNumber().
+ * @param out Output position
+ * @param value Value
+ * @return Position after the number
+ */
+char* appendRate(char* out, double value) {
+    double tenths = std::round(value * 10.0);
+    if (!(std::fabs(tenths) < 1e18)) {
+        return appendNumber(out, tenths / 10.0);
+    }
+    long long scaled = static_cast<long long>(tenths);
+    if (scaled < 0) {
+        *out++ = '-';
+        scaled = -scaled;
+    }
+    out = appendInteger(out, scaled / 10);
+    if (scaled % 10 != 0) {
+        *out++ = '.';
+        *out++ = static_cast<char>('0' + scaled % 10);
+    }
+    return out;
+}
+
+/**
+ * @brief Appends the counters of a set as one JSON object
+ * @param out Output position
+ * @param mask Counters to include, bit (1 << counter) per member
+ * @param values Integer counters, or nullptr to take the rates of slot instead
+ * @param slot Monitor slot whose 1 s rates are written when values is nullptr
+ * @return Position after the closing brace
+ */
+char* appendCounters(char* out, unsigned mask, const unsigned long long* values, int slot) {
+    *out++ = '{';
+    bool first = true;
+    for (int c = 0; c < NUM_COUNTERS; ++c) {
+        if ((mask & (1u << c)) == 0) {
+            continue;
+        }
+        if (!first) {
+            *out++ = ',';
+        }
+        *out++ = '"';
+        out = appendRaw(out, COUNTER_NAMES[c]);
+        out = appendLiteral(out, "\":");
+        out = values != nullptr ? appendInteger(out, values[c]) : appendRate(out, g_rates.rates[0][c][slot]);
+        first = false;
+    }
+    *out++ = '}';
+    return out;
+}
+
+/**
+ * @brief Ends a serialized line, writing the buffer out if another might not fit
+ * @param writer Writer
+ * @param out Position after the line's newline
+ */
+void finishLine(JsonLinesWriter& writer, char* out) {
+    writer.length = out - writer.buffer;
+    ++writer.lines;
+    if (JSON_LINES_BUFFER - writer.length < JSON_LINE_MAX) {
+        flushJsonLines(writer);
+    }
+}
+
+/**
+ * @brief Opens a JSON Lines file for appending
+ * @param path File path, created if missing
+ * @param writer Writer, empty
+ * @throws runtime_error if the file cannot be opened
+ */
+void openJsonLines(const char* path, JsonLinesWriter& writer) {
+    writer.fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (writer.fd < 0) {
+        throw std::runtime_error("!!! jsonLines.cpp !!!- Failed to open " + std::string(path) + ": " +
+                                 std::string(strerror(errno)));
+    }
+    writer.length = 0;
+    writer.flushedAt = g_clock->monotonic();
+}
+
+/**
+ * @brief Writes out the buffered lines and closes the file
+ * @param writer Writer, closed afterwards
+ */
+void closeJsonLines(JsonLinesWriter& writer) {
+    if (writer.fd >= 0) {
+        flushJsonLines(writer);
+        close(writer.fd);
+        writer.fd = -1;
+    }
+}
+
+/**
+ * @brief Writes out the buffered lines
+ * @details A failed write drops the buffer, counted in bytesDropped, so a full disk
+ *          costs lines rather than stalling ingestion.
+ * @param writer Writer
+ * @return false if a write failed
+ */
+bool flushJsonLines(JsonLinesWriter& writer) {
+    bool ok = true;
+    for (size_t written = 0; written < writer.length;) {
+        ssize_t result = write(writer.fd, writer.buffer + written, writer.length - written);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            writer.bytesDropped += writer.length - written;
+            ok = false;
+            break;
+        }
+        written += result;
+        writer.bytesWritten += result;
+    }
+    writer.flushes += writer.length > 0;
+    writer.length = 0;
+    writer.flushedAt = g_clock->monotonic();
+    return ok;
+}
+
+/**
+ * @brief Writes out the buffered lines once the oldest may have waited JSON_LINES_FLUSH_INTERVAL
+ * @param writer Writer
+ */
+void flushJsonLinesIfDue(JsonLinesWriter& writer) {
+    double now = g_clock->monotonic();
+    if (writer.length == 0) {
+        writer.flushedAt = now; // The next line starts the wait
+    } else if (now - writer.flushedAt >= JSON_LINES_FLUSH_INTERVAL) {
+        flushJsonLines(writer);
+    }
+}
+
+/**
+ * @brief Serializes the latest sample of an interface with its rates and utilization
+ * @details Counters the collector did not read are left out, as are rates until the
+ *          interface has two samples, utilization for links of unknown speed, the
+ *          owner of interfaces without a veth peer and the irqs of devices without MSI.
+ * @param writer Writer
+ * @param slot Monitor slot holding a sample
+ * @param timestamp Wall clock time of the sample
+ */
+void appendSampleJson(JsonLinesWriter& writer, int slot, time_t timestamp) {
+    const InterfaceState& state = g_interfaceStates[slot];
+    const InterfaceSample& sample = state.last;
+    char* out = writer.buffer + writer.length;
+    out = appendLiteral(out, "{\"ts\":");
+    out = appendInteger(out, static_cast<long long>(timestamp));
+    out = appendLiteral(out, ",\"type\":\"sample\",\"interface\":");
+    out = appendString(out, sample.name, sizeof(sample.name));
+    out = appendLiteral(out, ",\"state\":");
+    out = appendString(out, sample.state, sizeof(sample.state));
+    out = appendLiteral(out, ",\"up\":");
+    out = appendInteger(out, sample.upCount);
+    out = appendLiteral(out, ",\"down\":");
+    out = appendInteger(out, sample.downCount);
+    out = appendLiteral(out, ",\"speed\":");
+    out = appendInteger(out, sample.speedMbps);
+    out = appendLiteral(out, ",\"mtu\":");
+    out = appendInteger(out, sample.mtu);
+    if (state.lastSampleReset) {
+        out = appendLiteral(out, ",\"reset\":true");
+    }
+    out = appendLiteral(out, ",\"counters\":");
+    out = appendCounters(out, sample.counterMask & ALL_COUNTERS, sample.counters, slot);
+    if (g_rates.primed[slot]) {
+        out = appendLiteral(out, ",\"rates\":");
+        out = appendCounters(out, sample.counterMask & ALL_COUNTERS, nullptr, slot);
+    }
+    if (sample.speedMbps > 0) {
+        out = appendLiteral(out, ",\"utilization\":{\"rx\":");
+        out = appendRate(out, state.rx.percent);
+        out = appendLiteral(out, ",\"tx\":");
+        out = appendRate(out, state.tx.percent);
+        *out++ = '}';
+    }
+    if (sample.owner[0] != '\0') {
+        out = appendLiteral(out, ",\"owner\":");
+        out = appendString(out, sample.owner, sizeof(sample.owner));
+    }
+    if (sample.irqCount > 0) {
+        out = appendLiteral(out, ",\"irqs\":[");
+        for (int i = 0; i < std::min(sample.irqCount, MAX_QUEUE_IRQS); ++i) {
+            const QueueInterrupts& queue = sample.irqs[i];
+            if (i > 0) {
+                *out++ = ',';
+            }
+            out = appendLiteral(out, "{\"irq\":");
+            out = appendInteger(out, queue.irq);
+            out = appendLiteral(out, ",\"rate\":");
+            out = appendRate(out, state.irqRates[i]);
+            out = appendLiteral(out, ",\"cpu\":");
+            out = appendInteger(out, queue.busiestCpu);
+            out = appendLiteral(out, ",\"share\":");
+            out = appendInteger(out, queue.busiestShare);
+            *out++ = '}';
+        }
+        *out++ = ']';
+    }
+    out = appendLiteral(out, "}\n");
+    finishLine(writer, out);
+}
+
+/**
+ * @brief Serializes an event
+ * @param writer Writer
+ * @param event Event, as passed to g_eventSink
+ */
+void appendEventJson(JsonLinesWriter& writer, const MonitorEvent& event) {
+    char* out = writer.buffer + writer.length;
+    out = appendLiteral(out, "{\"ts\":");
+    out = appendInteger(out, static_cast<long long>(event.timestamp));
+    out = appendLiteral(out, ",\"type\":\"event\",\"event\":\"");
+    out = appendRaw(out, event.kind >= 0 && event.kind < NUM_EVENT_KINDS ? EVENT_KIND_NAMES[event.kind] : "unknown");
+    out = appendLiteral(out, "\",\"interface\":");
+    out = appendString(out, event.name, sizeof(event.name));
+    out = appendLiteral(out, ",\"detail\":");
+    out = appendString(out, event.detail, sizeof(event.detail));
+    out = appendLiteral(out, ",\"value\":[");
+    out = appendNumber(out, event.value[0]);
+    *out++ = ',';
+    out = appendNumber(out, event.value[1]);
+    out = appendLiteral(out, "]}\n");
+    finishLine(writer, out);
+}
@@ -0,0 +1,48 @@
+/**
+ * @file jsonLines.h
+ * @brief JSON Lines output of samples and events, one object per line
+ * @details Lines are serialized by hand straight into a fixed buffer: numbers with
+ *          std::to_chars, strings with a copy-through fast path when they need no
+ *          escaping, as interface names never do in practice. Nothing allocates, so
+ *          the sink can run in the ingest path. The buffer is written out when the
+ *          next line might not fit, and by flushJsonLinesIfDue() once lines have
+ *          waited JSON_LINES_FLUSH_INTERVAL, so a quiet stream still reaches the
+ *          log pipeline promptly.
+ *
+ *          {"ts":1700000060,"type":"sample","interface":"eth0","state":"up",...}
+ *          {"ts":1700000061,"type":"event","event":"saturation","interface":"eth0",...}
+ */
+#ifndef JSON_LINES_H
+#define JSON_LINES_H
+
+#include <cstddef>
+#include <ctime>
+
+#include "monitorState.h"
+
+const size_t JSON_LINES_BUFFER = 64 * 1024;   // Written out when fewer than JSON_LINE_MAX bytes are left
+const size_t JSON_LINE_MAX = 8192;            // Longest line: a sample with MAX_QUEUE_IRQS vectors
+const double JSON_LINES_FLUSH_INTERVAL = 1.0; // Seconds a line may wait in the buffer
+
+/**
+ * @brief Buffered JSON Lines destination
+ */
+struct JsonLinesWriter {
+    int fd = -1;
+    size_t length = 0;       // Bytes buffered
+    double flushedAt = 0.0;  // Clock::monotonic() of the last flush
+    size_t lines = 0;        // Lines serialized
+    size_t flushes = 0;      // Writes of the buffer
+    size_t bytesWritten = 0;
+    size_t bytesDropped = 0; // Lost to failed writes
+    char buffer[JSON_LINES_BUFFER];
+};
+
+void openJsonLines(const char* path, JsonLinesWriter& writer);
+void closeJsonLines(JsonLinesWriter& writer);
+bool flushJsonLines(JsonLinesWriter& writer);
+void flushJsonLinesIfDue(JsonLinesWriter& writer);
+void appendSampleJson(JsonLinesWriter& writer, int slot, time_t timestamp);
+void appendEventJson(JsonLinesWriter& writer, const MonitorEvent& event);
+
+#endif // JSON_LINES_H
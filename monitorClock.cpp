@@ -0,0 +1,8 @@
+/**
+ * @file monitorClock.cpp
+ * @brief The clock every timer reads, defined once for all binaries in libnetwatch.a
+ */
+#include "monitorClock.h"
+
+SystemClock g_systemClock;
+Clock* g_clock = &g_systemClock;
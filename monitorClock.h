@@ -0,0 +1,97 @@
+/**
+ * @file monitorClock.h
+ * @brief Clock abstraction shared by intfMonitor and networkMonitor
+ * @details All timing logic (sampling period, rate intervals, history timestamps,
+ *          retention) reads time through a Clock so that it can run on virtual time
+ *          in networkMonitor's --simulate mode. Latency measurements of the code
+ *          itself keep using CLOCK_MONOTONIC directly.
+ */
+#ifndef MONITOR_CLOCK_H
+#define MONITOR_CLOCK_H
+
+#include <ctime>
+
+/**
+ * @brief Source of time and of waiting
+ */
+class Clock {
+public:
+    virtual ~Clock() = default;
+
+    /**
+     * @brief Seconds since an arbitrary fixed point, never going backwards
+     */
+    virtual double monotonic() const = 0;
+
+    /**
+     * @brief Wall-clock time in seconds since the epoch
+     */
+    virtual time_t wallTime() const = 0;
+
+    /**
+     * @brief Waits for the given time, or less if interrupted by a signal
+     * @param seconds Time to wait
+     */
+    virtual void sleepFor(double seconds) = 0;
+};
+
+/**
+ * @brief Clock backed by the operating system
+ */
+class SystemClock : public Clock {
+public:
+    double monotonic() const override {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec + now.tv_nsec / 1e9;
+    }
+
+    time_t wallTime() const override {
+        return time(nullptr);
+    }
+
+    void sleepFor(double seconds) override {
+        struct timespec duration;
+        duration.tv_sec = static_cast<time_t>(seconds);
+        duration.tv_nsec = static_cast<long>((seconds - duration.tv_sec) * 1e9);
+        nanosleep(&duration, nullptr);
+    }
+};
+
+/**
+ * @brief Clock that only moves when told to, for deterministic simulation
+ */
+class VirtualClock : public Clock {
+public:
+    explicit VirtualClock(time_t start) : m_start(start), m_elapsed(0.0) {}
+
+    double monotonic() const override {
+        return m_elapsed;
+    }
+
+    time_t wallTime() const override {
+        return m_start + static_cast<time_t>(m_elapsed);
+    }
+
+    void sleepFor(double seconds) override {
+        advance(seconds);
+    }
+
+    /**
+     * @brief Moves virtual time forward
+     * @param seconds Time to add
+     */
+    void advance(double seconds) {
+        m_elapsed += seconds;
+    }
+
+private:
+    time_t m_start;
+    double m_elapsed;
+};
+
+// Every timer reads time through g_clock; both are defined in monitorClock.cpp
+extern SystemClock g_systemClock;
+extern Clock* g_clock;           // Virtual in --simulate mode
+
+#endif // MONITOR_CLOCK_H
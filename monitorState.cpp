@@ -0,0 +1,1048 @@
+/**
+ * @file monitorState.cpp
+ * @brief Sample processing engine shared by networkMonitor and libnetwatch.a
+ */
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+
+#include "derivedMetrics.h"
+#include "monitorState.h"
+#include "probes.h"
+#include "sketch.h"
+
+std::vector<InterfaceState> g_interfaceStates;
+RateTable g_rates(0);
+bool g_printSamples = true;
+bool g_hugePages = false;
+std::map<std::string, InterfaceHistory> g_history;
+std::string g_compactionCursor;                    // Interface the next compaction pass starts at
+time_t g_rawRetention = DEFAULT_RAW_RETENTION;
+size_t g_memoryBudget = 0;
+size_t g_memoryUsage[NUM_MEM_SUBSYSTEMS] = {};
+time_t g_lastRetentionChange = 0;
+bool g_fixedCostsWarned = false;                   // Fixed costs alone exceeded the budget
+std::vector<std::pair<time_t, InterfaceHistory*>> g_evictionHeap; // Histories by oldest block, reused
+PipelineStats g_stats;
+PerfStage g_perfStages[NUM_STAGES] = {{"ingest", 0, {}}, {"render", 0, {}}};
+SlabPool<HistoryBlock> g_blockPool;
+SlabPool<HistorySegment> g_segmentPool;
+MonitorEventSink g_eventSink = nullptr;
+
+/**
+ * @brief Maps a 2 MiB-aligned chunk, preferring huge pages
+ * @details Tries reserved hugetlbfs pages first. Without them it maps twice the size,
+ *          trims to an aligned 2 MiB window and asks for transparent huge pages.
+ * @return Mapped memory of HUGE_PAGE_BYTES, nullptr on failure
+ */
+void* mapHugeChunk() {
+    void* memory = mmap(nullptr, HUGE_PAGE_BYTES, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (memory != MAP_FAILED) {
+        return memory;
+    }
+    memory = mmap(nullptr, 2 * HUGE_PAGE_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return nullptr;
+    }
+    char* start = static_cast<char*>(memory);
+    char* aligned = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(start) + HUGE_PAGE_BYTES - 1) &
+                                            ~(HUGE_PAGE_BYTES - 1));
+    if (aligned > start) {
+        munmap(start, aligned - start);
+    }
+    munmap(aligned + HUGE_PAGE_BYTES, start + 2 * HUGE_PAGE_BYTES - (aligned + HUGE_PAGE_BYTES));
+    madvise(aligned, HUGE_PAGE_BYTES, MADV_HUGEPAGE);
+    return aligned;
+}
+
+/**
+ * @brief Sets the number of monitor slots, keeping the state of existing ones
+ * @param slots Number of slots
+ */
+void resizeSlots(size_t slots) {
+    g_interfaceStates.resize(slots);
+    g_rates.primed.resize(slots, 0);
+    for (int h = 0; h < NUM_HORIZONS; ++h) {
+        for (int c = 0; c < NUM_COUNTERS; ++c) {
+            g_rates.rates[h][c].resize(slots, 0.0);
+        }
+    }
+}
+
+/**
+ * @brief Bounds-checked read position in a report being decoded
+ * @details Every reader is a no-op once ok is false, so a decode runs straight
+ *          through and is checked once at the end instead of after every field.
+ */
+struct ReportCursor {
+    const char* position;
+    const char* end;
+    bool ok;
+};
+
+/**
+ * @brief Skips the spaces and newlines separating fields, stopping at the blank line that ends a report
+ * @param cursor Decode position
+ */
+void skipSeparators(ReportCursor& cursor) {
+    while (cursor.position < cursor.end &&
+           (*cursor.position == ' ' ||
+            (*cursor.position == '\n' && (cursor.end - cursor.position < 2 || cursor.position[1] != '\n')))) {
+        ++cursor.position;
+    }
+}
+
+/**
+ * @brief Consumes a field key such as "rx_bytes:"
+ * @param cursor Decode position
+ * @param key Expected key including the colon
+ */
+void expectKey(ReportCursor& cursor, const char* key) {
+    skipSeparators(cursor);
+    size_t length = strlen(key);
+    cursor.ok = cursor.ok && static_cast<size_t>(cursor.end - cursor.position) >= length &&
+                memcmp(cursor.position, key, length) == 0;
+    cursor.position += cursor.ok ? length : 0;
+}
+
+/**
+ * @brief Consumes an optional field key if it comes next
+ * @param cursor Decode position, left where it was if the key is absent
+ * @param key Key including the colon
+ * @return true if the key was present and consumed
+ */
+bool acceptKey(ReportCursor& cursor, const char* key) {
+    const char* start = cursor.position;
+    skipSeparators(cursor);
+    size_t length = strlen(key);
+    bool present = cursor.ok && static_cast<size_t>(cursor.end - cursor.position) >= length &&
+                   memcmp(cursor.position, key, length) == 0;
+    cursor.position = present ? cursor.position + length : start; // Keeps the report's final newline
+    return present;
+}
+
+/**
+ * @brief Decodes an unsigned decimal value
+ * @param cursor Decode position
+ * @param limit Largest accepted value
+ * @return The value, 0 if the cursor failed
+ */
+unsigned long long readUnsigned(ReportCursor& cursor, unsigned long long limit) {
+    skipSeparators(cursor);
+    const char* start = cursor.position;
+    unsigned long long value = 0;
+    bool overflow = false;
+    while (cursor.ok && cursor.position < cursor.end) {
+        unsigned digit = static_cast<unsigned char>(*cursor.position) - '0';
+        if (digit > 9) {
+            break;
+        }
+        overflow |= value > (limit - digit) / 10;
+        value = value * 10 + digit;
+        ++cursor.position;
+    }
+    cursor.ok = cursor.ok && cursor.position > start && !overflow;
+    return cursor.ok ? value : 0;
+}
+
+/**
+ * @brief Decodes a printable token such as an interface name
+ * @param cursor Decode position
+ * @param out Receives the NUL-terminated token, nullptr to skip it
+ * @param capacity Size of out including the terminator
+ */
+void readToken(ReportCursor& cursor, char* out, size_t capacity) {
+    skipSeparators(cursor);
+    const char* start = cursor.position;
+    while (cursor.ok && cursor.position < cursor.end &&
+           static_cast<unsigned char>(*cursor.position - 0x21) < 0x5e) {
+        ++cursor.position;
+    }
+    size_t length = cursor.position - start;
+    cursor.ok = cursor.ok && length > 0 && (out == nullptr || length < capacity);
+    if (cursor.ok && out != nullptr) {
+        memcpy(out, start, length);
+        out[length] = '\0';
+    }
+}
+
+/**
+ * @brief Decodes one report sent by intfMonitor
+ * @details Trusts nothing about the input: it need not be NUL-terminated, every
+ *          read is bounds-checked, numbers are overflow-checked and tokens must be
+ *          printable ASCII that fits its field. A report ends with a blank line, so a
+ *          report cut short anywhere never decodes. Reports that arrive back to back
+ *          in one read are decoded one call at a time using the returned length.
+ * @param data Received bytes
+ * @param length Number of received bytes
+ * @param sample Reference to the sample receiving the decoded fields
+ * @return Bytes consumed by the report, 0 if the data is not a well-formed report
+ */
+size_t decodeSample(const char* data, size_t length, InterfaceSample& sample) {
+    ReportCursor cursor = {data, data + length, true};
+    expectKey(cursor, "Interface:");
+    readToken(cursor, sample.name, sizeof(sample.name));
+    expectKey(cursor, "state:");
+    readToken(cursor, sample.state, sizeof(sample.state));
+    expectKey(cursor, "up_count:");
+    sample.upCount = static_cast<int>(readUnsigned(cursor, INT_MAX));
+    expectKey(cursor, "down_count:");
+    sample.downCount = static_cast<int>(readUnsigned(cursor, INT_MAX));
+    expectKey(cursor, "sampled_us:");
+    sample.sampledAt = readUnsigned(cursor, ULLONG_MAX) / 1e6;
+
+    static const char* const keys[NUM_COUNTERS] = {
+        "rx_bytes:", "rx_dropped:", "rx_errors:", "rx_packets:",
+        "tx_bytes:", "tx_dropped:", "tx_errors:", "tx_packets:"
+    };
+    // Collectors only send the counters networkMonitor asked for, in this order
+    sample.counterMask = 0;
+    for (int c = 0; c < NUM_COUNTERS; ++c) {
+        sample.counters[c] = 0;
+        if (acceptKey(cursor, keys[c])) {
+            sample.counters[c] = readUnsigned(cursor, ULLONG_MAX);
+            sample.counterMask |= 1u << c;
+        }
+    }
+
+    expectKey(cursor, "ifindex:");
+    sample.ifindex = static_cast<int>(readUnsigned(cursor, INT_MAX));
+    expectKey(cursor, "speed:");
+    sample.speedMbps = static_cast<int>(readUnsigned(cursor, INT_MAX));
+    expectKey(cursor, "mtu:");
+    sample.mtu = static_cast<int>(readUnsigned(cursor, INT_MAX));
+    expectKey(cursor, "driver:");
+    readToken(cursor, nullptr, 0);
+    expectKey(cursor, "pci:");
+    readToken(cursor, nullptr, 0);
+    expectKey(cursor, "address:");
+    readToken(cursor, nullptr, 0);
+    // Present only for veth interfaces whose peer was attributed to a pod or container
+    sample.peerIfindex = 0;
+    sample.owner[0] = '\0';
+    if (acceptKey(cursor, "peer:")) {
+        sample.peerIfindex = static_cast<int>(readUnsigned(cursor, INT_MAX));
+        expectKey(cursor, "owner:");
+        readToken(cursor, sample.owner, sizeof(sample.owner));
+    }
+    // Present only for devices with MSI vectors
+    sample.irqCount = 0;
+    if (acceptKey(cursor, "irqs:")) {
+        sample.irqCount = static_cast<int>(readUnsigned(cursor, MAX_QUEUE_IRQS));
+        for (int i = 0; i < sample.irqCount; ++i) {
+            QueueInterrupts& queue = sample.irqs[i];
+            queue.irq = static_cast<int>(readUnsigned(cursor, INT_MAX));
+            queue.count = readUnsigned(cursor, ULLONG_MAX);
+            queue.busiestCpu = static_cast<int>(readUnsigned(cursor, INT_MAX));
+            queue.busiestShare = static_cast<unsigned>(readUnsigned(cursor, 100));
+        }
+    }
+    // The report ends with its last line's newline and a blank line; include both so the next report starts cleanly
+    cursor.ok = cursor.ok && cursor.end - cursor.position >= 2 && memcmp(cursor.position, "\n\n", 2) == 0;
+    return cursor.ok ? cursor.position + 2 - data : 0;
+}
+
+/**
+ * @brief Largest increase a counter can plausibly show over an interval
+ * @param counter Counter index
+ * @param speedMbps Link speed reported by the interface, 0 if unknown
+ * @param seconds Time elapsed since the previous sample
+ * @return Upper bound on the increase, 0 if the link speed is unknown or no time elapsed
+ */
+unsigned long long counterCeiling(int counter, int speedMbps, double seconds) {
+    if (speedMbps <= 0 || seconds <= 0.0) {
+        return 0;
+    }
+    // Twice line rate leaves room for sampling jitter
+    double bytes = speedMbps * 1e6 / 8.0 * seconds * 2.0;
+    bool isBytes = counter == RX_BYTES || counter == TX_BYTES;
+    return static_cast<unsigned long long>(isBytes ? bytes : bytes / MIN_FRAME_BYTES);
+}
+
+/**
+ * @brief Computes the increase of a counter, telling wraps apart from resets
+ * @param previous Counter value in the previous sample
+ * @param current Counter value in the current sample
+ * @param ceiling Largest plausible increase for the interval, 0 if unknown
+ * @param delta Receives the increase, 0 for a reset
+ * @return How the increase was derived
+ */
+DeltaKind counterDelta(unsigned long long previous, unsigned long long current,
+                       unsigned long long ceiling, unsigned long long& delta) {
+    if (current >= previous) {
+        delta = current - previous;
+        return DeltaKind::Normal;
+    }
+    // Drivers exporting 32-bit counters roll over at 2^32; only a small increase is a wrap
+    if (previous <= UINT32_MAX) {
+        unsigned long long wrapped = (UINT32_MAX - previous) + current + 1;
+        if (wrapped <= (ceiling != 0 ? ceiling : UINT32_MAX / 2)) {
+            delta = wrapped;
+            return DeltaKind::Wrap32;
+        }
+    } else if (previous > ULLONG_MAX / 2) {
+        unsigned long long wrapped = (ULLONG_MAX - previous) + current + 1;
+        if (wrapped <= (ceiling != 0 ? ceiling : UINT32_MAX)) {
+            delta = wrapped;
+            return DeltaKind::Wrap64;
+        }
+    }
+    delta = 0;
+    return DeltaKind::Reset;
+}
+
+/**
+ * @brief Detects a recreated or reloaded interface from sample-level evidence
+ * @param previous The previous sample
+ * @param current The current sample
+ * @return Description of the reset, nullptr if the counters continue
+ */
+const char* detectReset(const InterfaceSample& previous, const InterfaceSample& current) {
+    if (current.ifindex != previous.ifindex) {
+        return "ifindex changed";
+    }
+    if (current.upCount < previous.upCount || current.downCount < previous.downCount) {
+        return "carrier counts went backwards";
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Updates utilization and saturation tracking for one link direction
+ * @param util Utilization state of the direction
+ * @param deltaBytes Bytes transferred since the previous sample
+ * @param seconds Time elapsed since the previous sample
+ * @param speedMbps Link speed reported by the interface, 0 if unknown
+ * @param finished Receives the episode that ended with this sample, if any
+ * @return true if a saturation episode ended with this sample
+ */
+bool updateUtilization(LinkUtilization& util, unsigned long long deltaBytes, double seconds,
+                       int speedMbps, SaturationEpisode& finished) {
+    if (speedMbps <= 0 || seconds <= 0.0) {
+        util.percent = 0.0;
+        return false;
+    }
+    util.percent = (deltaBytes * 8.0) / (seconds * speedMbps * 1e6) * 100.0;
+
+    if (util.percent >= SATURATION_THRESHOLD) {
+        util.secondsAboveThreshold += seconds;
+        if (!util.episode.active) {
+            util.episode.active = true;
+            util.episode.start = g_clock->wallTime();
+            util.episode.peak = 0.0;
+            util.episode.duration = 0.0;
+        }
+        util.episode.peak = std::max(util.episode.peak, util.percent);
+        util.episode.duration += seconds;
+        return false;
+    }
+    if (util.episode.active) {
+        finished = util.episode;
+        util.episode.active = false;
+        ++util.episodeCount;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Prints a saturation episode that has just ended
+ * @param interface Name of the interface
+ * @param direction "rx" or "tx"
+ * @param episode The finished episode
+ */
+void reportSaturation(const char* interface, const char* direction, const SaturationEpisode& episode) {
+    char started[32];
+    strftime(started, sizeof(started), "%Y-%m-%d %H:%M:%S", localtime(&episode.start));
+    printf("Saturation episode on %s %s: start %s, peak %.1f%%, duration %.0fs\n",
+           interface, direction, started, episode.peak, episode.duration);
+}
+
+/**
+ * @brief Folds one interval's counter increases into the EWMA rates of a slot
+ * @param slot Monitor slot the deltas belong to
+ * @param deltas Counter increases since the previous sample
+ * @param seconds Time elapsed since the previous sample
+ */
+void updateRates(int slot, const unsigned long long deltas[], double seconds) {
+    if (seconds <= 0.0) {
+        return;
+    }
+    for (int h = 0; h < NUM_HORIZONS; ++h) {
+        // Samples are late or early only by scheduling jitter; exp() is needed only off schedule
+        double decay = fabs(seconds - NOMINAL_INTERVAL) < 0.05 ? g_rates.nominalDecay[h]
+                                                               : exp(-seconds / RATE_HORIZONS[h]);
+        for (int c = 0; c < NUM_COUNTERS; ++c) {
+            double instant = deltas[c] / seconds;
+            double& rate = g_rates.rates[h][c][slot];
+            rate = g_rates.primed[slot] ? instant + decay * (rate - instant) : instant;
+        }
+    }
+    g_rates.primed[slot] = 1;
+}
+
+/**
+ * @brief Clears the EWMA rates of a slot whose monitor went away
+ * @param slot Monitor slot to clear
+ */
+void resetRates(int slot) {
+    for (int h = 0; h < NUM_HORIZONS; ++h) {
+        for (int c = 0; c < NUM_COUNTERS; ++c) {
+            g_rates.rates[h][c][slot] = 0.0;
+        }
+    }
+    g_rates.primed[slot] = 0;
+}
+
+/**
+ * @brief Summary of the oldest block of a non-empty tier
+ * @param segments Segments of the tier
+ * @return Index entry of the block
+ */
+const HistoryBlockSummary& oldestBlock(const std::vector<HistorySegment*>& segments) {
+    return segments.front()->summaries[segments.front()->start / SAMPLES_PER_BLOCK];
+}
+
+/**
+ * @brief Index one past the last block in use by a segment
+ * @param segment The segment
+ * @return Blocks filled so far, released ones included
+ */
+size_t blockEnd(const HistorySegment& segment) {
+    return (segment.size + SAMPLES_PER_BLOCK - 1) / SAMPLES_PER_BLOCK;
+}
+
+/**
+ * @brief Index of the oldest block still held by a segment
+ * @param segment The segment
+ * @return Blocks released from the front
+ */
+size_t firstBlock(const HistorySegment& segment) {
+    return segment.start / SAMPLES_PER_BLOCK;
+}
+
+/**
+ * @brief Timestamp of the newest record in a non-empty segment
+ * @param segment The segment
+ * @return Timestamp of the last record
+ */
+time_t lastTimestamp(const HistorySegment& segment) {
+    return segment.summaries[blockEnd(segment) - 1].last;
+}
+
+/**
+ * @brief Releases the oldest block of a non-empty tier, and its segment once that is empty
+ * @param segments Segments of the tier
+ */
+void dropOldestBlock(std::vector<HistorySegment*>& segments) {
+    HistorySegment* segment = segments.front();
+    g_blockPool.release(segment->blocks[firstBlock(*segment)]);
+    segment->start = std::min(segment->start + SAMPLES_PER_BLOCK, segment->size);
+    if (segment->start == segment->size) {
+        g_segmentPool.release(segment);
+        segments.erase(segments.begin());
+    }
+}
+
+/**
+ * @brief Appends a record to a history tier, maintaining the block index
+ * @param segments Segments of the tier
+ * @param record Record to append; timestamps must not decrease
+ */
+void appendHistory(std::vector<HistorySegment*>& segments, const HistoryRecord& record) {
+    if (segments.empty() || segments.back()->size == SEGMENT_RECORDS) {
+        segments.push_back(g_segmentPool.allocate());
+    }
+    HistorySegment& segment = *segments.back();
+    size_t block = segment.size / SAMPLES_PER_BLOCK;
+    size_t offset = segment.size % SAMPLES_PER_BLOCK;
+    HistoryBlockSummary& summary = segment.summaries[block];
+    if (offset == 0) {
+        segment.blocks[block] = g_blockPool.allocate();
+        summary.first = record.timestamp;
+        std::copy(record.rates, record.rates + NUM_COUNTERS, summary.minRate);
+        std::copy(record.rates, record.rates + NUM_COUNTERS, summary.maxRate);
+    }
+    summary.last = record.timestamp;
+    for (int c = 0; c < NUM_COUNTERS; ++c) {
+        summary.minRate[c] = std::min(summary.minRate[c], record.rates[c]);
+        summary.maxRate[c] = std::max(summary.maxRate[c], record.rates[c]);
+    }
+    segment.blocks[block]->records[offset] = record;
+    ++segment.size;
+}
+
+/**
+ * @brief Aggregates the records of a history tier that fall in a time range
+ * @details The first segment and block are found by binary search on the sparse
+ *          index, and blocks whose summary rules out query.minRate are not scanned,
+ *          so the cost depends on the range queried rather than on total retention.
+ * @param segments Segments of the tier
+ * @param query Time range, counter and rate filter
+ * @param result Reference to the aggregates to update
+ */
+void queryHistory(const std::vector<HistorySegment*>& segments, const HistoryQuery& query,
+                  HistoryResult& result) {
+    auto segment = std::lower_bound(segments.begin(), segments.end(), query.from,
+                                    [](const HistorySegment* s, time_t t) { return lastTimestamp(*s) < t; });
+    for (; segment != segments.end(); ++segment) {
+        const HistorySegment& current = **segment;
+        const HistoryBlockSummary* summaries = current.summaries;
+        const HistoryBlockSummary* end = summaries + blockEnd(current);
+        const HistoryBlockSummary* block = std::lower_bound(summaries + firstBlock(current), end, query.from,
+                                      [](const HistoryBlockSummary& b, time_t t) { return b.last < t; });
+        for (; block != end; ++block) {
+            if (block->first > query.to) {
+                return;
+            }
+            if (block->maxRate[query.counter] < query.minRate) {
+                ++result.blocksSkipped;
+                continue;
+            }
+            ++result.blocksScanned;
+            size_t index = block - summaries;
+            size_t records = std::min(SAMPLES_PER_BLOCK, current.size - index * SAMPLES_PER_BLOCK);
+            for (size_t r = 0; r < records; ++r) {
+                const HistoryRecord& record = current.blocks[index]->records[r];
+                double rate = record.rates[query.counter];
+                if (record.timestamp < query.from || record.timestamp > query.to || rate < query.minRate) {
+                    continue;
+                }
+                result.min = result.matched == 0 ? rate : std::min(result.min, rate);
+                result.max = result.matched == 0 ? rate : std::max(result.max, rate);
+                result.sum += rate;
+                ++result.matched;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Visits every record of a history tier within a time range, oldest first
+ * @param segments Segments of one tier, oldest first
+ * @param from Earliest timestamp to visit
+ * @param to Latest timestamp to visit
+ * @param visit Called for each record in the range
+ * @param context Passed through to visit
+ * @return Number of records visited
+ */
+size_t scanHistory(const std::vector<HistorySegment*>& segments, time_t from, time_t to,
+                   HistoryVisitor visit, void* context) {
+    size_t visited = 0;
+    auto segment = std::lower_bound(segments.begin(), segments.end(), from,
+                                    [](const HistorySegment* s, time_t t) { return lastTimestamp(*s) < t; });
+    for (; segment != segments.end(); ++segment) {
+        const HistorySegment& current = **segment;
+        for (size_t r = current.start; r < current.size; ++r) {
+            const HistoryRecord& record = current.blocks[r / SAMPLES_PER_BLOCK]->records[r % SAMPLES_PER_BLOCK];
+            if (record.timestamp > to) {
+                return visited;
+            }
+            if (record.timestamp >= from) {
+                visit(record, context);
+                ++visited;
+            }
+        }
+    }
+    return visited;
+}
+
+/**
+ * @brief Adds a raw record to the pending minute, first appending that minute if the record starts another
+ * @param history History being compacted
+ * @param record Raw record, or nullptr to append the pending minute now
+ */
+void accumulateMinute(InterfaceHistory& history, const HistoryRecord* record) {
+    auto& pending = history.pending;
+    time_t minute = record != nullptr ? record->timestamp - record->timestamp % 60 : 0;
+    if (pending.count > 0 && (record == nullptr || minute != pending.minute)) {
+        HistoryRecord rollup;
+        rollup.timestamp = pending.minute;
+        for (int c = 0; c < NUM_COUNTERS; ++c) {
+            rollup.rates[c] = static_cast<float>(pending.sums[c] / pending.count);
+            pending.sums[c] = 0.0;
+        }
+        appendHistory(history.minutes, rollup);
+        pending.count = 0;
+    }
+    if (record != nullptr) {
+        pending.minute = minute;
+        for (int c = 0; c < NUM_COUNTERS; ++c) {
+            pending.sums[c] += record->rates[c];
+        }
+        ++pending.count;
+    }
+}
+
+/**
+ * @brief Rolls the oldest raw block of a history up into per-minute average rates and releases it
+ * @param history History with raw records
+ * @return Records rolled up
+ */
+size_t rollUpOldestBlock(InterfaceHistory& history) {
+    const HistorySegment& segment = *history.raw.front();
+    const HistoryBlock& block = *segment.blocks[firstBlock(segment)];
+    size_t records = std::min(SAMPLES_PER_BLOCK, segment.size - segment.start);
+    for (size_t r = 0; r < records; ++r) {
+        accumulateMinute(history, &block.records[r]);
+    }
+    dropOldestBlock(history.raw);
+    // The pending minute is complete unless the next raw block continues it
+    if (history.raw.empty() || oldestBlock(history.raw).first - oldestBlock(history.raw).first % 60 !=
+                                   history.pending.minute) {
+        accumulateMinute(history, nullptr);
+    }
+    return records;
+}
+
+/**
+ * @brief Runs one budgeted compaction pass over the histories
+ * @details Raw blocks that fell out of the raw retention are rolled up into the
+ *          minute tier and released, and minute blocks past their retention are
+ *          dropped, so memory follows retention a block (about a minute of
+ *          samples) at a time. Work per pass is capped so a pass never delays
+ *          ingestion by more than a couple of segments' worth of arithmetic; the
+ *          next pass resumes at the interface where this one ran out of budget.
+ * @param now Current wall-clock time
+ */
+void compactHistory(time_t now) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t budget = COMPACTION_BUDGET;
+
+    auto entry = g_history.lower_bound(g_compactionCursor);
+    for (size_t visited = 0; visited < g_history.size(); ++visited, ++entry) {
+        if (entry == g_history.end()) {
+            entry = g_history.begin();
+        }
+        InterfaceHistory& history = entry->second;
+        while (!history.raw.empty() && oldestBlock(history.raw).last < now - g_rawRetention) {
+            if (budget < SAMPLES_PER_BLOCK) {
+                g_compactionCursor = entry->first;
+                visited = g_history.size();
+                break;
+            }
+            size_t records = rollUpOldestBlock(history);
+            budget -= records;
+            g_stats.recordsRolledUp += records;
+        }
+        while (!history.minutes.empty() && oldestBlock(history.minutes).last < now - MINUTE_RETENTION) {
+            dropOldestBlock(history.minutes);
+            ++g_stats.blocksExpired;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ++g_stats.compactionPasses;
+    g_stats.compactionSeconds += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/**
+ * @brief Bytes held by the segments of a history tier
+ * @param segments Segments of the tier
+ * @return Size of the segments and of the blocks in use
+ */
+size_t tierBytes(const std::vector<HistorySegment*>& segments) {
+    size_t bytes = segments.capacity() * sizeof(HistorySegment*);
+    for (const HistorySegment* segment : segments) {
+        bytes += sizeof(HistorySegment) + (blockEnd(*segment) - firstBlock(*segment)) * sizeof(HistoryBlock);
+    }
+    return bytes;
+}
+
+/**
+ * @brief Recomputes the memory held by each subsystem
+ */
+void measureMemory() {
+    g_memoryUsage[MEM_LIVE_STATE] = g_interfaceStates.capacity() * sizeof(InterfaceState) +
+                                    g_rates.primed.capacity() * (1 + NUM_HORIZONS * NUM_COUNTERS * sizeof(double)) +
+                                    derivedStateBytes();
+    for (const InterfaceState& state : g_interfaceStates) {
+        for (const std::string& fragment : state.rendered.fragments) {
+            g_memoryUsage[MEM_LIVE_STATE] += fragment.capacity();
+        }
+    }
+    g_memoryUsage[MEM_RAW_HISTORY] = 0;
+    g_memoryUsage[MEM_ROLLUPS] = 0;
+    for (const auto& entry : g_history) {
+        g_memoryUsage[MEM_RAW_HISTORY] += entry.first.capacity() + sizeof(entry) + tierBytes(entry.second.raw);
+        g_memoryUsage[MEM_ROLLUPS] += tierBytes(entry.second.minutes);
+    }
+    g_memoryUsage[MEM_POOL_FREE] = g_blockPool.freeBytes() + g_segmentPool.freeBytes();
+    g_memoryUsage[MEM_SKETCHES] = g_sketchBytes;
+}
+
+/**
+ * @brief Evicts the oldest blocks of history across all interfaces
+ * @details Raw blocks go first: rolled up into the minute tier, the same span of
+ *          time takes a sixtieth of the memory. Once no raw history is left, the
+ *          oldest minute blocks are dropped. Each tier is walked once, into a
+ *          min-heap of the histories by their oldest block; a history goes back on
+ *          the heap with its next block after each eviction, so evicting n blocks
+ *          costs one walk plus n log(interfaces) instead of a walk per block.
+ * @param count Blocks to evict
+ * @return Blocks evicted, fewer than count once no history is left
+ */
+size_t evictOldestBlocks(size_t count) {
+    std::greater<std::pair<time_t, InterfaceHistory*>> later;
+    size_t evicted = 0;
+    for (bool raw : {true, false}) {
+        if (evicted == count) {
+            break;
+        }
+        g_evictionHeap.clear();
+        for (auto& entry : g_history) {
+            std::vector<HistorySegment*>& tier = raw ? entry.second.raw : entry.second.minutes;
+            if (!tier.empty()) {
+                g_evictionHeap.emplace_back(oldestBlock(tier).first, &entry.second);
+            }
+        }
+        std::make_heap(g_evictionHeap.begin(), g_evictionHeap.end(), later);
+        while (evicted < count && !g_evictionHeap.empty()) {
+            std::pop_heap(g_evictionHeap.begin(), g_evictionHeap.end(), later);
+            InterfaceHistory& history = *g_evictionHeap.back().second;
+            g_evictionHeap.pop_back();
+            if (raw) {
+                g_stats.recordsRolledUp += rollUpOldestBlock(history);
+                ++g_stats.blocksEvicted;
+            } else {
+                dropOldestBlock(history.minutes);
+                ++g_stats.blocksExpired;
+            }
+            ++evicted;
+            std::vector<HistorySegment*>& tier = raw ? history.raw : history.minutes;
+            if (!tier.empty()) {
+                g_evictionHeap.emplace_back(oldestBlock(tier).first, &history);
+                std::push_heap(g_evictionHeap.begin(), g_evictionHeap.end(), later);
+            }
+        }
+    }
+    return evicted;
+}
+
+/**
+ * @brief Keeps memory within the configured budget
+ * @details Above 90% of the budget the raw retention is halved, down to
+ *          MIN_RAW_RETENTION, and compaction rolls the excess into the much smaller
+ *          minute tier over the following passes. Whenever usage is above the
+ *          budget itself, the oldest history blocks are evicted right away, raw
+ *          blocks younger than the retention included, until it fits. Raw retention
+ *          grows back once doubling it would still leave usage below 70% of the
+ *          budget. Pooled free memory is reused before the pools grow, so only memory
+ *          in use counts as pressure. Live state and flow sketches cannot be evicted;
+ *          if they alone exceed the budget, all history is given up and a warning printed.
+ * @param now Current wall-clock time
+ */
+void enforceMemoryBudget(time_t now) {
+    measureMemory();
+    if (g_memoryBudget == 0) {
+        return;
+    }
+    size_t total = 0;
+    for (int m = 0; m < NUM_MEM_SUBSYSTEMS; ++m) {
+        total += m != MEM_POOL_FREE ? g_memoryUsage[m] : 0;
+    }
+    bool cooledDown = now - g_lastRetentionChange >= RETENTION_COOLDOWN;
+
+    if (total > g_memoryBudget / 10 * 9 && g_rawRetention > MIN_RAW_RETENTION && cooledDown) {
+        g_rawRetention = std::max(MIN_RAW_RETENTION, g_rawRetention / 2);
+        g_lastRetentionChange = now;
+        std::cout << "!!! Memory at " << total / 1024 << " KiB of " << g_memoryBudget / 1024
+                  << " KiB - raw history retention reduced to " << g_rawRetention << "s !!!" << std::endl;
+    }
+    if (total > g_memoryBudget) {
+        // Rollups can take new minute blocks, so re-measure after each round of evictions
+        bool evicted = true;
+        while (total > g_memoryBudget && evicted) {
+            size_t blocks = (total - g_memoryBudget + sizeof(HistoryBlock) - 1) / sizeof(HistoryBlock);
+            evicted = evictOldestBlocks(blocks) > 0;
+            measureMemory();
+            total = 0;
+            for (int m = 0; m < NUM_MEM_SUBSYSTEMS; ++m) {
+                total += m != MEM_POOL_FREE ? g_memoryUsage[m] : 0;
+            }
+        }
+        size_t fixed = g_memoryUsage[MEM_LIVE_STATE] + g_memoryUsage[MEM_SKETCHES];
+        if (fixed > g_memoryBudget && !g_fixedCostsWarned) {
+            g_fixedCostsWarned = true;
+            std::cout << "!!! Live state and flow sketches alone take " << fixed / 1024 << " KiB of the "
+                      << g_memoryBudget / 1024 << " KiB budget - no history is kept !!!" << std::endl;
+        }
+    } else if (total + g_memoryUsage[MEM_RAW_HISTORY] < g_memoryBudget / 10 * 7 &&
+               g_rawRetention < DEFAULT_RAW_RETENTION && cooledDown) {
+        // Doubling the retention eventually doubles the raw history; stay clear of the 90% mark
+        g_rawRetention = std::min(DEFAULT_RAW_RETENTION, g_rawRetention * 2);
+        g_lastRetentionChange = now;
+    }
+}
+
+/**
+ * @brief Reports an event to g_eventSink, if any
+ * @param kind MonitorEventKind
+ * @param slot Monitor slot the event concerns, -1 if none
+ * @param name Interface name
+ * @param detail Short text, see MonitorEventKind
+ * @param value First value, see MonitorEventKind
+ * @param value2 Second value, see MonitorEventKind
+ */
+void emitEvent(int kind, int slot, const char* name, const char* detail, double value, double value2) {
+    if (g_eventSink == nullptr) {
+        return;
+    }
+    MonitorEvent event;
+    memset(&event, 0, sizeof(event));
+    event.timestamp = g_clock->wallTime();
+    event.kind = kind;
+    event.slot = slot;
+    strncpy(event.name, name, sizeof(event.name) - 1);
+    strncpy(event.detail, detail, sizeof(event.detail) - 1);
+    event.value[0] = value;
+    event.value[1] = value2;
+    g_eventSink(event);
+}
+
+/**
+ * @brief Computes the interrupt rate of each MSI vector since the previous sample
+ * @param state State of the interface, still holding the previous sample
+ * @param sample New sample
+ * @param seconds Time since the previous sample; rates are zeroed if it is not positive
+ */
+void updateIrqRates(InterfaceState& state, const InterfaceSample& sample, double seconds) {
+    const InterfaceSample& previous = state.last;
+    for (int i = 0; i < sample.irqCount; ++i) {
+        if (seconds <= 0.0) {
+            state.irqRates[i] = 0.0f;
+            continue;
+        }
+        const QueueInterrupts& queue = sample.irqs[i];
+        // Vectors keep their order, so the same index nearly always holds the same vector
+        int match = i < previous.irqCount && previous.irqs[i].irq == queue.irq ? i : -1;
+        for (int j = 0; match < 0 && j < previous.irqCount; ++j) {
+            match = previous.irqs[j].irq == queue.irq ? j : -1;
+        }
+        state.irqRates[i] = match >= 0 && queue.count >= previous.irqs[match].count
+                          ? static_cast<float>((queue.count - previous.irqs[match].count) / seconds) : 0.0f;
+    }
+}
+
+/**
+ * @brief Folds a decoded report into the live state of its interface monitor
+ * @details Intervals are measured between the collector's sample times, not
+ *          between arrivals: reports that queued up while the monitor was busy and
+ *          are decoded from one read still cover one collector interval each. A
+ *          sample taken no later than the previous one is stored but not rated.
+ * @param slot Monitor slot that sent the report
+ * @param sample The decoded report
+ */
+void ingestSample(int slot, const InterfaceSample& sample) {
+    InterfaceState& state = g_interfaceStates[slot];
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    state.lastSampleRated = false;
+
+    // A changed counter set restarts the deltas like a new connection would
+    if (state.hasSample && strcmp(state.last.name, sample.name) == 0 &&
+        state.last.counterMask == sample.counterMask) {
+        double seconds = sample.sampledAt - state.last.sampledAt;
+        unsigned long long deltas[NUM_COUNTERS];
+        const char* resetReason = detectReset(state.last, sample);
+        int wraps = 0; // Counted only if no later counter turns the sample into a reset
+        for (int c = 0; c < NUM_COUNTERS && resetReason == nullptr; ++c) {
+            DeltaKind kind = counterDelta(state.last.counters[c], sample.counters[c],
+                                          counterCeiling(c, sample.speedMbps, seconds), deltas[c]);
+            if (kind == DeltaKind::Reset) {
+                resetReason = "counter went backwards";
+            } else if (kind != DeltaKind::Normal) {
+                ++wraps;
+            }
+        }
+
+        state.lastSampleReset = resetReason != nullptr;
+        if (state.lastSampleReset) {
+            ++state.resetCount;
+            if (g_printSamples) {
+                std::cout << "!!! Counters of " << sample.name << " were reset (" << resetReason
+                          << ") - sample skipped !!!" << std::endl;
+            }
+            emitEvent(EVENT_RESET, slot, sample.name, resetReason);
+        } else if (seconds > 0.0) {
+            state.wrapCount += wraps;
+            updateRates(slot, deltas, seconds);
+            updateIrqRates(state, sample, seconds);
+            state.lastSampleRated = true;
+            HistoryRecord record;
+            record.timestamp = g_clock->wallTime();
+            for (int c = 0; c < NUM_COUNTERS; ++c) {
+                record.rates[c] = static_cast<float>(deltas[c] / seconds);
+            }
+            if (state.history == nullptr) {
+                state.history = &g_history[sample.name];
+            }
+            appendHistory(state.history->raw, record);
+            NETWATCH_PROBE2(store, sample.name, record.timestamp);
+            if (!g_derived.metrics.empty()) {
+                markDerivedInputs(slot, sample.name, sample.owner, record.rates);
+            }
+
+            SaturationEpisode finished;
+            if (updateUtilization(state.rx, deltas[RX_BYTES], seconds, sample.speedMbps, finished)) {
+                if (g_printSamples) {
+                    reportSaturation(sample.name, "rx", finished);
+                }
+                emitEvent(EVENT_SATURATION, slot, sample.name, "rx", finished.peak, finished.duration);
+            }
+            if (updateUtilization(state.tx, deltas[TX_BYTES], seconds, sample.speedMbps, finished)) {
+                if (g_printSamples) {
+                    reportSaturation(sample.name, "tx", finished);
+                }
+                emitEvent(EVENT_SATURATION, slot, sample.name, "tx", finished.peak, finished.duration);
+            }
+        }
+    }
+    if (state.hasSample && strcmp(state.last.state, sample.state) != 0) {
+        emitEvent(EVENT_STATE_CHANGE, slot, sample.name, sample.state);
+    }
+    state.last = sample;
+    state.hasSample = true;
+    ++state.samples;
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    ++g_stats.samplesIngested;
+    g_stats.ingestSeconds += elapsed;
+    g_stats.maxIngestSeconds = std::max(g_stats.maxIngestSeconds, elapsed);
+    NETWATCH_PROBE3(ingest, slot, sample.name, static_cast<long>(elapsed * 1e9));
+}
+
+/**
+ * @brief Renders the text fragments of an interface unless its sample is unchanged
+ * @details Strings are overwritten in place, so once they have grown to their
+ *          working size rendering reuses their storage.
+ * @param slot Monitor slot
+ * @return The fragments, valid until the slot's next sample is rendered
+ */
+const RenderedInterface& renderInterface(int slot) {
+    InterfaceState& state = g_interfaceStates[slot];
+    RenderedInterface& rendered = state.rendered;
+    if (rendered.version == state.samples) {
+        return rendered;
+    }
+    rendered.version = state.samples;
+    const InterfaceSample& sample = state.last;
+    char line[256];
+
+    snprintf(line, sizeof(line), "%-16s %-10s rx %12.0f B/s tx %12.0f B/s util %5.1f%%/%5.1f%% resets %d wraps %d\n",
+             sample.name, sample.state, g_rates.rates[0][RX_BYTES][slot], g_rates.rates[0][TX_BYTES][slot],
+             state.rx.percent, state.tx.percent, state.resetCount, state.wrapCount);
+    rendered.fragments[FRAGMENT_SUMMARY] = line;
+    snprintf(line, sizeof(line), "rate 1s/10s/60s rx: %.0f/%.0f/%.0f B/s tx: %.0f/%.0f/%.0f B/s\n",
+             g_rates.rates[0][RX_BYTES][slot], g_rates.rates[1][RX_BYTES][slot], g_rates.rates[2][RX_BYTES][slot],
+             g_rates.rates[0][TX_BYTES][slot], g_rates.rates[1][TX_BYTES][slot], g_rates.rates[2][TX_BYTES][slot]);
+    rendered.fragments[FRAGMENT_RATES] = line;
+    rendered.fragments[FRAGMENT_UTILIZATION].clear();
+    if (sample.speedMbps > 0) {
+        snprintf(line, sizeof(line), "utilization rx: %.1f%% tx: %.1f%% above %.0f%%: rx %.0fs tx %.0fs\n",
+                 state.rx.percent, state.tx.percent, SATURATION_THRESHOLD, state.rx.secondsAboveThreshold,
+                 state.tx.secondsAboveThreshold);
+        rendered.fragments[FRAGMENT_UTILIZATION] = line;
+    }
+
+    // Each vector's rate with its busiest CPU; a CPU's load sums the vectors it is busiest for
+    std::string& irqs = rendered.fragments[FRAGMENT_IRQS];
+    irqs.clear();
+    int busiestCpu = -1;
+    double busiestRate = 0.0;
+    for (int i = 0; i < sample.irqCount; ++i) {
+        const QueueInterrupts& queue = sample.irqs[i];
+        snprintf(line, sizeof(line), " %d %.0f/s cpu%d %u%%", queue.irq, state.irqRates[i], queue.busiestCpu,
+                 queue.busiestShare);
+        irqs += i == 0 ? "irq rates:" : "";
+        irqs += line;
+        double cpuRate = 0.0;
+        for (int j = 0; j < sample.irqCount; ++j) {
+            if (sample.irqs[j].busiestCpu == queue.busiestCpu) {
+                cpuRate += state.irqRates[j] * sample.irqs[j].busiestShare / 100.0;
+            }
+        }
+        if (cpuRate > busiestRate) {
+            busiestCpu = queue.busiestCpu;
+            busiestRate = cpuRate;
+        }
+    }
+    if (busiestCpu >= 0) {
+        snprintf(line, sizeof(line), "; busiest cpu%d %.0f/s", busiestCpu, busiestRate);
+        irqs += line;
+    }
+    irqs += sample.irqCount > 0 ? "\n" : "";
+    return rendered;
+}
+
+/**
+ * @brief Appends the non-empty fragments of an interface, rendering them if stale
+ * @param slot Monitor slot
+ * @param fragments Set of fragments, bit (1 << RenderFragment) per member
+ * @param iovecs Receives one iovec per fragment, pointing into the cache
+ */
+void gatherFragments(int slot, unsigned fragments, std::vector<struct iovec>& iovecs) {
+    const RenderedInterface& rendered = renderInterface(slot);
+    for (int f = 0; f < NUM_FRAGMENTS; ++f) {
+        if ((fragments & (1u << f)) != 0 && !rendered.fragments[f].empty()) {
+            iovecs.push_back({const_cast<char*>(rendered.fragments[f].data()), rendered.fragments[f].size()});
+        }
+    }
+}
+
+/**
+ * @brief Writes gathered fragments completely, IOV_MAX at a time
+ * @param fd Destination, e.g. STDOUT_FILENO; buffered stdio output must be flushed first
+ * @param iovecs Fragments; consumed as they are written
+ * @return false if a write failed
+ */
+bool writeFragments(int fd, std::vector<struct iovec>& iovecs) {
+    size_t next = 0;
+    while (next < iovecs.size()) {
+        int count = static_cast<int>(std::min(iovecs.size() - next, static_cast<size_t>(IOV_MAX)));
+        ssize_t written = writev(fd, &iovecs[next], count);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written < 0) {
+            return false;
+        }
+        // A short write leaves the rest of its last iovec for the next call
+        for (size_t bytes = static_cast<size_t>(written); next < iovecs.size(); ++next) {
+            if (bytes < iovecs[next].iov_len) {
+                iovecs[next].iov_base = static_cast<char*>(iovecs[next].iov_base) + bytes;
+                iovecs[next].iov_len -= bytes;
+                break;
+            }
+            bytes -= iovecs[next].iov_len;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Decodes one report, accounting decode time and rejects
+ * @param data Received bytes
+ * @param length Number of received bytes
+ * @param sample Reference to the sample receiving the decoded fields
+ * @return Bytes consumed, 0 if the data is not a well-formed report
+ */
+size_t timedDecode(const char* data, size_t length, InterfaceSample& sample) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t consumed = decodeSample(data, length, sample);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    g_stats.decodeSeconds += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    ++(consumed != 0 ? g_stats.messagesDecoded : g_stats.messagesRejected);
+    return consumed;
+}
@@ -0,0 +1,379 @@
+/**
+ * @file monitorState.h
+ * @brief Sample processing engine: decoding, rates, utilization and tiered history
+ * @details Shared by networkMonitor and libnetwatch.a. All state is global, one
+ *          engine per process, indexed by monitor slot.
+ */
+#ifndef MONITOR_STATE_H
+#define MONITOR_STATE_H
+
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <map>
+#include <new>
+#include <string>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <vector>
+
+#include "interfaceSample.h"
+#include "monitorClock.h"
+#include "perfCounters.h"
+
+const double SATURATION_THRESHOLD = 90.0; // Percent of link speed counted as saturated
+const double MIN_FRAME_BYTES = 64.0;      // Smallest Ethernet frame, bounds packet rates
+
+// How the increase of a counter between two samples was derived
+enum class DeltaKind { Normal, Wrap32, Wrap64, Reset };
+
+// Averaging horizons of the EWMA rates, like the 1/5/15 minute load average
+const int NUM_HORIZONS = 3;
+const double RATE_HORIZONS[NUM_HORIZONS] = {1.0, 10.0, 60.0}; // Seconds
+const double NOMINAL_INTERVAL = 1.0;                           // intfMonitor reporting period
+
+// History layout: segments of fixed-size blocks, one sparse index entry per block
+const size_t SAMPLES_PER_BLOCK = 64;
+const size_t BLOCKS_PER_SEGMENT = 64;
+const size_t SEGMENT_RECORDS = SAMPLES_PER_BLOCK * BLOCKS_PER_SEGMENT;
+
+// Retention per history tier and the work a compaction pass may do
+const time_t DEFAULT_RAW_RETENTION = 6 * 3600;      // Raw per-second records
+const time_t MINUTE_RETENTION = 7 * 86400;          // Per-minute rollups
+const size_t COMPACTION_BUDGET = 2 * SEGMENT_RECORDS; // Raw records rolled up per pass
+const time_t MIN_RAW_RETENTION = 600;               // Floor when shrinking raw history for memory
+const time_t RETENTION_COOLDOWN = 60;               // Lets compaction catch up between retention changes
+const size_t POOL_CHUNK_BYTES = 64 * 1024;          // Pool chunk size on regular pages
+const size_t HUGE_PAGE_BYTES = 2 * 1024 * 1024;     // Pool chunk size with --huge-pages
+
+// Subsystems whose memory is accounted against the budget. Live state and flow
+// sketches are fixed costs of the interfaces monitored: they count towards the
+// total, but only history can be shrunk to make room. Pooled free memory is
+// reported and never counted.
+enum MemorySubsystem {
+    MEM_LIVE_STATE, MEM_RAW_HISTORY, MEM_ROLLUPS, MEM_POOL_FREE, MEM_SKETCHES,
+    NUM_MEM_SUBSYSTEMS
+};
+const char* const MEM_SUBSYSTEM_NAMES[NUM_MEM_SUBSYSTEMS] = {
+    "live state", "raw history", "minute rollups", "pooled free", "flow sketches"
+};
+
+/**
+ * @brief A period during which one link direction stayed above the saturation threshold
+ */
+struct SaturationEpisode {
+    bool active = false;
+    time_t start = 0;
+    double peak = 0.0;
+    double duration = 0.0;
+};
+
+/**
+ * @brief Utilization of one link direction, maintained incrementally per sample
+ */
+struct LinkUtilization {
+    double percent = 0.0;
+    double secondsAboveThreshold = 0.0;
+    int episodeCount = 0;
+    SaturationEpisode episode;
+};
+
+// Text fragments rendered per interface, see renderInterface()
+enum RenderFragment {
+    FRAGMENT_SUMMARY,     // One line for the show command
+    FRAGMENT_RATES,       // Printed after each sample
+    FRAGMENT_UTILIZATION, // Printed after each sample of a link with a known speed
+    FRAGMENT_IRQS,        // Printed after each sample of a device with MSI vectors
+    NUM_FRAGMENTS
+};
+const unsigned SAMPLE_FRAGMENTS = (1u << FRAGMENT_RATES) | (1u << FRAGMENT_UTILIZATION) | (1u << FRAGMENT_IRQS);
+
+/**
+ * @brief Text of one interface, rendered at most once per sample and shared by every consumer
+ * @details Consumers gather the fragments they need as iovecs and writev() them, so
+ *          printing an unchanged interface again copies bytes instead of formatting numbers.
+ */
+struct RenderedInterface {
+    size_t version = 0;                   // InterfaceState::samples when rendered
+    std::string fragments[NUM_FRAGMENTS]; // Newline-terminated, empty if not applicable
+};
+
+/**
+ * @brief Live state kept for each connected interface monitor
+ */
+struct InterfaceState {
+    bool hasSample = false;
+    bool lastSampleReset = false; // Rollups and alerts skip samples marked as resets
+    bool lastSampleRated = false; // The last sample updated the rates and utilization
+    size_t samples = 0;           // Samples ingested; a change invalidates the rendered text
+    int resetCount = 0;
+    int wrapCount = 0;
+    InterfaceSample last;
+    struct InterfaceHistory* history = nullptr; // Resolved once per connection
+    struct InterfaceHistory* derivedHistory = nullptr; // Derived metrics, see derivedMetrics.h
+    LinkUtilization rx, tx;
+    float irqRates[MAX_QUEUE_IRQS] = {}; // Interrupts per second of each vector in last.irqs
+    RenderedInterface rendered;
+};
+
+/**
+ * @brief Exponentially weighted per-second rates of every counter over several horizons
+ * @details Stored as one column per (horizon, counter) indexed by monitor slot, so a
+ *          display that shows one rate for all interfaces walks contiguous memory.
+ */
+struct RateTable {
+    std::vector<double> rates[NUM_HORIZONS][NUM_COUNTERS];
+    std::vector<unsigned char> primed;  // Zero until a slot has received its first rate
+    double nominalDecay[NUM_HORIZONS];  // Decay for a sample arriving exactly on schedule
+
+    explicit RateTable(size_t slots) : primed(slots, 0) {
+        for (int h = 0; h < NUM_HORIZONS; ++h) {
+            nominalDecay[h] = exp(-NOMINAL_INTERVAL / RATE_HORIZONS[h]);
+            for (int c = 0; c < NUM_COUNTERS; ++c) {
+                rates[h][c].assign(slots, 0.0);
+            }
+        }
+    }
+};
+/**
+ * @brief One stored interval: when it ended and the per-second rate of each counter
+ */
+struct HistoryRecord {
+    time_t timestamp;
+    float rates[NUM_COUNTERS];
+};
+
+/**
+ * @brief Sparse index entry covering one block of a segment
+ */
+struct HistoryBlockSummary {
+    time_t first, last;
+    float minRate[NUM_COUNTERS];
+    float maxRate[NUM_COUNTERS];
+};
+
+/**
+ * @brief Fixed-size run of records, the unit the history is allocated in
+ */
+struct HistoryBlock {
+    HistoryRecord records[SAMPLES_PER_BLOCK];
+};
+
+/**
+ * @brief Append-only run of blocks with a sparse time index and per-block summaries
+ */
+struct HistorySegment {
+    size_t size = 0;                                 // Records appended so far
+    size_t start = 0;                                // Records released from the front, whole blocks at a time
+    HistoryBlock* blocks[BLOCKS_PER_SEGMENT];        // Allocated as the segment fills
+    HistoryBlockSummary summaries[BLOCKS_PER_SEGMENT];
+};
+
+extern bool g_hugePages; // --huge-pages: back the history pools with 2 MiB pages
+
+void* mapHugeChunk();
+
+/**
+ * @brief Pool of fixed-size objects carved out of large chunks
+ * @details Released objects go on a free list and are reused before another chunk
+ *          is allocated, so once history reaches its retention the store recycles
+ *          the blocks compaction frees instead of calling malloc. With --huge-pages
+ *          each chunk is one 2 MiB page, so a full scan of the history touches a
+ *          handful of TLB entries instead of one per 4 KiB.
+ */
+template <typename T>
+class SlabPool {
+public:
+    SlabPool() = default;
+    SlabPool(const SlabPool&) = delete;
+    SlabPool& operator=(const SlabPool&) = delete;
+    ~SlabPool() {
+        for (const Chunk& chunk : m_chunks) {
+            if (chunk.mapped) {
+                munmap(chunk.memory, chunk.bytes);
+            } else {
+                ::operator delete(chunk.memory);
+            }
+        }
+    }
+
+    T* allocate() {
+        if (m_freeList == nullptr) {
+            grow();
+        }
+        Slot* slot = m_freeList;
+        m_freeList = slot->next;
+        --m_freeCount;
+        ++m_allocations;
+        return new (slot->storage) T();
+    }
+
+    void release(T* object) {
+        object->~T();
+        Slot* slot = reinterpret_cast<Slot*>(object);
+        slot->next = m_freeList;
+        m_freeList = slot;
+        ++m_freeCount;
+    }
+
+    size_t chunks() const { return m_chunks.size(); }
+    size_t allocations() const { return m_allocations; }
+    size_t freeBytes() const { return m_freeCount * sizeof(Slot); }
+
+private:
+    union Slot {
+        Slot* next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+    struct Chunk {
+        void* memory;
+        size_t bytes;
+        bool mapped; // From mapHugeChunk() rather than operator new
+    };
+
+    void grow() {
+        Chunk chunk = {nullptr, HUGE_PAGE_BYTES, false};
+        if (g_hugePages) {
+            chunk.memory = mapHugeChunk();
+            chunk.mapped = chunk.memory != nullptr;
+        }
+        if (!chunk.mapped) {
+            chunk.bytes = std::max(POOL_CHUNK_BYTES, sizeof(Slot));
+            chunk.memory = ::operator new(chunk.bytes);
+        }
+        m_chunks.push_back(chunk);
+        Slot* slots = static_cast<Slot*>(chunk.memory);
+        size_t count = chunk.bytes / sizeof(Slot);
+        for (size_t i = 0; i < count; ++i) {
+            slots[i].next = m_freeList;
+            m_freeList = &slots[i];
+        }
+        m_freeCount += count;
+    }
+
+    std::vector<Chunk> m_chunks;
+    Slot* m_freeList = nullptr;
+    size_t m_freeCount = 0;
+    size_t m_allocations = 0;
+};
+
+/**
+ * @brief Time-ordered history of one interface, kept across monitor reconnects
+ * @details Raw blocks older than the raw retention are rolled up into per-minute
+ *          averages by the compaction pass; the two tiers never overlap in time. A
+ *          minute whose raw records span two blocks is held in pending until its
+ *          last raw record has been rolled up.
+ */
+struct InterfaceHistory {
+    std::vector<HistorySegment*> raw;
+    std::vector<HistorySegment*> minutes;
+    struct {
+        time_t minute = 0;
+        size_t count = 0;
+        double sums[NUM_COUNTERS] = {};
+    } pending;
+};
+
+/**
+ * @brief Range query over one counter of an interface history
+ */
+struct HistoryQuery {
+    time_t from, to;
+    int counter;
+    double minRate; // Only records at or above this rate match
+};
+
+/**
+ * @brief Aggregates produced by a history query
+ */
+struct HistoryResult {
+    size_t matched = 0;
+    size_t blocksScanned = 0;
+    size_t blocksSkipped = 0;
+    double min = 0.0, max = 0.0, sum = 0.0;
+};
+
+/**
+ * @brief Work done by history compaction and by ingestion, for the stats command
+ */
+struct PipelineStats {
+    size_t messagesDecoded = 0;
+    size_t messagesRejected = 0;
+    double decodeSeconds = 0.0;
+    size_t samplesIngested = 0;
+    double ingestSeconds = 0.0;
+    double maxIngestSeconds = 0.0;
+    size_t compactionPasses = 0;
+    size_t recordsRolledUp = 0;
+    size_t blocksExpired = 0;     // Minute blocks past retention or evicted for memory
+    size_t blocksEvicted = 0;     // Raw blocks rolled up early for memory
+    double compactionSeconds = 0.0;
+};
+
+// Pipeline stages measured with hardware counters when built with PERF=1
+enum Stage { STAGE_INGEST, STAGE_RENDER, NUM_STAGES };
+
+// Notable changes reported to g_eventSink
+enum MonitorEventKind {
+    EVENT_RESET,          // Counters went backwards or carrier counts dropped; detail holds the reason
+    EVENT_SATURATION,     // Saturation episode ended; detail "rx"/"tx", values peak percent and seconds
+    EVENT_STATE_CHANGE,   // Operational state changed; detail holds the new state
+    EVENT_RESTORE,        // Restore requested through the control socket
+    EVENT_INTERVAL,       // Sampling interval changed; value is the new interval in seconds
+    EVENT_DISCONNECT,     // Interface monitor closed its connection
+    EVENT_THRESHOLD,      // Derived metric rose above its threshold; detail metric, values value and threshold
+    EVENT_CAPTURE,        // Packet capture started; detail the triggering metric or "requested", value seconds
+    NUM_EVENT_KINDS
+};
+const char* const EVENT_KIND_NAMES[NUM_EVENT_KINDS] = {
+    "reset", "saturation", "state", "restore", "interval", "disconnect", "threshold", "capture"
+};
+
+/**
+ * @brief One event, filled on the stack so reporting it never allocates
+ */
+struct MonitorEvent {
+    time_t timestamp;
+    int kind;
+    int slot;
+    char name[MAX_IFACE_NAME];
+    char detail[32];
+    double value[2];
+};
+typedef void (*MonitorEventSink)(const MonitorEvent& event);
+typedef void (*HistoryVisitor)(const HistoryRecord& record, void* context);
+
+extern std::vector<InterfaceState> g_interfaceStates; // Indexed by monitor slot
+extern RateTable g_rates;
+extern bool g_printSamples;    // Per-sample console output, off while simulating or embedded
+extern std::map<std::string, InterfaceHistory> g_history; // Keyed by interface name
+extern time_t g_rawRetention;  // Shrunk by the memory governor under pressure
+extern size_t g_memoryBudget;  // Bytes, 0 for unlimited
+extern size_t g_memoryUsage[NUM_MEM_SUBSYSTEMS]; // Refreshed by enforceMemoryBudget()
+extern PipelineStats g_stats;
+extern PerfStage g_perfStages[NUM_STAGES];
+extern SlabPool<HistoryBlock> g_blockPool;
+extern SlabPool<HistorySegment> g_segmentPool;
+extern MonitorEventSink g_eventSink; // nullptr when nobody listens for events
+
+void resizeSlots(size_t slots);
+size_t decodeSample(const char* data, size_t length, InterfaceSample& sample);
+void updateRates(int slot, const unsigned long long deltas[], double seconds);
+void resetRates(int slot);
+void queryHistory(const std::vector<HistorySegment*>& segments, const HistoryQuery& query,
+                  HistoryResult& result);
+void appendHistory(std::vector<HistorySegment*>& segments, const HistoryRecord& record);
+size_t scanHistory(const std::vector<HistorySegment*>& segments, time_t from, time_t to,
+                   HistoryVisitor visit, void* context);
+void emitEvent(int kind, int slot, const char* name, const char* detail, double value = 0.0,
+               double value2 = 0.0);
+void compactHistory(time_t now);
+void measureMemory();
+void enforceMemoryBudget(time_t now);
+void ingestSample(int slot, const InterfaceSample& sample);
+size_t timedDecode(const char* data, size_t length, InterfaceSample& sample);
+const RenderedInterface& renderInterface(int slot);
+void gatherFragments(int slot, unsigned fragments, std::vector<struct iovec>& iovecs);
+bool writeFragments(int fd, std::vector<struct iovec>& iovecs);
+
+#endif // MONITOR_STATE_H
@@ -0,0 +1,228 @@
+/**
+ * @file netwatch.cpp
+ * @brief NetWatch, the in-process front end of the collection engine
+ */
+#include <stdexcept>
+#include <unistd.h>
+
+#include "collector.h"
+#include "derivedMetrics.h"
+#include "monitorState.h"
+#include "netwatch.h"
+
+static bool g_netWatchActive = false; // One engine per process, see netwatch.h
+
+/**
+ * @brief One registered interface
+ */
+struct NetWatch::Watched {
+    std::string name;
+    CollectorState collector;
+};
+
+/**
+ * @brief Takes over the process-wide engine state
+ * @throws logic_error if another NetWatch already exists
+ */
+NetWatch::NetWatch() {
+    if (g_netWatchActive) {
+        throw std::logic_error("!!! netwatch.cpp !!!- Only one NetWatch may exist per process");
+    }
+    g_netWatchActive = true;
+    g_printSamples = false;
+    resizeSlots(0);
+}
+
+NetWatch::~NetWatch() {
+    for (Watched& watched : m_interfaces) {
+        if (watched.collector.linkNotifyFd >= 0) {
+            close(watched.collector.linkNotifyFd);
+        }
+        if (watched.collector.interruptsFd >= 0) {
+            close(watched.collector.interruptsFd);
+        }
+    }
+    g_netWatchActive = false;
+}
+
+/**
+ * @brief Starts watching an interface
+ * @param name Name of the interface
+ * @return Slot identifying the interface in the other calls
+ * @throws invalid_argument if the interface does not exist
+ */
+int NetWatch::registerInterface(const std::string& name) {
+    if (name.empty() || name.size() >= MAX_IFACE_NAME ||
+        access(("/sys/class/net/" + name).c_str(), F_OK) != 0) {
+        throw std::invalid_argument("!!! netwatch.cpp !!!- No such interface: " + name);
+    }
+    Watched watched;
+    watched.name = name;
+    watched.collector.linkNotifyFd = openLinkNotifications();
+    watched.collector.counterMask = m_subscribedCounters | m_storedCounters | UTILIZATION_COUNTERS;
+    m_interfaces.push_back(watched);
+    resizeSlots(m_interfaces.size());
+    return static_cast<int>(m_interfaces.size()) - 1;
+}
+
+/**
+ * @brief Registers a callback run for every sample poll() collects
+ * @param callback Called with the slot and the sample, after rates and history are updated
+ * @param counters Counters the callback reads, as a mask of (1 << counter) bits
+ */
+void NetWatch::subscribe(SampleCallback callback, unsigned counters) {
+    m_subscribers.push_back(callback);
+    m_subscribedCounters |= counters;
+    applyCounterMask();
+}
+
+/**
+ * @brief Declares which counters are read back through rate() and queryHistory()
+ * @details Counters nobody consumes are not read from sysfs and stay zero.
+ * @param counters Mask of (1 << counter) bits, ALL_COUNTERS by default
+ */
+void NetWatch::setStoredCounters(unsigned counters) {
+    m_storedCounters = counters;
+    applyCounterMask();
+}
+
+/**
+ * @brief Defines a metric computed from counter rates after every poll()
+ * @param definition "name=expression" or "name=expression>threshold", see derivedMetrics.h
+ * @return Index of the metric for derived() and queryHistory()
+ * @throws invalid_argument if the definition does not compile
+ */
+int NetWatch::addDerivedMetric(const std::string& definition) {
+    std::string error;
+    if (!::addDerivedMetric(definition, error)) {
+        throw std::invalid_argument("!!! netwatch.cpp !!!- Invalid derived metric '" + definition + "': " + error);
+    }
+    applyCounterMask();
+    return static_cast<int>(g_derived.metrics.size()) - 1;
+}
+
+/**
+ * @brief Pushes the union of consumed counters down to every collector
+ */
+void NetWatch::applyCounterMask() {
+    unsigned mask = (m_subscribedCounters | m_storedCounters | derivedInputs() | UTILIZATION_COUNTERS) &
+                    ALL_COUNTERS;
+    for (Watched& watched : m_interfaces) {
+        watched.collector.counterMask = mask;
+    }
+}
+
+/**
+ * @brief Collects one sample of every registered interface and folds it into the engine
+ * @details Meant to be called once per second; rates are computed from the actual
+ *          interval between calls. Downed interfaces are restored like intfMonitor does.
+ * @throws runtime_error if a downed interface cannot be restored
+ */
+void NetWatch::poll() {
+    for (size_t slot = 0; slot < m_interfaces.size(); ++slot) {
+        Watched& watched = m_interfaces[slot];
+        InterfaceSample sample;
+        gatherStats(watched.name.c_str(), watched.collector, sample);
+        ingestSample(static_cast<int>(slot), sample);
+        for (const SampleCallback& callback : m_subscribers) {
+            callback(static_cast<int>(slot), sample);
+        }
+    }
+    evaluateDerivedMetrics(g_clock->wallTime());
+    compactHistory(g_clock->wallTime());
+    enforceMemoryBudget(g_clock->wallTime());
+}
+
+/**
+ * @brief Number of registered interfaces; slots run from 0 to this minus one
+ */
+int NetWatch::interfaceCount() const {
+    return static_cast<int>(m_interfaces.size());
+}
+
+/**
+ * @brief Looks up a registered interface
+ * @param slot Slot returned by registerInterface()
+ * @return The interface
+ * @throws out_of_range if no interface has this slot
+ */
+const NetWatch::Watched& NetWatch::watched(int slot) const {
+    if (slot < 0 || slot >= interfaceCount()) {
+        throw std::out_of_range("!!! netwatch.cpp !!!- No interface in slot " + std::to_string(slot));
+    }
+    return m_interfaces[slot];
+}
+
+/**
+ * @brief Last sample collected from an interface, zeroed before the first poll()
+ * @param slot Slot returned by registerInterface()
+ */
+const InterfaceSample& NetWatch::latest(int slot) const {
+    return state(slot).last;
+}
+
+/**
+ * @brief Exponentially weighted per-second rate of one counter
+ * @param slot Slot returned by registerInterface()
+ * @param counter Counter to read
+ * @param horizon Index into RATE_HORIZONS (0: 1 s, 1: 10 s, 2: 60 s)
+ * @return Rate per second, 0 until two samples have been collected
+ * @throws out_of_range on an unknown slot or horizon
+ */
+double NetWatch::rate(int slot, Counter counter, int horizon) const {
+    watched(slot);
+    if (horizon < 0 || horizon >= NUM_HORIZONS || counter < 0 || counter >= NUM_COUNTERS) {
+        throw std::out_of_range("!!! netwatch.cpp !!!- No such rate");
+    }
+    return g_rates.rates[horizon][counter][slot];
+}
+
+/**
+ * @brief Latest value of a derived metric
+ * @param slot Slot returned by registerInterface()
+ * @param metric Index returned by addDerivedMetric()
+ * @return The value, 0 until the interface has completed an interval
+ * @throws out_of_range on an unknown slot or metric
+ */
+double NetWatch::derived(int slot, int metric) const {
+    watched(slot);
+    if (metric < 0 || metric >= static_cast<int>(g_derived.metrics.size())) {
+        throw std::out_of_range("!!! netwatch.cpp !!!- No derived metric " + std::to_string(metric));
+    }
+    return static_cast<size_t>(slot) < g_derived.values[metric].size() ? g_derived.values[metric][slot] : 0.0;
+}
+
+/**
+ * @brief Live state of an interface: last sample, resets, wraps and utilization
+ * @param slot Slot returned by registerInterface()
+ */
+const InterfaceState& NetWatch::state(int slot) const {
+    watched(slot);
+    return g_interfaceStates[slot];
+}
+
+/**
+ * @brief Cached link properties of an interface
+ * @param slot Slot returned by registerInterface()
+ */
+const InterfaceMetadata& NetWatch::metadata(int slot) const {
+    return watched(slot).collector.metadata;
+}
+
+/**
+ * @brief Runs a range query over the stored history of an interface
+ * @param slot Slot returned by registerInterface()
+ * @param query Time range, counter and minimum rate; a derived metric index if derived
+ * @param derived true to query the derived metrics instead of the counters
+ * @param result Receives the aggregates
+ * @return false if the interface has no history yet
+ */
+bool NetWatch::queryHistory(int slot, const HistoryQuery& query, HistoryResult& result, bool derived) const {
+    auto history = g_history.find(derived ? watched(slot).name + DERIVED_HISTORY_SUFFIX : watched(slot).name);
+    if (history == g_history.end()) {
+        return false;
+    }
+    ::queryHistory(history->second.minutes, query, result);
+    ::queryHistory(history->second.raw, query, result);
+    return true;
+}
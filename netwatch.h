@@ -0,0 +1,76 @@
+/**
+ * @file netwatch.h
+ * @brief Public API of libnetwatch.a, the collection engine for embedding in other agents
+ * @details Link with -lnetwatch. The engine keeps its state in process globals, so a
+ *          process holds at most one NetWatch and must not also run networkMonitor's
+ *          ingestion loop.
+ *
+ *          NetWatch watch;
+ *          int eth0 = watch.registerInterface("eth0");
+ *          watch.subscribe([](int slot, const InterfaceSample& sample) { ... });
+ *          while (running) {
+ *              watch.poll();
+ *              double rxPerSecond = watch.rate(eth0, RX_BYTES, 0);
+ *              sleep(1);
+ *          }
+ *
+ *          Only the sample type is part of this header. Engine state returned by
+ *          state(), metadata() and queryHistory() is declared in monitorState.h
+ *          and collector.h; include them to read its fields.
+ */
+#ifndef NETWATCH_H
+#define NETWATCH_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "interfaceSample.h"
+
+struct InterfaceState;
+struct InterfaceMetadata;
+struct HistoryQuery;
+struct HistoryResult;
+
+// Bumped whenever a declaration below changes incompatibly
+const int NETWATCH_API_VERSION = 1;
+
+/**
+ * @brief Collects, rates and stores the statistics of a set of interfaces in-process
+ */
+class NetWatch {
+public:
+    typedef std::function<void(int slot, const InterfaceSample& sample)> SampleCallback;
+
+    NetWatch();
+    ~NetWatch();
+    NetWatch(const NetWatch&) = delete;
+    NetWatch& operator=(const NetWatch&) = delete;
+
+    int registerInterface(const std::string& name);
+    void subscribe(SampleCallback callback, unsigned counters = ALL_COUNTERS);
+    void setStoredCounters(unsigned counters);
+    int addDerivedMetric(const std::string& definition);
+    void poll();
+
+    int interfaceCount() const;
+    const InterfaceSample& latest(int slot) const;
+    double rate(int slot, Counter counter, int horizon) const;
+    double derived(int slot, int metric) const;
+    const InterfaceState& state(int slot) const;
+    const InterfaceMetadata& metadata(int slot) const;
+    bool queryHistory(int slot, const HistoryQuery& query, HistoryResult& result, bool derived = false) const;
+
+private:
+    struct Watched;
+
+    const Watched& watched(int slot) const;
+    void applyCounterMask();
+
+    std::vector<Watched> m_interfaces; // Indexed by slot
+    std::vector<SampleCallback> m_subscribers;
+    unsigned m_subscribedCounters = 0;           // Union of what subscribers asked for
+    unsigned m_storedCounters = ALL_COUNTERS;    // Read through rate() and queryHistory()
+};
+
+#endif // NETWATCH_H
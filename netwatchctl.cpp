@@ -0,0 +1,430 @@
+/**
+ * @file netwatchctl.cpp
+ * @brief Command-line client for networkMonitor's control socket
+ * @details Sends one request over the binary protocol in controlProtocol.h and
+ *          prints the records of the response as they arrive.
+ */
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "controlProtocol.h"
+
+const char* g_summaryFile = nullptr; // Where sketch saves the merge of the summaries it receives
+FlowSummary g_savedSummary;
+
+const char SUMMARY_FILE_MAGIC[8] = {'N', 'W', 'S', 'K', 'E', 'T', 'C', 'H'};
+const uint32_t SUMMARY_FILE_VERSION = 1;
+const uint32_t SUMMARY_FILE_BYTE_ORDER = 0x01020304; // Reads back as 0x04030201 on a host of the other endianness
+
+/**
+ * @brief Leads a saved summary so that a file from a build with other sketch dimensions,
+ *        another byte order or another FlowSummary layout is rejected instead of misread
+ */
+struct SummaryFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t depth;        // SKETCH_DEPTH
+    uint32_t width;        // SKETCH_WIDTH
+    uint32_t slots;        // SPACE_SAVING_SLOTS
+    uint32_t summaryBytes; // sizeof(FlowSummary), which follows the header
+};
+
+/**
+ * @brief Fills a header describing this build's summaries
+ * @param header Header to fill
+ */
+void fillSummaryHeader(SummaryFileHeader& header) {
+    memcpy(header.magic, SUMMARY_FILE_MAGIC, sizeof(header.magic));
+    header.version = SUMMARY_FILE_VERSION;
+    header.byteOrder = SUMMARY_FILE_BYTE_ORDER;
+    header.depth = SKETCH_DEPTH;
+    header.width = SKETCH_WIDTH;
+    header.slots = SPACE_SAVING_SLOTS;
+    header.summaryBytes = sizeof(FlowSummary);
+}
+
+/**
+ * @brief Connects to the control socket of the running networkMonitor
+ * @return Connected file descriptor, -1 on error
+ */
+int connectControl() {
+    struct sockaddr_un addr;
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        std::cerr << "!!! netwatchctl.cpp !!!- Socket creation failed: " << strerror(errno) << std::endl;
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, CONTROL_SOCKET_PATH, sizeof(addr.sun_path) - 1);
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        std::cerr << "!!! netwatchctl.cpp !!!- Cannot reach networkMonitor at " << CONTROL_SOCKET_PATH
+                  << ": " << strerror(errno) << std::endl;
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/**
+ * @brief Sends one request frame
+ * @param sock Control connection
+ * @param type ControlType of the request
+ * @param payload Request struct, nullptr for none
+ * @param length Size of the request struct
+ * @return true if the whole frame was sent
+ */
+bool sendRequest(int sock, uint8_t type, const void* payload, uint32_t length) {
+    char frame[sizeof(ControlHeader) + 128];
+    ControlHeader header = {CONTROL_MAGIC, CONTROL_VERSION, type, length};
+    memcpy(frame, &header, sizeof(header));
+    if (length > 0) {
+        memcpy(frame + sizeof(header), payload, length);
+    }
+    return write(sock, frame, sizeof(header) + length) == static_cast<ssize_t>(sizeof(header) + length);
+}
+
+/**
+ * @brief Reads exactly size bytes
+ * @param sock Control connection
+ * @param data Receives the bytes
+ * @param size Number of bytes to read
+ * @return true if all bytes arrived
+ */
+bool readFull(int sock, void* data, size_t size) {
+    char* out = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t bytesRead = read(sock, out, size);
+        if (bytesRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytesRead <= 0) {
+            return false;
+        }
+        out += bytesRead;
+        size -= bytesRead;
+    }
+    return true;
+}
+
+/**
+ * @brief Formats a wall-clock time as local HH:MM:SS
+ * @param timestamp Seconds since the epoch
+ * @param out Receives the text, at least 16 bytes
+ */
+void formatTime(int64_t timestamp, char* out) {
+    time_t seconds = static_cast<time_t>(timestamp);
+    struct tm local;
+    localtime_r(&seconds, &local);
+    strftime(out, 16, "%H:%M:%S", &local);
+}
+
+/**
+ * @brief Prints one response record
+ * @param type ControlType of the frame holding the record
+ * @param record The record
+ */
+void printRecord(uint8_t type, const char* record) {
+    char when[16];
+    switch (type) {
+    case CTL_INTERFACE: {
+        const ControlInterfaceRecord& r = *reinterpret_cast<const ControlInterfaceRecord*>(record);
+        printf("%-16s %-10s slot %-4d ifindex %-5d speed %-6d mtu %-5d resets %d wraps %d", r.name, r.state,
+               r.slot, r.ifindex, r.speedMbps, r.mtu, r.resetCount, r.wrapCount);
+        if (r.owner[0] != '\0') {
+            printf(" peer %d owner %.*s", r.peerIfindex, static_cast<int>(sizeof(r.owner)), r.owner);
+        }
+        printf("\n");
+        break;
+    }
+    case CTL_RATE: {
+        const ControlRateRecord& r = *reinterpret_cast<const ControlRateRecord*>(record);
+        printf("%-16s rx %.0f/%.0f/%.0f B/s tx %.0f/%.0f/%.0f B/s util rx %.1f%% tx %.1f%%\n", r.name,
+               r.rates[0][RX_BYTES], r.rates[1][RX_BYTES], r.rates[2][RX_BYTES], r.rates[0][TX_BYTES],
+               r.rates[1][TX_BYTES], r.rates[2][TX_BYTES], r.utilization[0], r.utilization[1]);
+        break;
+    }
+    case CTL_HISTORY_RECORD: {
+        const ControlHistoryRecord& r = *reinterpret_cast<const ControlHistoryRecord*>(record);
+        formatTime(r.timestamp, when);
+        printf("%s %s", when, r.minuteRollup ? "min" : "raw");
+        for (int c = 0; c < NUM_COUNTERS; ++c) {
+            printf(" %s %.0f", COUNTER_NAMES[c], r.rates[c]);
+        }
+        printf("\n");
+        break;
+    }
+    case CTL_TALKER: {
+        const ControlTalkerRecord& r = *reinterpret_cast<const ControlTalkerRecord*>(record);
+        printf("%-16s %-60s %12.0f B/s %8.0f pkt/s of %u flows\n", r.name, formatTalker(r.key).c_str(),
+               r.bytesPerSecond, r.packetsPerSecond, r.flows);
+        break;
+    }
+    case CTL_SUMMARY: {
+        const ControlSummaryRecord& r = *reinterpret_cast<const ControlSummaryRecord*>(record);
+        printSummary(std::cout, r.name, r.summary, TOP_TALKERS);
+        if (g_summaryFile != nullptr) {
+            mergeSummary(g_savedSummary, r.summary);
+        }
+        break;
+    }
+    case CTL_EVENT: {
+        const ControlEventRecord& r = *reinterpret_cast<const ControlEventRecord*>(record);
+        formatTime(r.timestamp, when);
+        printf("%s %-10s %-16s %s", when, r.kind >= 0 && r.kind < NUM_EVENT_KINDS ? EVENT_KIND_NAMES[r.kind] : "?",
+               r.name, r.detail);
+        if (r.kind == EVENT_SATURATION) {
+            printf(" peak %.1f%% for %.0fs", r.value[0], r.value[1]);
+        } else if (r.kind == EVENT_THRESHOLD) {
+            printf(" %.4g above %.4g", r.value[0], r.value[1]);
+        } else if (r.kind == EVENT_CAPTURE) {
+            printf(" for %.0fs", r.value[0]);
+        }
+        printf("\n");
+        fflush(stdout);
+        break;
+    }
+    }
+}
+
+/**
+ * @brief Size of one record of a response frame type
+ * @param type ControlType
+ * @return Record size, 0 for types that are not record streams
+ */
+size_t recordSize(uint8_t type) {
+    switch (type) {
+    case CTL_INTERFACE: return sizeof(ControlInterfaceRecord);
+    case CTL_RATE: return sizeof(ControlRateRecord);
+    case CTL_HISTORY_RECORD: return sizeof(ControlHistoryRecord);
+    case CTL_EVENT: return sizeof(ControlEventRecord);
+    case CTL_TALKER: return sizeof(ControlTalkerRecord);
+    case CTL_SUMMARY: return sizeof(ControlSummaryRecord);
+    case CTL_DONE: return sizeof(ControlDone);
+    default: return 0;
+    }
+}
+
+/**
+ * @brief Prints response frames until the response ends
+ * @param sock Control connection
+ * @return EXIT_SUCCESS after CTL_DONE, EXIT_FAILURE after CTL_ERROR or a broken connection
+ */
+int readResponse(int sock) {
+    static char payload[MAX_CONTROL_FRAME + 1];
+    ControlHeader header;
+    while (readFull(sock, &header, sizeof(header))) {
+        if (header.magic != CONTROL_MAGIC || header.length > MAX_CONTROL_FRAME ||
+            !readFull(sock, payload, header.length)) {
+            break;
+        }
+        if (header.type == CTL_ERROR) {
+            payload[header.length] = '\0';
+            std::cerr << "networkMonitor: " << payload << std::endl;
+            return EXIT_FAILURE;
+        }
+        size_t size = recordSize(header.type);
+        if (size == 0 || header.length % size != 0) {
+            break;
+        }
+        if (header.type == CTL_DONE) {
+            return EXIT_SUCCESS;
+        }
+        for (size_t offset = 0; offset < header.length; offset += size) {
+            printRecord(header.type, payload + offset);
+        }
+    }
+    std::cerr << "!!! netwatchctl.cpp !!!- Connection to networkMonitor lost or response malformed" << std::endl;
+    return EXIT_FAILURE;
+}
+
+/**
+ * @brief Copies an interface name argument into a request, "all" meaning every interface
+ * @param argument Command-line argument
+ * @param name Request field of MAX_IFACE_NAME bytes
+ */
+void setName(const char* argument, char* name) {
+    memset(name, 0, MAX_IFACE_NAME);
+    if (strcmp(argument, "all") != 0) {
+        strncpy(name, argument, MAX_IFACE_NAME - 1);
+    }
+}
+
+/**
+ * @brief Reads a summary saved by sketch
+ * @param path File written by saveSummary()
+ * @param summary Receives the summary
+ * @return false if the file is unreadable or not a summary
+ */
+bool loadSummary(const char* path, FlowSummary& summary) {
+    std::ifstream file(path, std::ios::binary);
+    SummaryFileHeader header, expected;
+    fillSummaryHeader(expected);
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0) {
+        std::cerr << "!!! netwatchctl.cpp !!!- " << path << " is not a flow summary" << std::endl;
+        return false;
+    }
+    const char* mismatch = nullptr;
+    if (header.byteOrder != expected.byteOrder) {
+        mismatch = "was saved on a host of the other byte order";
+    } else if (header.version != expected.version) {
+        mismatch = "has an unsupported format version";
+    } else if (header.depth != expected.depth || header.width != expected.width || header.slots != expected.slots) {
+        mismatch = "was saved with other sketch dimensions";
+    } else if (header.summaryBytes != expected.summaryBytes) {
+        mismatch = "was saved with another summary layout";
+    }
+    if (mismatch != nullptr) {
+        std::cerr << "!!! netwatchctl.cpp !!!- " << path << " " << mismatch << std::endl;
+        return false;
+    }
+    if (!file.read(reinterpret_cast<char*>(&summary), sizeof(summary)) || file.peek() != EOF ||
+        summary.hitterCount > static_cast<uint32_t>(SPACE_SAVING_SLOTS)) {
+        std::cerr << "!!! netwatchctl.cpp !!!- " << path << " is not a flow summary" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Saves a summary for a later merge, possibly with those of other hosts
+ * @param path File to write
+ * @param summary Summary to save; the file holds a SummaryFileHeader and then the summary as is,
+ *                so loadSummary() only accepts it on hosts of the same byte order and build dimensions
+ * @return false if the file could not be written
+ */
+bool saveSummary(const char* path, const FlowSummary& summary) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    SummaryFileHeader header;
+    fillSummaryHeader(header);
+    if (!file.write(reinterpret_cast<const char*>(&header), sizeof(header)) ||
+        !file.write(reinterpret_cast<const char*>(&summary), sizeof(summary)) || !file.flush()) {
+        std::cerr << "!!! netwatchctl.cpp !!!- Failed to write " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Merges saved summaries, e.g. of several hosts or hours, and prints the result
+ * @param paths Files written by sketch
+ * @param count Number of files
+ * @return EXIT_SUCCESS if every file was a summary
+ */
+int mergeFiles(char* paths[], int count) {
+    FlowSummary merged, summary;
+    clearSummary(merged, 0, 0);
+    for (int i = 0; i < count; ++i) {
+        if (!loadSummary(paths[i], summary)) {
+            return EXIT_FAILURE;
+        }
+        mergeSummary(merged, summary);
+    }
+    printSummary(std::cout, std::to_string(count) + " summaries", merged, TOP_TALKERS);
+    return EXIT_SUCCESS;
+}
+
+void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " <command>\n"
+              << "  list                              interfaces being monitored\n"
+              << "  rates [interface]                 live 1s/10s/60s rates and utilization\n"
+              << "  history <interface> <seconds>     stored samples of the last <seconds>\n"
+              << "  restore <interface>               bring the interface up now\n"
+              << "  interval <interface|all> <ms>     change the sampling interval\n"
+              << "  capture <interface|all> <s> [MiB] write packets to /tmp/<interface>-<time>.pcap\n"
+              << "  talkers [interface]               heaviest flows or sources of the last second\n"
+              << "  sketch <interface|all> <minutes> [file]\n"
+              << "                                    heaviest flows of the last minutes, saved to file\n"
+              << "  merge <file>...                   heaviest flows across saved sketches\n"
+              << "  tail                              stream events until interrupted" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    std::string command = argv[1];
+    uint8_t type;
+    union {
+        ControlTarget target;
+        ControlHistoryRequest history;
+        ControlInterval interval;
+        ControlCapture capture;
+        ControlSketchRequest sketch;
+    } request;
+    uint32_t length = 0;
+    memset(&request, 0, sizeof(request));
+
+    if (command == "list" && argc == 2) {
+        type = CTL_LIST;
+    } else if (command == "rates" && argc <= 3) {
+        type = CTL_RATES;
+        setName(argc == 3 ? argv[2] : "all", request.target.name);
+        length = sizeof(request.target);
+    } else if (command == "history" && argc == 4) {
+        type = CTL_HISTORY;
+        setName(argv[2], request.history.name);
+        request.history.to = time(nullptr);
+        request.history.from = request.history.to - atol(argv[3]);
+        length = sizeof(request.history);
+    } else if (command == "restore" && argc == 3) {
+        type = CTL_RESTORE;
+        setName(argv[2], request.target.name);
+        length = sizeof(request.target);
+    } else if (command == "interval" && argc == 4) {
+        type = CTL_SET_INTERVAL;
+        setName(argv[2], request.interval.name);
+        request.interval.intervalMs = static_cast<uint32_t>(strtoul(argv[3], nullptr, 10));
+        length = sizeof(request.interval);
+    } else if (command == "capture" && (argc == 4 || argc == 5)) {
+        type = CTL_CAPTURE;
+        setName(argv[2], request.capture.name);
+        request.capture.seconds = static_cast<uint32_t>(strtoul(argv[3], nullptr, 10));
+        request.capture.maxMiB = argc == 5 ? static_cast<uint32_t>(strtoul(argv[4], nullptr, 10)) : DEFAULT_CAPTURE_MIB;
+        length = sizeof(request.capture);
+    } else if (command == "talkers" && argc <= 3) {
+        type = CTL_TALKERS;
+        setName(argc == 3 ? argv[2] : "all", request.target.name);
+        length = sizeof(request.target);
+    } else if (command == "sketch" && (argc == 4 || argc == 5)) {
+        type = CTL_SKETCH;
+        setName(argv[2], request.sketch.name);
+        request.sketch.minutes = static_cast<uint32_t>(strtoul(argv[3], nullptr, 10));
+        length = sizeof(request.sketch);
+        g_summaryFile = argc == 5 ? argv[4] : nullptr;
+        clearSummary(g_savedSummary, 0, 0);
+    } else if (command == "merge" && argc >= 3) {
+        return mergeFiles(argv + 2, argc - 2);
+    } else if (command == "tail" && argc == 2) {
+        type = CTL_TAIL;
+    } else {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int sock = connectControl();
+    if (sock < 0) {
+        return EXIT_FAILURE;
+    }
+    if (!sendRequest(sock, type, &request, length)) {
+        std::cerr << "!!! netwatchctl.cpp !!!- Failed to send request: " << strerror(errno) << std::endl;
+        close(sock);
+        return EXIT_FAILURE;
+    }
+    int status = readResponse(sock);
+    close(sock);
+    if (status == EXIT_SUCCESS && g_summaryFile != nullptr && !saveSummary(g_summaryFile, g_savedSummary)) {
+        status = EXIT_FAILURE;
+    }
+    return status;
+}
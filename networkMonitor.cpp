@@ -5,9 +5,20 @@
  *          through child processes and communicates with clients via Unix domain sockets.
  */
 
+ #include <algorithm>
+ #include <cmath>
+ #include <cstdio>
+ #include <ctime>
+ #include <fcntl.h>
+ #include <iomanip>
  #include <iostream>
+ #include <net/if.h>
+ #include <netinet/in.h>
+ #include <random>
+ #include <sstream>
  #include <signal.h>
  #include <string.h>
+ #include <sys/ioctl.h>
  #include <sys/socket.h>
  #include <sys/types.h>
  #include <sys/un.h>
@@ -15,20 +26,107 @@
  #include <unistd.h>
  #include <vector>
  
+ #include "collector.h"
+ #include "controlProtocol.h"
+ #include "derivedMetrics.h"
+ #include "jsonLines.h"
+ #include "monitorState.h"
+ #include "probes.h"
+ #include "sketch.h"
+ #include "talkers.h"
+ 
  // Constants
  const char* SOCKET_PATH = "/tmp/networkMonitor";
- const int BUFFER_SIZE = 256;
- const int MAX_CONNECTIONS = 2;
+ const int BUFFER_SIZE = 4096; // Holds the longest intfMonitor report
+ const int CONSOLE_LINE_SIZE = 1024; // Longest console command
+ const int MAX_CONTROL_CLIENTS = 8;   // Concurrent netwatchctl connections
+ const unsigned DEFAULT_CAPTURE_SECONDS = 10;
+ const time_t CAPTURE_COOLDOWN = 60;  // Seconds between triggered captures of one interface
+ 
+ // Simulated collectors used by --simulate
+ const int SIM_SPEED_MBPS = 1000;
+ const time_t SIM_START_TIME = 1700000000; // Fixed so runs with the same seed are identical
+ const int SIM_RESET_ODDS = 20000;         // One driver reload per this many samples on average
+ const int SIM_SOCKET_PAIRS = 256;         // Reused group by group, keeping descriptors below FD_SETSIZE
+ 
+ // Synthetic flow feed used by --sketch-bench
+ const double SKETCH_BENCH_SKEW = 1.1;   // Zipf exponent of the flow sizes
+ const int SKETCH_BENCH_PACKETS = 10;    // Packets per flow on average
+ 
+ // Interfaces whose samples --jsonl-bench serializes round-robin
+ const int JSONL_BENCH_INTERFACES = 64;
+ 
+ // Times --restore-bench takes every stack down and restores it
+ const int RESTORE_BENCH_ROUNDS = 50;
  
  // Global state management
  bool g_isRunning = true;             // Flag indicating server operation status
  std::vector<pid_t> g_childProcesses; // Container for tracking child process IDs
+ unsigned g_counterMask = ALL_COUNTERS; // Counters collectors read and send, see --counters
+ 
+ /**
+  * @brief Bytes received from an interface monitor that do not yet form a whole report
+  */
+ struct ReportBuffer {
+     char data[BUFFER_SIZE];
+     size_t length = 0;
+ };
+ std::vector<ReportBuffer> g_reportBuffers; // One per monitor slot
+ 
+ /**
+  * @brief Console input that does not yet form a whole command line
+  */
+ struct ConsoleBuffer {
+     char data[CONSOLE_LINE_SIZE];
+     size_t length = 0;
+ };
+ ConsoleBuffer g_console;
+ 
+ /**
+  * @brief Payload of a control request frame; every request starts with an interface name
+  */
+ union ControlRequest {
+     ControlTarget target;
+     ControlHistoryRequest history;
+     ControlInterval interval;
+     ControlCapture capture;
+     ControlSketchRequest sketch;
+ };
+ 
+ /**
+  * @brief A connected netwatchctl
+  */
+ struct ControlClient {
+     int fd;
+     bool tailing;                // Receives CTL_EVENT records until it disconnects
+     size_t received = 0;         // Bytes of the current request frame in frame
+     char frame[sizeof(ControlHeader) + sizeof(ControlRequest)];
+ };
+ std::vector<ControlClient> g_controlClients;
+ 
+ /**
+  * @brief Rule capturing an interface's packets when a derived metric crosses its threshold
+  */
+ struct CaptureTrigger {
+     std::string metricName;             // Set by --capture
+     int metric = -1;                    // Index in g_derived.metrics, -1 if no rule
+     unsigned seconds = DEFAULT_CAPTURE_SECONDS;
+     unsigned maxMiB = DEFAULT_CAPTURE_MIB;
+     std::vector<unsigned char> wasAbove; // Per slot, so only upward crossings trigger
+     std::vector<time_t> lastCapture;     // Per slot, for CAPTURE_COOLDOWN
+     bool groupWasAbove[MAX_INTERFACE_GROUPS] = {};
+ };
+ CaptureTrigger g_captureTrigger;
+ std::vector<TalkerTracker> g_talkers; // One per interface, with --top-talkers
+ std::vector<struct iovec> g_renderIovecs; // Cached fragments being written, reused by every print
+ JsonLinesWriter g_jsonLines;              // --jsonl output, fd -1 when off
  
  /**
   * @brief Creates a Unix domain socket server for IPC communication
+  * @param path Filesystem path of the socket
   * @return File descriptor of created socket, -1 on error
   */
- int createServerSocket() {
+ int createServerSocket(const char* path) {
      struct sockaddr_un addr;
      int serverFd = socket(AF_UNIX, SOCK_STREAM, 0);
      
@@ -41,8 +139,8 @@
      // Initialize socket address structure
      memset(&addr, 0, sizeof(addr));
      addr.sun_family = AF_UNIX;
-     strncpy(addr.sun_path, SOCKET_PATH, sizeof(addr.sun_path) - 1);
-     unlink(SOCKET_PATH);
+     strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+     unlink(path);
  
      if (bind(serverFd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
          std::cerr << "!!! networkMonitor.cpp !!!- Error binding server socket: " 
@@ -99,21 +197,26 @@
   * @param serverFd Server socket file descriptor
   * @param masterSet Master file descriptor set
   * @param maxFd Maximum file descriptor value
-  * @param clientFds Array of client file descriptors
+  * @param clientFds Client file descriptors, one per monitor slot
   * @param activeClients Number of active client connections
   */
  void handleNewConnection(int serverFd, fd_set& masterSet, int& maxFd, 
-                         int clientFds[], int& activeClients) {
+                         std::vector<int>& clientFds, int& activeClients) {
      char buffer[BUFFER_SIZE];
-     clientFds[activeClients] = accept(serverFd, nullptr, nullptr);
+     int clientFd = accept(serverFd, nullptr, nullptr);
      
-     if (clientFds[activeClients] < 0) {
+     if (clientFd < 0) {
          std::cerr << "!!! networkMonitor.cpp !!!- Error accepting connection: " 
                    << strerror(errno) << std::endl;
          return;
      }
- 
-     FD_SET(clientFds[activeClients], &masterSet);
+     if (activeClients == static_cast<int>(clientFds.size())) {
+         std::cerr << "!!! networkMonitor.cpp !!!- More interface monitors than requested interfaces, "
+                   << "connection refused" << std::endl;
+         close(clientFd);
+         return;
+     }
+     clientFds[activeClients] = clientFd;
  
      int bytesRead = read(clientFds[activeClients], buffer, BUFFER_SIZE - 1);
      if (bytesRead < 0) {
@@ -127,7 +230,8 @@
  
      // Verify connection handshake
      if (strcmp(buffer, "ready_to_monitor") == 0) {
-         snprintf(buffer, BUFFER_SIZE, "start_monitoring");
+         // Tell the collector which counters are consumed so it skips the others
+         snprintf(buffer, BUFFER_SIZE, "start_monitoring counters %x", g_counterMask);
          
          if (write(clientFds[activeClients], buffer, strlen(buffer) + 1) == -1) {
              std::cerr << "!!! networkMonitor.cpp !!!- Error writing to interface monitor: "
@@ -142,46 +246,1456 @@
          return;
      }
  
+     NETWATCH_PROBE2(accept, activeClients, clientFds[activeClients]);
+     FD_SET(clientFds[activeClients], &masterSet);
      maxFd = std::max(maxFd, clientFds[activeClients]);
      ++activeClients;
  }
  
+ /**
+  * @brief Prints and ingests one decoded report
+  * @param slot Monitor slot that sent the report
+  * @param report The report as received, without its closing blank line
+  * @param length Length of the report
+  * @param sample The decoded report
+  */
+ void publishReport(int slot, const char* report, size_t length, const InterfaceSample& sample) {
+     if (g_printSamples) {
+         PERF_BEGIN(renderStart);
+         std::cout << "Monitor [" << slot << "] - Data received:\n";
+         std::cout.write(report, length);
+         PERF_END(g_perfStages[STAGE_RENDER], renderStart);
+     }
+     NETWATCH_PROBE2(publish, slot, length);
+     PERF_BEGIN(ingestStart);
+     ingestSample(slot, sample);
+     PERF_END(g_perfStages[STAGE_INGEST], ingestStart);
+     if (g_jsonLines.fd >= 0) {
+         appendSampleJson(g_jsonLines, slot, g_clock->wallTime());
+     }
+     if (g_printSamples && g_interfaceStates[slot].lastSampleRated) {
+         PERF_BEGIN(fragmentStart);
+         g_renderIovecs.clear();
+         gatherFragments(slot, SAMPLE_FRAGMENTS, g_renderIovecs);
+         fflush(stdout);
+         writeFragments(STDOUT_FILENO, g_renderIovecs);
+         PERF_END(g_perfStages[STAGE_RENDER], fragmentStart);
+     }
+     if (g_printSamples) {
+         std::cout << std::endl;
+     }
+ }
+ 
  /**
   * @brief Processes incoming data from interface monitors
+  * @details A read may end anywhere, in the middle of a report too. Whole reports,
+  *          each closed by a blank line, are decoded; the rest is kept in the slot's
+  *          ReportBuffer until the next read completes it. Only a whole report that
+  *          fails to decode, or a report too long for the buffer, is dropped.
   * @param activeClients Number of active clients
-  * @param clientFds Array of client file descriptors
+  * @param clientFds Client file descriptors, -1 for closed slots
   * @param readSet File descriptor set for reading
+  * @param masterSet Master file descriptor set, closed monitors are removed from it
   */
- void processMonitorData(int activeClients, int clientFds[], fd_set& readSet) {
-     char buffer[BUFFER_SIZE];
-     
+ void processMonitorData(int activeClients, std::vector<int>& clientFds, fd_set& readSet, fd_set& masterSet) {
      for (int i = 0; i < activeClients; ++i) {
-         if (FD_ISSET(clientFds[i], &readSet)) {
-             bzero(buffer, BUFFER_SIZE);
-             int bytesRead = read(clientFds[i], buffer, BUFFER_SIZE);
-             
-             if (bytesRead > 0) {
-                 std::cout << "Monitor [" << i << "] - Data received:\n" 
-                          << buffer << std::endl;
-             } else if (bytesRead == 0) {
+         if (clientFds[i] >= 0 && FD_ISSET(clientFds[i], &readSet)) {
+             ReportBuffer& pending = g_reportBuffers[i];
+             int bytesRead = read(clientFds[i], pending.data + pending.length, BUFFER_SIZE - pending.length);
+             pending.length += bytesRead > 0 ? bytesRead : 0;
+ 
+             size_t offset = 0;
+             while (const char* end = static_cast<const char*>(
+                        memmem(pending.data + offset, pending.length - offset, "\n\n", 2))) {
+                 size_t reportLength = end + 2 - (pending.data + offset);
+                 InterfaceSample sample;
+                 if (timedDecode(pending.data + offset, reportLength, sample) == reportLength) {
+                     publishReport(i, pending.data + offset, reportLength - 1, sample);
+                 } else {
+                     std::cerr << "!!! networkMonitor.cpp !!!- Monitor [" << i << "] sent a malformed report, "
+                               << reportLength << " bytes dropped" << std::endl;
+                 }
+                 offset += reportLength;
+             }
+             if (offset == 0 && pending.length == static_cast<size_t>(BUFFER_SIZE)) {
+                 std::cerr << "!!! networkMonitor.cpp !!!- Monitor [" << i << "] sent a report longer than "
+                           << BUFFER_SIZE << " bytes, dropped" << std::endl;
+                 offset = pending.length;
+             }
+             memmove(pending.data, pending.data + offset, pending.length - offset);
+             pending.length -= offset;
+ 
+             if (bytesRead == 0) {
                  std::cerr << "Monitor [" << i << "] has closed the connection." 
                           << std::endl;
+                 emitEvent(EVENT_DISCONNECT, i, g_interfaceStates[i].last.name, "");
+                 FD_CLR(clientFds[i], &masterSet);
                  close(clientFds[i]);
                  clientFds[i] = -1;
+                 pending.length = 0;
+                 g_interfaceStates[i] = InterfaceState();
+                 resetRates(i);
+                 clearDerivedSlot(i);
              }
          }
      }
  }
  
+ /**
+  * @brief Runs a history range query typed on the console
+  * @details The counter may also name a derived metric or, with a group as the
+  *          interface, a metric summed over the group.
+  * @param words Remaining words of the command: <interface> <seconds> [counter] [min_rate]
+  */
+ void handleHistoryCommand(std::istringstream& words) {
+     std::string interface, counterName = "rx_bytes";
+     long seconds = 0;
+     double minRate = 0.0;
+     if (!(words >> interface >> seconds)) {
+         std::cout << "Usage: history <interface> <seconds> [counter] [min_rate]" << std::endl;
+         return;
+     }
+     words >> counterName >> minRate;
+     int counter = std::find(COUNTER_NAMES, COUNTER_NAMES + NUM_COUNTERS, counterName) - COUNTER_NAMES;
+     int derived = findDerivedMetric(counterName);
+     if (derived >= 0) {
+         counter = derived; // Derived values are stored in the counter slots of their own history
+         bool group = std::any_of(g_derived.groups.begin(), g_derived.groups.end(),
+                                  [&](const InterfaceGroup& g) { return g.name == interface; });
+         interface += group ? GROUP_HISTORY_SUFFIX : DERIVED_HISTORY_SUFFIX;
+     }
+     auto history = g_history.find(interface);
+     if (counter == NUM_COUNTERS || history == g_history.end()) {
+         std::cout << "No history for " << interface << " " << counterName << std::endl;
+         return;
+     }
+ 
+     HistoryQuery query;
+     query.to = g_clock->wallTime();
+     query.from = query.to - seconds;
+     query.counter = counter;
+     query.minRate = minRate;
+     HistoryResult result;
+     queryHistory(history->second.minutes, query, result);
+     queryHistory(history->second.raw, query, result);
+     printf(derived >= 0 ? "%s %s last %lds: %zu samples (%zu blocks scanned, %zu skipped) min %.4g avg %.4g max %.4g\n"
+                         : "%s %s last %lds: %zu samples (%zu blocks scanned, %zu skipped) min %.0f avg %.0f max %.0f /s\n",
+            interface.c_str(), counterName.c_str(), seconds, result.matched, result.blocksScanned,
+            result.blocksSkipped, result.min, result.matched ? result.sum / result.matched : 0.0, result.max);
+ }
+ 
+ /**
+  * @brief Prints ingestion and compaction statistics
+  */
+ void printStats() {
+     printf("decode: %zu reports, %zu rejected, avg %.0f ns (%.0f reports/s)\n", g_stats.messagesDecoded,
+            g_stats.messagesRejected,
+            g_stats.messagesDecoded ? g_stats.decodeSeconds / g_stats.messagesDecoded * 1e9 : 0.0,
+            g_stats.decodeSeconds > 0.0 ? g_stats.messagesDecoded / g_stats.decodeSeconds : 0.0);
+     printf("ingest: %zu samples, avg %.1f us, max %.1f us\n", g_stats.samplesIngested,
+            g_stats.samplesIngested ? g_stats.ingestSeconds / g_stats.samplesIngested * 1e6 : 0.0,
+            g_stats.maxIngestSeconds * 1e6);
+     printf("pools: history blocks %zu allocations from %zu chunks, segments %zu allocations from %zu chunks\n",
+            g_blockPool.allocations(), g_blockPool.chunks(), g_segmentPool.allocations(), g_segmentPool.chunks());
+     if (g_jsonLines.fd >= 0) {
+         printf("jsonl: %zu lines, %zu writes, %zu bytes written, %zu bytes dropped\n", g_jsonLines.lines,
+                g_jsonLines.flushes, g_jsonLines.bytesWritten, g_jsonLines.bytesDropped);
+     }
+     printf("compaction: %zu passes, %zu records rolled up (%.0f records/s), %zu raw blocks evicted, %zu minute blocks expired, %.3f s total\n",
+            g_stats.compactionPasses, g_stats.recordsRolledUp,
+            g_stats.compactionSeconds > 0.0 ? g_stats.recordsRolledUp / g_stats.compactionSeconds : 0.0,
+            g_stats.blocksEvicted, g_stats.blocksExpired, g_stats.compactionSeconds);
+ 
+     size_t total = 0;
+     std::cout << "memory:";
+     for (int m = 0; m < NUM_MEM_SUBSYSTEMS; ++m) {
+         std::cout << " " << MEM_SUBSYSTEM_NAMES[m] << " " << g_memoryUsage[m] / 1024 << " KiB,";
+         total += m != MEM_POOL_FREE ? g_memoryUsage[m] : 0;
+     }
+     std::cout << " total in use " << total / 1024 << " KiB";
+     if (g_memoryBudget != 0) {
+         std::cout << " of " << g_memoryBudget / 1024 << " KiB budget";
+     }
+     std::cout << ", raw retention " << g_rawRetention << "s" << std::endl;
+     printPerfStages(std::cout, g_perfStages, NUM_STAGES);
+ }
+ 
+ /**
+  * @brief Prints the latest value of every derived metric per interface and group
+  */
+ void printDerived() {
+     if (g_derived.metrics.empty()) {
+         std::cout << "No derived metrics, define them with --derive <name>=<expression>" << std::endl;
+         return;
+     }
+     for (const DerivedMetric& metric : g_derived.metrics) {
+         std::cout << metric.name << " = " << metric.expression;
+         if (metric.hasThreshold) {
+             std::cout << " (alert above " << metric.threshold << ")";
+         }
+         std::cout << std::endl;
+     }
+     for (size_t slot = 0; slot < g_derived.slotNames.size(); ++slot) {
+         if (g_derived.slotNames[slot].empty()) {
+             continue;
+         }
+         printf("%-16s", g_derived.slotNames[slot].c_str());
+         if (!g_derived.slotOwners[slot].empty()) {
+             printf(" (%s)", g_derived.slotOwners[slot].c_str());
+         }
+         for (size_t m = 0; m < g_derived.metrics.size(); ++m) {
+             printf(" %s %.4g", g_derived.metrics[m].name.c_str(), g_derived.values[m][slot]);
+         }
+         printf("\n");
+     }
+     for (const InterfaceGroup& group : g_derived.groups) {
+         printf("%-16s", (group.name + " (group)").c_str());
+         for (size_t m = 0; m < g_derived.metrics.size(); ++m) {
+             printf(" %s %.4g", g_derived.metrics[m].name.c_str(), group.values[m]);
+         }
+         printf("\n");
+     }
+ }
+ 
+ /**
+  * @brief Prints the heaviest flows or sources of the last second
+  * @param words Remaining words of the command: [interface]
+  */
+ void printTalkers(std::istringstream& words) {
+     std::string interface;
+     words >> interface;
+     if (g_talkers.empty()) {
+         std::cout << "No top talkers, start with --top-talkers flows|sources" << std::endl;
+         return;
+     }
+     for (const TalkerTracker& tracker : g_talkers) {
+         if (!interface.empty() && tracker.interface != interface) {
+             continue;
+         }
+         printf("%s: %zu flows\n", tracker.interface.c_str(), tracker.flows);
+         for (const TopTalker& talker : tracker.top) {
+             printf("  %-60s %12.0f B/s %8.0f pkt/s\n", formatTalker(talker.key).c_str(), talker.bytesPerSecond,
+                    talker.packetsPerSecond);
+         }
+     }
+ }
+ 
+ /**
+  * @brief Prints the heaviest flows of the last minutes from the talker summaries
+  * @param words Remaining words of the command: <interface|all> <minutes>
+  */
+ void printSketch(std::istringstream& words) {
+     std::string interface;
+     int minutes = 0;
+     if (!(words >> interface >> minutes) || minutes <= 0 || minutes > SKETCH_INTERVALS) {
+         std::cout << "Usage: sketch <interface|all> <minutes>, at most " << SKETCH_INTERVALS << " minutes" << std::endl;
+         return;
+     }
+     if (g_talkers.empty()) {
+         std::cout << "No flow summaries, start with --top-talkers flows|sources" << std::endl;
+         return;
+     }
+     FlowSummary summary;
+     for (const TalkerTracker& tracker : g_talkers) {
+         if (interface == "all" || tracker.interface == interface) {
+             summarizeTalkers(tracker, g_clock->wallTime(), minutes, summary);
+             printSummary(std::cout, tracker.interface, summary, TOP_TALKERS);
+         }
+     }
+ }
+ 
+ /**
+  * @brief Prints one summary line per interface from the rendered-fragment cache
+  * @param words Remaining words of the command: [interface]
+  */
+ void showInterfaces(std::istringstream& words) {
+     std::string interface;
+     words >> interface;
+     g_renderIovecs.clear();
+     for (int i = 0; i < static_cast<int>(g_interfaceStates.size()); ++i) {
+         const InterfaceState& state = g_interfaceStates[i];
+         if (state.hasSample && (interface.empty() || interface == state.last.name)) {
+             gatherFragments(i, 1u << FRAGMENT_SUMMARY, g_renderIovecs);
+         }
+     }
+     fflush(stdout);
+     writeFragments(STDOUT_FILENO, g_renderIovecs);
+ }
+ 
+ /**
+  * @brief Executes a command typed on the console
+  * @details Supported: history <interface> <seconds> [counter] [min_rate], derived, talkers [interface],
+  *          sketch <interface|all> <minutes>, show [interface], stats
+  * @param line Command line without the trailing newline
+  */
+ void handleCommand(const std::string& line) {
+     std::istringstream words(line);
+     std::string command;
+     if (!(words >> command)) {
+         return;
+     }
+     if (command == "history") {
+         handleHistoryCommand(words);
+     } else if (command == "stats") {
+         printStats();
+     } else if (command == "derived") {
+         printDerived();
+     } else if (command == "talkers") {
+         printTalkers(words);
+     } else if (command == "sketch") {
+         printSketch(words);
+     } else if (command == "show") {
+         showInterfaces(words);
+     } else {
+         std::cout << "Commands: history <interface> <seconds> [counter|metric] [min_rate], derived,"
+                   << " talkers [interface], sketch <interface|all> <minutes>, show [interface], stats" << std::endl;
+     }
+ }
+ 
+ /**
+  * @brief Reads what the console has typed and runs every complete command line
+  * @details Called when select reports STDIN readable, so the single read never
+  *          blocks. A partial line is kept in g_console until its newline arrives,
+  *          and every line of a read is run, not only the first. At end of input a
+  *          last line without a newline is run too.
+  * @return false once the console has closed
+  */
+ bool readConsole() {
+     int bytesRead = read(STDIN_FILENO, g_console.data + g_console.length, CONSOLE_LINE_SIZE - g_console.length);
+     if (bytesRead < 0) {
+         return errno == EINTR || errno == EAGAIN;
+     }
+     g_console.length += bytesRead;
+ 
+     size_t offset = 0;
+     while (const char* end = static_cast<const char*>(
+                memchr(g_console.data + offset, '\n', g_console.length - offset))) {
+         size_t lineLength = end - (g_console.data + offset);
+         handleCommand(std::string(g_console.data + offset, lineLength));
+         offset += lineLength + 1;
+     }
+     if (bytesRead == 0 && offset < g_console.length) {
+         handleCommand(std::string(g_console.data + offset, g_console.length - offset));
+         offset = g_console.length;
+     } else if (offset == 0 && g_console.length == static_cast<size_t>(CONSOLE_LINE_SIZE)) {
+         std::cerr << "!!! networkMonitor.cpp !!!- Console line longer than " << CONSOLE_LINE_SIZE
+                   << " bytes, dropped" << std::endl;
+         offset = g_console.length;
+     }
+     memmove(g_console.data, g_console.data + offset, g_console.length - offset);
+     g_console.length -= offset;
+     return bytesRead > 0;
+ }
+ 
+ /**
+  * @brief Streams response records to a control client in frames of up to MAX_CONTROL_FRAME
+  * @details Records accumulate in one fixed buffer that is written out whenever it
+  *          fills, so a response of any length needs no more memory than one frame
+  *          and nothing is rendered as text on the server side.
+  */
+ class ControlWriter {
+ public:
+     explicit ControlWriter(int fd) : m_fd(fd) {}
+ 
+     void record(uint8_t type, const void* data, size_t size) {
+         if (type != m_type || m_used + size > sizeof(m_buffer)) {
+             closeFrame();
+             if (m_used + sizeof(ControlHeader) + size > sizeof(m_buffer)) {
+                 flush();
+             }
+             m_frameStart = m_used;
+             m_used += sizeof(ControlHeader);
+             m_type = type;
+         }
+         memcpy(m_buffer + m_used, data, size);
+         m_used += size;
+     }
+ 
+     void finish(uint32_t records) {
+         ControlDone done = {records};
+         record(CTL_DONE, &done, sizeof(done));
+         flush();
+     }
+ 
+     void error(const std::string& message) {
+         record(CTL_ERROR, message.data(), message.size());
+         flush();
+     }
+ 
+     bool ok() const { return m_ok; }
+ 
+ private:
+     void closeFrame() {
+         if (m_type != 0) {
+             ControlHeader header = {CONTROL_MAGIC, CONTROL_VERSION, m_type,
+                                     static_cast<uint32_t>(m_used - m_frameStart - sizeof(ControlHeader))};
+             memcpy(m_buffer + m_frameStart, &header, sizeof(header));
+             m_type = 0;
+         }
+     }
+ 
+     void flush() {
+         closeFrame();
+         for (size_t sent = 0; m_ok && sent < m_used;) {
+             ssize_t written = send(m_fd, m_buffer + sent, m_used - sent, MSG_NOSIGNAL);
+             if (written < 0 && errno != EINTR) {
+                 m_ok = false;
+             } else if (written > 0) {
+                 sent += written;
+             }
+         }
+         m_used = 0;
+     }
+ 
+     int m_fd;
+     bool m_ok = true;
+     uint8_t m_type = 0;       // Type of the open frame, 0 if none
+     size_t m_frameStart = 0;  // Offset of the open frame's header
+     size_t m_used = 0;
+     char m_buffer[sizeof(ControlHeader) + MAX_CONTROL_FRAME];
+ };
+ 
+ /**
+  * @brief Creates the control socket netwatchctl connects to
+  * @return Listening file descriptor, -1 if the control socket is unavailable
+  */
+ int openControlSocket() {
+     int controlFd = createServerSocket(CONTROL_SOCKET_PATH);
+     if (controlFd >= 0 && listen(controlFd, MAX_CONTROL_CLIENTS) == -1) {
+         std::cerr << "!!! networkMonitor.cpp !!!- Error starting control listener: "
+                   << strerror(errno) << std::endl;
+         close(controlFd);
+         unlink(CONTROL_SOCKET_PATH);
+         controlFd = -1;
+     }
+     return controlFd;
+ }
+ 
+ /**
+  * @brief Accepts a netwatchctl connection
+  * @details Requests are read as they arrive, see readControlFrame(). Sends time out
+  *          after a second so a client that stops reading cannot hold up sampling for
+  *          longer than that.
+  * @param controlFd Listening control socket
+  * @param masterSet Master file descriptor set
+  * @param maxFd Maximum file descriptor value
+  */
+ void acceptControlClient(int controlFd, fd_set& masterSet, int& maxFd) {
+     int clientFd = accept(controlFd, nullptr, nullptr);
+     if (clientFd < 0) {
+         std::cerr << "!!! networkMonitor.cpp !!!- Error accepting control connection: "
+                   << strerror(errno) << std::endl;
+         return;
+     }
+     if (g_controlClients.size() >= static_cast<size_t>(MAX_CONTROL_CLIENTS)) {
+         close(clientFd);
+         return;
+     }
+     struct timeval timeout = {1, 0};
+     setsockopt(clientFd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+     g_controlClients.push_back({clientFd, false});
+     FD_SET(clientFd, &masterSet);
+     maxFd = std::max(maxFd, clientFd);
+ }
+ 
+ /**
+  * @brief Reads what has arrived of a control client's request frame
+  * @details Called when select() found the client readable, so the single read never
+  *          blocks; a frame split across reads is completed by later calls. At most the
+  *          rest of the current frame is read, so pipelined requests are answered one
+  *          at a time.
+  * @param client The control client
+  * @return 1 once the frame is complete, 0 while it is not, -1 if the client is gone or
+  *         sent a malformed header and must be closed
+  */
+ int readControlFrame(ControlClient& client) {
+     ControlHeader header;
+     size_t wanted = sizeof(header);
+     if (client.received >= sizeof(header)) {
+         memcpy(&header, client.frame, sizeof(header));
+         wanted += header.length;
+     }
+     ssize_t bytesRead = read(client.fd, client.frame + client.received, wanted - client.received);
+     if (bytesRead < 0 && (errno == EINTR || errno == EAGAIN)) {
+         return 0;
+     }
+     if (bytesRead <= 0) {
+         return -1;
+     }
+     client.received += bytesRead;
+     if (client.received == sizeof(header)) {
+         memcpy(&header, client.frame, sizeof(header));
+         if (header.magic != CONTROL_MAGIC || header.version != CONTROL_VERSION ||
+             header.length > sizeof(ControlRequest)) {
+             ControlWriter writer(client.fd);
+             writer.error("unsupported protocol version or malformed request");
+             return -1;
+         }
+         wanted += header.length;
+     }
+     return client.received == wanted ? 1 : 0;
+ }
+ 
+ /**
+  * @brief Forwards a command to the monitors of matching interfaces
+  * @param name Interface name, empty for every connected monitor
+  * @param command Newline-terminated command understood by intfMonitor
+  * @param activeClients Number of active clients
+  * @param clientFds Client file descriptors, -1 for closed slots
+  * @param kind Event reported for every monitor the command reached
+  * @param detail Event detail
+  * @param value Event value
+  * @return Number of monitors the command was sent to
+  */
+ uint32_t forwardToMonitors(const char* name, const char* command, int activeClients, const std::vector<int>& clientFds,
+                            MonitorEventKind kind, const char* detail, double value) {
+     uint32_t notified = 0;
+     for (int i = 0; i < activeClients; ++i) {
+         const InterfaceState& state = g_interfaceStates[i];
+         if (clientFds[i] < 0 || !state.hasSample || (name[0] != '\0' && strcmp(state.last.name, name) != 0)) {
+             continue;
+         }
+         if (send(clientFds[i], command, strlen(command), MSG_NOSIGNAL) > 0) {
+             emitEvent(kind, i, state.last.name, detail, value);
+             ++notified;
+         }
+     }
+     return notified;
+ }
+ 
+ /**
+  * @brief Context of a history dump, passed through scanHistory()
+  */
+ struct HistoryDump {
+     ControlWriter* writer;
+     uint32_t minuteRollup;
+     uint32_t records;
+ };
+ 
+ /**
+  * @brief Sends one history record of a dump
+  * @param record Stored record
+  * @param context The HistoryDump
+  */
+ void sendHistoryRecord(const HistoryRecord& record, void* context) {
+     HistoryDump& dump = *static_cast<HistoryDump*>(context);
+     ControlHistoryRecord out;
+     out.timestamp = record.timestamp;
+     out.minuteRollup = dump.minuteRollup;
+     memcpy(out.rates, record.rates, sizeof(out.rates));
+     dump.writer->record(CTL_HISTORY_RECORD, &out, sizeof(out));
+     ++dump.records;
+ }
+ 
+ /**
+  * @brief Answers the request frame a control client completed
+  * @param client The control client, its frame complete and validated by readControlFrame()
+  * @param activeClients Number of active interface monitors
+  * @param clientFds Interface monitor file descriptors, -1 for closed slots
+  * @return false if the client is gone and must be closed
+  */
+ bool handleControlRequest(ControlClient& client, int activeClients, const std::vector<int>& clientFds) {
+     ControlHeader header;
+     ControlRequest request;
+     memcpy(&header, client.frame, sizeof(header));
+     memset(&request, 0, sizeof(request));
+     memcpy(&request, client.frame + sizeof(header), header.length);
+     client.received = 0;
+     ControlWriter writer(client.fd);
+     request.target.name[MAX_IFACE_NAME - 1] = '\0'; // Every request starts with a name
+ 
+     uint32_t records = 0;
+     switch (header.type) {
+     case CTL_LIST:
+         for (int i = 0; i < static_cast<int>(g_interfaceStates.size()); ++i) {
+             const InterfaceState& state = g_interfaceStates[i];
+             if (!state.hasSample) {
+                 continue;
+             }
+             ControlInterfaceRecord out;
+             memcpy(out.name, state.last.name, sizeof(out.name));
+             memcpy(out.state, state.last.state, sizeof(out.state));
+             out.slot = i;
+             out.ifindex = state.last.ifindex;
+             out.speedMbps = state.last.speedMbps;
+             out.mtu = state.last.mtu;
+             out.resetCount = state.resetCount;
+             out.wrapCount = state.wrapCount;
+             out.peerIfindex = state.last.peerIfindex;
+             memcpy(out.owner, state.last.owner, sizeof(out.owner));
+             writer.record(CTL_INTERFACE, &out, sizeof(out));
+             ++records;
+         }
+         writer.finish(records);
+         break;
+     case CTL_RATES:
+         for (int i = 0; i < static_cast<int>(g_interfaceStates.size()); ++i) {
+             const InterfaceState& state = g_interfaceStates[i];
+             if (!state.hasSample || (request.target.name[0] != '\0' && strcmp(state.last.name, request.target.name) != 0)) {
+                 continue;
+             }
+             ControlRateRecord out;
+             memcpy(out.name, state.last.name, sizeof(out.name));
+             for (int h = 0; h < NUM_HORIZONS; ++h) {
+                 for (int c = 0; c < NUM_COUNTERS; ++c) {
+                     out.rates[h][c] = static_cast<float>(g_rates.rates[h][c][i]);
+                 }
+             }
+             out.utilization[0] = static_cast<float>(state.rx.percent);
+             out.utilization[1] = static_cast<float>(state.tx.percent);
+             writer.record(CTL_RATE, &out, sizeof(out));
+             ++records;
+         }
+         writer.finish(records);
+         break;
+     case CTL_HISTORY: {
+         auto history = g_history.find(request.history.name);
+         if (history == g_history.end()) {
+             writer.error("no history for " + std::string(request.history.name));
+             break;
+         }
+         HistoryDump dump = {&writer, 1, 0};
+         scanHistory(history->second.minutes, request.history.from, request.history.to, sendHistoryRecord, &dump);
+         dump.minuteRollup = 0;
+         scanHistory(history->second.raw, request.history.from, request.history.to, sendHistoryRecord, &dump);
+         writer.finish(dump.records);
+         break;
+     }
+     case CTL_RESTORE:
+         records = request.target.name[0] == '\0' ? 0 :
+                   forwardToMonitors(request.target.name, "restore\n", activeClients, clientFds, EVENT_RESTORE,
+                                     "requested", 0.0);
+         if (records == 0) {
+             writer.error("no connected monitor for " + std::string(request.target.name));
+         } else {
+             writer.finish(records);
+         }
+         break;
+     case CTL_SET_INTERVAL: {
+         if (request.interval.intervalMs < MIN_INTERVAL_MS || request.interval.intervalMs > MAX_INTERVAL_MS) {
+             writer.error("interval must be between " + std::to_string(MIN_INTERVAL_MS) + " and " +
+                          std::to_string(MAX_INTERVAL_MS) + " ms");
+             break;
+         }
+         char command[32], detail[32];
+         snprintf(command, sizeof(command), "interval %u\n", request.interval.intervalMs);
+         snprintf(detail, sizeof(detail), "%u ms", request.interval.intervalMs);
+         records = forwardToMonitors(request.interval.name, command, activeClients, clientFds, EVENT_INTERVAL,
+                                     detail, request.interval.intervalMs / 1000.0);
+         if (records == 0) {
+             writer.error("no connected monitor for " + std::string(request.interval.name));
+         } else {
+             writer.finish(records);
+         }
+         break;
+     }
+     case CTL_TALKERS:
+         for (const TalkerTracker& tracker : g_talkers) {
+             if (request.target.name[0] != '\0' && tracker.interface != request.target.name) {
+                 continue;
+             }
+             for (const TopTalker& talker : tracker.top) {
+                 ControlTalkerRecord out;
+                 memset(&out, 0, sizeof(out));
+                 strncpy(out.name, tracker.interface.c_str(), sizeof(out.name) - 1);
+                 out.key = talker.key;
+                 out.bytesPerSecond = static_cast<float>(talker.bytesPerSecond);
+                 out.packetsPerSecond = static_cast<float>(talker.packetsPerSecond);
+                 out.flows = static_cast<uint32_t>(tracker.flows);
+                 writer.record(CTL_TALKER, &out, sizeof(out));
+                 ++records;
+             }
+         }
+         writer.finish(records);
+         break;
+     case CTL_SKETCH: {
+         if (request.sketch.minutes == 0 || request.sketch.minutes > static_cast<uint32_t>(SKETCH_INTERVALS)) {
+             writer.error("sketch covers 1 to " + std::to_string(SKETCH_INTERVALS) + " minutes");
+             break;
+         }
+         ControlSummaryRecord out;
+         for (const TalkerTracker& tracker : g_talkers) {
+             if (request.sketch.name[0] != '\0' && tracker.interface != request.sketch.name) {
+                 continue;
+             }
+             memset(out.name, 0, sizeof(out.name));
+             strncpy(out.name, tracker.interface.c_str(), sizeof(out.name) - 1);
+             summarizeTalkers(tracker, g_clock->wallTime(), static_cast<int>(request.sketch.minutes), out.summary);
+             writer.record(CTL_SUMMARY, &out, sizeof(out));
+             ++records;
+         }
+         writer.finish(records);
+         break;
+     }
+     case CTL_CAPTURE: {
+         if (request.capture.seconds == 0 || request.capture.seconds > MAX_CAPTURE_SECONDS ||
+             request.capture.maxMiB == 0 || request.capture.maxMiB > MAX_CAPTURE_MIB) {
+             writer.error("capture must last 1 to " + std::to_string(MAX_CAPTURE_SECONDS) + " s and 1 to " +
+                          std::to_string(MAX_CAPTURE_MIB) + " MiB");
+             break;
+         }
+         char command[64];
+         snprintf(command, sizeof(command), "capture %u %llu\n", request.capture.seconds,
+                  request.capture.maxMiB * 1024ULL * 1024ULL);
+         records = forwardToMonitors(request.capture.name, command, activeClients, clientFds, EVENT_CAPTURE,
+                                     "requested", request.capture.seconds);
+         if (records == 0) {
+             writer.error("no connected monitor for " + std::string(request.capture.name));
+         } else {
+             writer.finish(records);
+         }
+         break;
+     }
+     case CTL_TAIL:
+         client.tailing = true;
+         break;
+     default:
+         writer.error("unknown request type " + std::to_string(header.type));
+         break;
+     }
+     return writer.ok();
+ }
+ 
+ /**
+  * @brief Reads from every readable control client, answering completed requests and dropping clients that left
+  * @param readSet File descriptor set for reading
+  * @param masterSet Master file descriptor set
+  * @param activeClients Number of active interface monitors
+  * @param clientFds Interface monitor file descriptors, -1 for closed slots
+  */
+ void processControlRequests(fd_set& readSet, fd_set& masterSet, int activeClients,
+                             const std::vector<int>& clientFds) {
+     for (size_t i = 0; i < g_controlClients.size();) {
+         ControlClient& client = g_controlClients[i];
+         int frame = FD_ISSET(client.fd, &readSet) ? readControlFrame(client) : 0;
+         if (frame < 0 || (frame > 0 && !handleControlRequest(client, activeClients, clientFds))) {
+             FD_CLR(client.fd, &masterSet);
+             close(client.fd);
+             g_controlClients.erase(g_controlClients.begin() + i);
+         } else {
+             ++i;
+         }
+     }
+ }
+ 
+ /**
+  * @brief Asks one interface monitor to capture packets for the --capture rule
+  * @param slot Monitor slot, below the size of g_captureTrigger.lastCapture
+  * @param crossedOn Interface or group whose value crossed the threshold
+  * @param now Current wall-clock time
+  * @param clientFds Interface monitor file descriptors, -1 for closed slots
+  */
+ void requestCapture(size_t slot, const char* crossedOn, time_t now, const std::vector<int>& clientFds) {
+     CaptureTrigger& trigger = g_captureTrigger;
+     if (clientFds[slot] < 0 || now < trigger.lastCapture[slot] + CAPTURE_COOLDOWN) {
+         return;
+     }
+     char command[64];
+     snprintf(command, sizeof(command), "capture %u %llu\n", trigger.seconds, trigger.maxMiB * 1024ULL * 1024ULL);
+     const char* name = g_interfaceStates[slot].last.name;
+     if (send(clientFds[slot], command, strlen(command), MSG_NOSIGNAL) > 0) {
+         trigger.lastCapture[slot] = now;
+         std::cout << "!!! " << trigger.metricName << " above threshold on " << crossedOn << " - capturing "
+                   << trigger.seconds << "s of packets on " << name << " !!!" << std::endl;
+         emitEvent(EVENT_CAPTURE, static_cast<int>(slot), name, trigger.metricName.c_str(), trigger.seconds,
+                   trigger.maxMiB);
+     }
+ }
+ 
+ /**
+  * @brief Has the monitors of interfaces whose --capture metric just crossed its threshold capture packets
+  * @details Runs after evaluateDerivedMetrics(); does nothing without a --capture rule.
+  *          When a group's value crosses, every connected member captures.
+  * @param now Current wall-clock time
+  * @param activeClients Number of active interface monitors
+  * @param clientFds Interface monitor file descriptors, -1 for closed slots
+  */
+ void triggerCaptures(time_t now, int activeClients, const std::vector<int>& clientFds) {
+     CaptureTrigger& trigger = g_captureTrigger;
+     if (trigger.metric < 0) {
+         return;
+     }
+     const std::vector<unsigned char>& above = g_derived.above[trigger.metric];
+     size_t slots = std::min(above.size(), static_cast<size_t>(activeClients));
+     trigger.wasAbove.resize(slots, 0);
+     trigger.lastCapture.resize(slots, 0);
+     for (size_t slot = 0; slot < slots; ++slot) {
+         bool crossed = above[slot] && !trigger.wasAbove[slot];
+         trigger.wasAbove[slot] = above[slot];
+         if (crossed) {
+             requestCapture(slot, g_interfaceStates[slot].last.name, now, clientFds);
+         }
+     }
+     for (size_t g = 0; g < g_derived.groups.size(); ++g) {
+         const InterfaceGroup& group = g_derived.groups[g];
+         bool crossed = group.above[trigger.metric] && !trigger.groupWasAbove[g];
+         trigger.groupWasAbove[g] = group.above[trigger.metric];
+         for (size_t slot = 0; crossed && slot < slots; ++slot) {
+             if (g_derived.groupMask[slot] & (1u << g)) {
+                 requestCapture(slot, group.name.c_str(), now, clientFds);
+             }
+         }
+     }
+ }
+ 
+ /**
+  * @brief Runs the work due once per second of clock time
+  * @param now Current wall-clock time
+  * @param activeClients Number of active interface monitors
+  * @param clientFds Interface monitor file descriptors, -1 for closed slots
+  */
+ void runPeriodicTasks(time_t now, int activeClients, const std::vector<int>& clientFds) {
+     evaluateDerivedMetrics(now);
+     triggerCaptures(now, activeClients, clientFds);
+     for (TalkerTracker& tracker : g_talkers) {
+         readTopTalkers(tracker, g_clock->monotonic(), now);
+     }
+     compactHistory(now);
+     enforceMemoryBudget(now);
+ }
+ 
+ /**
+  * @brief Parses a --capture rule
+  * @param argument "<metric>[:<seconds>[:<MiB>]]"
+  * @param trigger Receives the rule; the metric is resolved once every --derive is known
+  * @return true if the limits are valid
+  */
+ bool parseCaptureRule(const char* argument, CaptureTrigger& trigger) {
+     std::string rule = argument;
+     size_t colon = rule.find(':');
+     trigger.metricName = rule.substr(0, colon);
+     if (colon != std::string::npos &&
+         sscanf(rule.c_str() + colon + 1, "%u:%u", &trigger.seconds, &trigger.maxMiB) < 1) {
+         trigger.seconds = 0;
+     }
+     if (trigger.seconds == 0 || trigger.seconds > MAX_CAPTURE_SECONDS || trigger.maxMiB == 0 ||
+         trigger.maxMiB > MAX_CAPTURE_MIB) {
+         std::cerr << "!!! networkMonitor.cpp !!!- Invalid --capture '" << argument << "': captures last 1 to "
+                   << MAX_CAPTURE_SECONDS << " s and 1 to " << MAX_CAPTURE_MIB << " MiB" << std::endl;
+         return false;
+     }
+     return true;
+ }
+ 
+ /**
+  * @brief Sends an event to every tailing control client
+  * @details A client whose socket buffer is full misses the event rather than
+  *          stalling ingestion.
+  * @param event The event
+  */
+ void publishEvent(const MonitorEvent& event) {
+     struct {
+         ControlHeader header;
+         ControlEventRecord record;
+     } frame;
+     memset(&frame, 0, sizeof(frame));
+     frame.header = {CONTROL_MAGIC, CONTROL_VERSION, CTL_EVENT, sizeof(frame.record)};
+     frame.record.timestamp = event.timestamp;
+     frame.record.kind = event.kind;
+     memcpy(frame.record.name, event.name, sizeof(frame.record.name));
+     memcpy(frame.record.detail, event.detail, sizeof(frame.record.detail));
+     frame.record.value[0] = event.value[0];
+     frame.record.value[1] = event.value[1];
+     for (const ControlClient& client : g_controlClients) {
+         if (client.tailing) {
+             send(client.fd, &frame, sizeof(frame), MSG_NOSIGNAL | MSG_DONTWAIT);
+         }
+     }
+ }
+ 
+ /**
+  * @brief Passes an event to the tailing control clients and the --jsonl file
+  * @details Installed as g_eventSink while the control socket or --jsonl is open.
+  * @param event The event
+  */
+ void dispatchEvent(const MonitorEvent& event) {
+     publishEvent(event);
+     if (g_jsonLines.fd >= 0) {
+         appendEventJson(g_jsonLines, event);
+     }
+ }
+ 
+ /**
+  * @brief Closes the control socket and every control client
+  * @param controlFd Listening control socket, -1 if none
+  * @param masterSet Master file descriptor set
+  */
+ void closeControlSocket(int controlFd, fd_set& masterSet) {
+     for (const ControlClient& client : g_controlClients) {
+         FD_CLR(client.fd, &masterSet);
+         close(client.fd);
+     }
+     g_controlClients.clear();
+     if (controlFd >= 0) {
+         FD_CLR(controlFd, &masterSet);
+         close(controlFd);
+         unlink(CONTROL_SOCKET_PATH);
+     }
+ }
+ 
+  /**
+  * @brief Counters and traffic model of one simulated collector
+  */
+ struct SimulatedInterface {
+     char name[MAX_IFACE_NAME];
+     int ifindex;
+     int upCount;
+     double load; // Fraction of line rate, random walk
+     unsigned long long counters[NUM_COUNTERS];
+ };
+ 
+ /**
+  * @brief Advances a simulated collector by one interval and formats its report
+  * @param sim Simulated collector
+  * @param rng Random source
+  * @param buffer Receives the report, formatted exactly like intfMonitor's
+  * @return true if a driver reload (counter reset) was injected into this report
+  */
+ bool simulateReport(SimulatedInterface& sim, std::mt19937& rng, char* buffer) {
+     std::normal_distribution<double> drift(0.0, 0.05);
+     std::uniform_int_distribution<int> resetRoll(1, SIM_RESET_ODDS);
+     std::poisson_distribution<int> faults(0.2);
+ 
+     // Traffic wanders between idle and line rate so saturation episodes occur
+     sim.load = std::min(1.0, std::max(0.0, sim.load + drift(rng)));
+     for (int direction = 0; direction < 2; ++direction) {
+         int base = direction == 0 ? RX_BYTES : TX_BYTES;
+         unsigned long long bytes = static_cast<unsigned long long>(sim.load * SIM_SPEED_MBPS * 1e6 / 8.0);
+         sim.counters[base + (RX_BYTES - RX_BYTES)] += bytes;
+         sim.counters[base + (RX_DROPPED - RX_BYTES)] += faults(rng);
+         sim.counters[base + (RX_ERRORS - RX_BYTES)] += faults(rng);
+         sim.counters[base + (RX_PACKETS - RX_BYTES)] += bytes / 800;
+     }
+ 
+     bool reset = false;
+     if (resetRoll(rng) == 1) {
+         memset(sim.counters, 0, sizeof(sim.counters));
+         sim.upCount = 0;
+         reset = true;
+     } else if (sim.upCount == 0) {
+         sim.upCount = 1; // Carrier comes back after the reload
+     }
+ 
+     snprintf(buffer, BUFFER_SIZE,
+              "Interface: %s state: up up_count: %d down_count: 0 sampled_us: %llu\n"
+              "rx_bytes: %llu rx_dropped: %llu rx_errors: %llu rx_packets: %llu\n"
+              "tx_bytes: %llu tx_dropped: %llu tx_errors: %llu tx_packets: %llu\n"
+              "ifindex: %d speed: %d mtu: 1500 driver: sim pci: - address: -\n\n",
+              sim.name, sim.upCount, static_cast<unsigned long long>(g_clock->monotonic() * 1e6),
+              sim.counters[RX_BYTES], sim.counters[RX_DROPPED], sim.counters[RX_ERRORS], sim.counters[RX_PACKETS],
+              sim.counters[TX_BYTES], sim.counters[TX_DROPPED], sim.counters[TX_ERRORS], sim.counters[TX_PACKETS],
+              sim.ifindex, SIM_SPEED_MBPS);
+     return reset;
+ }
+ 
+ /**
+  * @brief Sets up one simulated collector
+  * @param sim Simulated collector
+  * @param index Position among the simulated interfaces, gives the name and ifindex
+  * @param rng Random source
+  */
+ void initSimulatedInterface(SimulatedInterface& sim, int index, std::mt19937& rng) {
+     std::uniform_real_distribution<double> initialLoad(0.05, 0.5);
+     snprintf(sim.name, sizeof(sim.name), "sim%d", index);
+     sim.ifindex = 100 + index;
+     sim.upCount = 1;
+     sim.load = initialLoad(rng);
+     memset(sim.counters, 0, sizeof(sim.counters));
+ }
+ 
+ /**
+  * @brief Lets processMonitorData read whatever the simulated collectors have written
+  * @param interfaces Number of simulated interfaces
+  * @param clientFds Read ends of the socket pairs, -1 for slots outside the current group
+  * @param masterSet Read ends of every socket pair
+  * @param maxFd Largest read end
+  */
+ void deliverSimulatedReports(int interfaces, std::vector<int>& clientFds, fd_set& masterSet, int maxFd) {
+     fd_set readSet = masterSet;
+     struct timeval noWait = {0, 0};
+     if (select(maxFd + 1, &readSet, nullptr, nullptr, &noWait) > 0) {
+         processMonitorData(interfaces, clientFds, readSet, masterSet);
+     }
+ }
+ 
+ /**
+  * @brief Runs the ingest, history and compaction pipeline against simulated collectors
+  * @details Time is virtual, so hours of sampling across thousands of interfaces
+  *          replay as fast as the pipeline can ingest them, and the same seed always
+  *          produces the same results. Reports take the main loop's path: the
+  *          collectors write them into socket pairs in two parts, processMonitorData
+  *          reassembles and ingests them, and runPeriodicTasks does the per-second
+  *          work. Interfaces take turns on the socket pairs in groups of
+  *          SIM_SOCKET_PAIRS, each group drained before the next writes.
+  * @param interfaces Number of simulated interfaces
+  * @param seconds Virtual seconds to simulate
+  * @param seed Random seed
+  */
+ void runSimulation(int interfaces, long seconds, unsigned seed) {
+     int pairs = std::min(interfaces, SIM_SOCKET_PAIRS);
+     std::vector<int> readFds(pairs), writeFds(pairs);
+     fd_set masterSet;
+     FD_ZERO(&masterSet);
+     int maxFd = 0;
+     for (int p = 0; p < pairs; ++p) {
+         int fds[2];
+         if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+             std::cerr << "!!! networkMonitor.cpp !!!- Error creating simulated collector sockets: "
+                       << strerror(errno) << std::endl;
+             for (int q = 0; q < p; ++q) {
+                 close(readFds[q]);
+                 close(writeFds[q]);
+             }
+             return;
+         }
+         readFds[p] = fds[0];
+         writeFds[p] = fds[1];
+         FD_SET(fds[0], &masterSet);
+         maxFd = std::max(maxFd, fds[0]);
+     }
+ 
+     VirtualClock clock(SIM_START_TIME);
+     g_clock = &clock;
+     g_printSamples = false;
+     resizeSlots(interfaces);
+     g_reportBuffers.assign(interfaces, ReportBuffer());
+     std::vector<int> clientFds(interfaces, -1);
+ 
+     std::mt19937 rng(seed);
+     std::vector<SimulatedInterface> sims(interfaces);
+     for (int i = 0; i < interfaces; ++i) {
+         initSimulatedInterface(sims[i], i, rng);
+     }
+ 
+     struct timespec start, end;
+     clock_gettime(CLOCK_MONOTONIC, &start);
+     std::vector<char> reports(static_cast<size_t>(pairs) * BUFFER_SIZE);
+     std::vector<size_t> lengths(pairs), splits(pairs);
+     size_t injectedResets = 0;
+     for (long t = 0; t < seconds; ++t) {
+         clock.advance(NOMINAL_INTERVAL);
+         for (int first = 0; first < interfaces; first += pairs) {
+             int group = std::min(pairs, interfaces - first);
+             for (int p = 0; p < group; ++p) {
+                 char* report = &reports[static_cast<size_t>(p) * BUFFER_SIZE];
+                 clientFds[first + p] = readFds[p];
+                 injectedResets += simulateReport(sims[first + p], rng, report);
+                 lengths[p] = strlen(report);
+                 splits[p] = 1 + rng() % (lengths[p] - 1);
+                 write(writeFds[p], report, splits[p]);
+             }
+             deliverSimulatedReports(interfaces, clientFds, masterSet, maxFd);
+             for (int p = 0; p < group; ++p) {
+                 write(writeFds[p], &reports[static_cast<size_t>(p) * BUFFER_SIZE] + splits[p], lengths[p] - splits[p]);
+             }
+             deliverSimulatedReports(interfaces, clientFds, masterSet, maxFd);
+             std::fill(clientFds.begin() + first, clientFds.begin() + first + group, -1);
+         }
+         runPeriodicTasks(clock.wallTime(), interfaces, clientFds);
+         if (g_jsonLines.fd >= 0) {
+             flushJsonLinesIfDue(g_jsonLines);
+         }
+     }
+     clock_gettime(CLOCK_MONOTONIC, &end);
+     for (int p = 0; p < pairs; ++p) {
+         close(readFds[p]);
+         close(writeFds[p]);
+     }
+     double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+ 
+     size_t detectedResets = 0, wraps = 0, episodes = 0;
+     for (const InterfaceState& state : g_interfaceStates) {
+         detectedResets += state.resetCount;
+         wraps += state.wrapCount;
+         episodes += state.rx.episodeCount + state.tx.episodeCount;
+     }
+     printf("simulated %d interfaces for %lds in %.2fs (%.0f samples/s)\n", interfaces, seconds, elapsed,
+            elapsed > 0.0 ? interfaces * seconds / elapsed : 0.0);
+     printf("resets: %zu injected, %zu detected; wraps: %zu; saturation episodes: %zu\n",
+            injectedResets, detectedResets, wraps, episodes);
+ 
+     // The second pass finds every interface's text cached, as a consumer after the first would
+     int devNull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+     double renderSeconds[2];
+     for (int pass = 0; pass < 2 && devNull >= 0; ++pass) {
+         clock_gettime(CLOCK_MONOTONIC, &start);
+         g_renderIovecs.clear();
+         for (int i = 0; i < interfaces; ++i) {
+             gatherFragments(i, (1u << NUM_FRAGMENTS) - 1, g_renderIovecs);
+         }
+         writeFragments(devNull, g_renderIovecs);
+         clock_gettime(CLOCK_MONOTONIC, &end);
+         renderSeconds[pass] = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+     }
+     if (devNull >= 0) {
+         printf("render: %d interfaces in %.0f us, again from the cache in %.0f us\n", interfaces,
+                renderSeconds[0] * 1e6, renderSeconds[1] * 1e6);
+         close(devNull);
+     }
+     if (g_jsonLines.fd >= 0) {
+         flushJsonLines(g_jsonLines);
+     }
+     printStats();
+     g_clock = &g_systemClock;
+ }
+ 
+ /**
+  * @brief Escapes a JSON string the straightforward way, for --jsonl-bench
+  * @param text Text
+  * @return Quoted, escaped text
+  */
+ std::string naiveJsonString(const std::string& text) {
+     std::string quoted = "\"";
+     for (char c : text) {
+         if (c == '"' || c == '\\') {
+             quoted += '\\';
+             quoted += c;
+         } else if (static_cast<unsigned char>(c) < 0x20) {
+             char escape[8];
+             snprintf(escape, sizeof(escape), "\\u%04x", c);
+             quoted += escape;
+         } else {
+             quoted += c;
+         }
+     }
+     return quoted + "\"";
+ }
+ 
+ /**
+  * @brief Serializes a sample like appendSampleJson() does, with an ostringstream
+  * @details The baseline --jsonl-bench measures the hand-written serializer against.
+  * @param slot Monitor slot holding a sample
+  * @param timestamp Wall clock time of the sample
+  * @return The line, newline included
+  */
+ std::string naiveSampleJson(int slot, time_t timestamp) {
+     const InterfaceState& state = g_interfaceStates[slot];
+     const InterfaceSample& sample = state.last;
+     std::ostringstream json;
+     json << std::setprecision(1) << std::fixed;
+     json << "{\"ts\":" << timestamp << ",\"type\":\"sample\",\"interface\":" << naiveJsonString(sample.name)
+          << ",\"state\":" << naiveJsonString(sample.state) << ",\"up\":" << sample.upCount
+          << ",\"down\":" << sample.downCount << ",\"speed\":" << sample.speedMbps << ",\"mtu\":" << sample.mtu;
+     if (state.lastSampleReset) {
+         json << ",\"reset\":true";
+     }
+     std::string counters, rates;
+     for (int c = 0; c < NUM_COUNTERS; ++c) {
+         if ((sample.counterMask & (1u << c)) != 0) {
+             std::string separator = counters.empty() ? "" : ",";
+             counters += separator + "\"" + COUNTER_NAMES[c] + "\":" + std::to_string(sample.counters[c]);
+             std::ostringstream rate;
+             rate << std::setprecision(1) << std::fixed << g_rates.rates[0][c][slot];
+             rates += separator + "\"" + COUNTER_NAMES[c] + "\":" + rate.str();
+         }
+     }
+     json << ",\"counters\":{" << counters << "}";
+     if (g_rates.primed[slot]) {
+         json << ",\"rates\":{" << rates << "}";
+     }
+     if (sample.speedMbps > 0) {
+         json << ",\"utilization\":{\"rx\":" << state.rx.percent << ",\"tx\":" << state.tx.percent << "}";
+     }
+     if (sample.owner[0] != '\0') {
+         json << ",\"owner\":" << naiveJsonString(sample.owner);
+     }
+     if (sample.irqCount > 0) {
+         json << ",\"irqs\":[";
+         for (int i = 0; i < sample.irqCount; ++i) {
+             json << (i > 0 ? "," : "") << "{\"irq\":" << sample.irqs[i].irq << ",\"rate\":" << state.irqRates[i]
+                  << ",\"cpu\":" << sample.irqs[i].busiestCpu << ",\"share\":" << sample.irqs[i].busiestShare << "}";
+         }
+         json << "]";
+     }
+     json << "}\n";
+     return json.str();
+ }
+ 
+ /**
+  * @brief Measures appendSampleJson() against naiveSampleJson() on simulated samples
+  * @details Both write to /dev/null through a JSON_LINES_BUFFER sized buffer, so the
+  *          difference is the serializer alone.
+  * @param lines Lines each serializer produces
+  * @param seed Random seed
+  */
+ void runJsonLinesBenchmark(long lines, unsigned seed) {
+     VirtualClock clock(SIM_START_TIME);
+     g_clock = &clock;
+     g_printSamples = false;
+     resizeSlots(JSONL_BENCH_INTERFACES);
+     std::mt19937 rng(seed);
+     std::vector<SimulatedInterface> sims(JSONL_BENCH_INTERFACES);
+     char buffer[BUFFER_SIZE];
+     for (int i = 0; i < JSONL_BENCH_INTERFACES; ++i) {
+         initSimulatedInterface(sims[i], i, rng);
+     }
+     // A second sample gives every interface the rates and utilization of steady state
+     for (int t = 0; t < 2; ++t) {
+         clock.advance(NOMINAL_INTERVAL);
+         for (int i = 0; i < JSONL_BENCH_INTERFACES; ++i) {
+             simulateReport(sims[i], rng, buffer);
+             InterfaceSample sample;
+             if (decodeSample(buffer, strlen(buffer), sample) != 0) {
+                 ingestSample(i, sample);
+             }
+         }
+     }
+     int devNull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+     if (devNull < 0) {
+         std::cerr << "!!! networkMonitor.cpp !!!- Failed to open /dev/null: " << strerror(errno) << std::endl;
+         g_clock = &g_systemClock;
+         return;
+     }
+ 
+     static JsonLinesWriter writer;
+     writer.fd = devNull;
+     struct timespec start, end;
+     clock_gettime(CLOCK_MONOTONIC, &start);
+     for (long n = 0; n < lines; ++n) {
+         appendSampleJson(writer, n % JSONL_BENCH_INTERFACES, clock.wallTime());
+     }
+     flushJsonLines(writer);
+     clock_gettime(CLOCK_MONOTONIC, &end);
+     double fast = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+ 
+     std::string pending;
+     clock_gettime(CLOCK_MONOTONIC, &start);
+     for (long n = 0; n < lines; ++n) {
+         pending += naiveSampleJson(n % JSONL_BENCH_INTERFACES, clock.wallTime());
+         if (pending.size() >= JSON_LINES_BUFFER - JSON_LINE_MAX || n == lines - 1) {
+             write(devNull, pending.data(), pending.size());
+             pending.clear();
+         }
+     }
+     clock_gettime(CLOCK_MONOTONIC, &end);
+     double naive = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+     close(devNull);
+ 
+     printf("%ld sample lines, %.0f bytes each\n", lines,
+            lines > 0 ? static_cast<double>(writer.bytesWritten) / lines : 0.0);
+     printf("hand-written: %.2fM lines/s, %.0f ns per line\n",
+            fast > 0.0 ? lines / fast / 1e6 : 0.0, lines > 0 ? fast / lines * 1e9 : 0.0);
+     printf("ostringstream: %.2fM lines/s, %.0f ns per line\n",
+            naive > 0.0 ? lines / naive / 1e6 : 0.0, lines > 0 ? naive / lines * 1e9 : 0.0);
+     g_clock = &g_systemClock;
+ }
+ 
+ /**
+  * @brief Clears or checks IFF_UP on every device of a restore order
+  * @param socketFd Datagram socket used for the interface ioctls
+  * @param order Devices, lowers first
+  * @param down true to take the devices down, top first; false to count those not up
+  * @return Devices that failed the ioctl or, when checking, are not up
+  */
+ int setStackDown(int socketFd, const std::vector<std::string>& order, bool down) {
+     int failures = 0;
+     for (auto device = order.rbegin(); device != order.rend(); ++device) {
+         struct ifreq ifr;
+         memset(&ifr, 0, sizeof(ifr));
+         strncpy(ifr.ifr_name, device->c_str(), IFNAMSIZ - 1);
+         if (ioctl(socketFd, SIOCGIFFLAGS, &ifr) < 0) {
+             ++failures;
+         } else if (!down) {
+             failures += (ifr.ifr_flags & IFF_UP) == 0;
+         } else if (ifr.ifr_flags & IFF_UP) {
+             ifr.ifr_flags &= ~IFF_UP;
+             failures += ioctl(socketFd, SIOCSIFFLAGS, &ifr) < 0;
+         }
+     }
+     return failures;
+ }
+ 
+ /**
+  * @brief Measures the time to full recovery of stacked interfaces
+  * @details Each round takes every device of every stack down, then restores the
+  *          tops with restoreInterface(): once one after another in this process,
+  *          and once with one child process per stack, as the intfMonitors of
+  *          separate interfaces do. A stack is recovered when all its devices are up.
+  *          Needs CAP_NET_ADMIN; tests/restore_stack.sh builds suitable stacks.
+  * @param list Top device of each stack, comma separated
+  */
+ void runRestoreBenchmark(const char* list) {
+     std::vector<std::vector<std::string>> stacks;
+     std::istringstream names(list);
+     std::string name;
+     size_t devices = 0, depth = 0;
+     while (std::getline(names, name, ',')) {
+         std::set<std::string> visited;
+         stacks.emplace_back();
+         orderRestoreSubtree(name, visited, stacks.back());
+         devices += stacks.back().size();
+         depth = std::max(depth, stacks.back().size());
+     }
+     int socketFd = socket(AF_INET, SOCK_DGRAM, 0);
+     if (socketFd < 0) {
+         std::cerr << "!!! networkMonitor.cpp !!!- Socket creation failed: " << strerror(errno) << std::endl;
+         return;
+     }
+ 
+     double worst[2] = {0.0, 0.0}, total[2] = {0.0, 0.0};
+     int notRecovered = 0;
+     std::streambuf* console = std::cout.rdbuf(nullptr); // restoreInterface() reports each lower device
+     for (int round = 0; round < RESTORE_BENCH_ROUNDS; ++round) {
+         for (int concurrent = 0; concurrent < 2; ++concurrent) {
+             for (const auto& order : stacks) {
+                 notRecovered += setStackDown(socketFd, order, true);
+             }
+             struct timespec start, end;
+             clock_gettime(CLOCK_MONOTONIC, &start);
+             std::vector<pid_t> children;
+             for (const auto& order : stacks) {
+                 pid_t pid = concurrent ? fork() : 0;
+                 if (pid == 0) {
+                     try {
+                         restoreInterface(order.back().c_str());
+                     } catch (const std::runtime_error& e) {
+                         std::cerr << e.what() << std::endl;
+                     }
+                     if (concurrent) {
+                         _exit(EXIT_SUCCESS);
+                     }
+                 } else if (pid > 0) {
+                     children.push_back(pid);
+                 }
+             }
+             for (pid_t pid : children) {
+                 waitpid(pid, nullptr, 0);
+             }
+             clock_gettime(CLOCK_MONOTONIC, &end);
+             double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+             worst[concurrent] = std::max(worst[concurrent], elapsed);
+             total[concurrent] += elapsed;
+             for (const auto& order : stacks) {
+                 notRecovered += setStackDown(socketFd, order, false);
+             }
+         }
+     }
+     std::cout.rdbuf(console);
+     std::cout.clear();
+     close(socketFd);
+ 
+     printf("%zu stacks, %zu devices, up to %zu levels, %d rounds\n", stacks.size(), devices, depth,
+            RESTORE_BENCH_ROUNDS);
+     printf("sequential: full recovery in %.0f us on average, %.0f us worst\n",
+            total[0] / RESTORE_BENCH_ROUNDS * 1e6, worst[0] * 1e6);
+     printf("process per stack: full recovery in %.0f us on average, %.0f us worst\n",
+            total[1] / RESTORE_BENCH_ROUNDS * 1e6, worst[1] * 1e6);
+     printf("devices left down or failing: %d\n", notRecovered);
+ }
+ 
+ /**
+  * @brief Prints how far a summary is from the exact per-flow bytes
+  * @param label Name of the summary
+  * @param summary Summary of the whole feed
+  * @param keys Flow keys
+  * @param exact Exact bytes of each flow
+  */
+ void reportSketchAccuracy(const char* label, const FlowSummary& summary, const std::vector<TalkerKey>& keys,
+                           const std::vector<uint64_t>& exact) {
+     double total = static_cast<double>(summary.totalBytes);
+     double bound = M_E / SKETCH_WIDTH * total;
+     size_t beyondBound = 0;
+     double overestimate = 0.0, worst = 0.0;
+     for (size_t i = 0; i < keys.size(); ++i) {
+         double excess = static_cast<double>(estimateFlow(summary, keys[i]) - exact[i]);
+         beyondBound += excess > bound;
+         overestimate += excess;
+         worst = std::max(worst, excess);
+     }
+     std::vector<HeavyHitter> listed;
+     heaviestFlows(summary, listed);
+     size_t heavy = 0, found = 0, outside = 0;
+     for (size_t i = 0; i < keys.size(); ++i) {
+         auto entry = std::find_if(listed.begin(), listed.end(), [&](const HeavyHitter& hitter) {
+             return memcmp(&hitter.key, &keys[i], sizeof(TalkerKey)) == 0;
+         });
+         if (entry != listed.end() && (exact[i] > entry->bytes || exact[i] < entry->bytes - entry->error)) {
+             ++outside;
+         }
+         if (exact[i] * SPACE_SAVING_SLOTS > summary.totalBytes) {
+             ++heavy;
+             found += entry != listed.end();
+         }
+     }
+     printf("%-7s count-min: mean excess %.4f%% of N, worst %.4f%%; %zu flows (%.3f%%) beyond e/w*N = %.2f%%,"
+            " %.2f%% allowed\n", label, 100.0 * overestimate / keys.size() / total, 100.0 * worst / total, beyondBound,
+            100.0 * beyondBound / keys.size(), 100.0 * M_E / SKETCH_WIDTH, 100.0 * std::exp(-SKETCH_DEPTH));
+     printf("%-7s space-saving: %zu of %zu flows above N/%d listed, %zu listed counts outside their error\n",
+            label, found, heavy, SPACE_SAVING_SLOTS, outside);
+ }
+ 
+ /**
+  * @brief Measures the flow summaries against exact counts on a synthetic feed
+  * @details Flow sizes follow a Zipf law, as bytes do across the flows of real links.
+  *          The feed is summarized whole and as two halves that are merged afterwards,
+  *          so the report covers the error merging adds as well.
+  * @param flows Number of distinct flows
+  * @param seed Random seed
+  */
+ void runSketchBenchmark(int flows, unsigned seed) {
+     std::mt19937 rng(seed);
+     std::vector<TalkerKey> keys(flows);
+     std::uniform_int_distribution<uint32_t> word;
+     for (TalkerKey& key : keys) {
+         memset(&key, 0, sizeof(key));
+         uint32_t source = word(rng), destination = word(rng);
+         memcpy(key.source, &source, sizeof(source));
+         memcpy(key.destination, &destination, sizeof(destination));
+         key.sourcePort = static_cast<uint16_t>(word(rng));
+         key.destinationPort = static_cast<uint16_t>(word(rng));
+         key.protocol = IPPROTO_UDP;
+         key.ipVersion = 4;
+     }
+     std::vector<double> popularity(flows);
+     double sum = 0.0;
+     for (int i = 0; i < flows; ++i) {
+         sum += 1.0 / std::pow(i + 1, SKETCH_BENCH_SKEW);
+         popularity[i] = sum;
+     }
+     std::uniform_real_distribution<double> pick(0.0, sum);
+     std::uniform_int_distribution<uint32_t> packetSize(64, 1500);
+     std::vector<std::pair<uint32_t, uint32_t>> packets(static_cast<size_t>(flows) * SKETCH_BENCH_PACKETS);
+     std::vector<uint64_t> exact(flows, 0);
+     for (auto& packet : packets) {
+         packet.first = static_cast<uint32_t>(std::lower_bound(popularity.begin(), popularity.end(), pick(rng)) -
+                                              popularity.begin());
+         packet.first = std::min(packet.first, static_cast<uint32_t>(flows - 1));
+         packet.second = packetSize(rng);
+         exact[packet.first] += packet.second;
+     }
+ 
+     std::vector<FlowSummary> summaries(3); // Whole feed and its two halves, zeroed
+     struct timespec start, end;
+     clock_gettime(CLOCK_MONOTONIC, &start);
+     for (const auto& packet : packets) {
+         addFlow(summaries[0], keys[packet.first], hashFlow(keys[packet.first]), packet.second);
+     }
+     clock_gettime(CLOCK_MONOTONIC, &end);
+     double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+     for (size_t i = 0; i < packets.size(); ++i) {
+         const TalkerKey& key = keys[packets[i].first];
+         addFlow(summaries[i < packets.size() / 2 ? 1 : 2], key, hashFlow(key), packets[i].second);
+     }
+     clock_gettime(CLOCK_MONOTONIC, &start);
+     mergeSummary(summaries[1], summaries[2]);
+     clock_gettime(CLOCK_MONOTONIC, &end);
+     double merge = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+ 
+     printf("%d flows, %zu packets, %zu bytes per summary; %.1fM updates/s, merge in %.0f us\n", flows,
+            packets.size(), sizeof(FlowSummary), elapsed > 0.0 ? packets.size() / elapsed / 1e6 : 0.0, merge * 1e6);
+     reportSketchAccuracy("whole", summaries[0], keys, exact);
+     reportSketchAccuracy("merged", summaries[1], keys, exact);
+ }
+ 
  /**
   * @brief Cleans up system resources during program termination
   * @param serverFd Server socket file descriptor
   * @param activeClients Number of active clients
-  * @param clientFds Array of client file descriptors
+  * @param clientFds Client file descriptors, -1 for closed slots
   * @param masterSet Master file descriptor set
   * @param processIds Vector of child process IDs
   */
- void cleanup(int serverFd, int activeClients, int clientFds[], fd_set& masterSet, 
+ void cleanup(int serverFd, int activeClients, std::vector<int>& clientFds, fd_set& masterSet, 
               std::vector<pid_t>& processIds) {
      // Signal child processes to terminate
      for (pid_t pid : processIds) {
@@ -200,8 +1714,10 @@
  
      // Close client connections
      for (int i = 0; i < activeClients; ++i) {
-         FD_CLR(clientFds[i], &masterSet);
-         close(clientFds[i]);
+         if (clientFds[i] >= 0) {
+             FD_CLR(clientFds[i], &masterSet);
+             close(clientFds[i]);
+         }
      }
  
      // Clean up server socket
@@ -214,6 +1730,27 @@
      }
  }
  
+ /**
+  * @brief Parses the --counters list
+  * @param list Comma-separated counter names
+  * @param mask Receives the counter mask, always including the utilization counters
+  * @return false if a name is not a known counter
+  */
+ bool parseCounterList(const char* list, unsigned& mask) {
+     mask = UTILIZATION_COUNTERS;
+     std::istringstream names(list);
+     std::string name;
+     while (std::getline(names, name, ',')) {
+         int counter = std::find(COUNTER_NAMES, COUNTER_NAMES + NUM_COUNTERS, name) - COUNTER_NAMES;
+         if (counter == NUM_COUNTERS) {
+             std::cerr << "!!! networkMonitor.cpp !!!- Unknown counter: " << name << std::endl;
+             return false;
+         }
+         mask |= 1u << counter;
+     }
+     return true;
+ }
+ 
  /**
   * @brief Signal handler for graceful program termination
   * @param signal Received signal number
@@ -227,7 +1764,113 @@
      }
  }
  
- int main() {
+ int main(int argc, char* argv[]) {
+     bool lockMemory = false;
+     bool enableTalkers = false;
+     TalkerGrouping talkerGrouping = TALKERS_BY_FLOW;
+     int simInterfaces = 0;
+     long simSeconds = 0;
+     int benchFlows = 0;
+     long benchLines = 0;
+     const char* restoreStacks = nullptr;
+     unsigned simSeed = 1;
+     for (int i = 1; i < argc; ++i) {
+         if (strcmp(argv[i], "--memory-budget") == 0 && i + 1 < argc) {
+             g_memoryBudget = strtoull(argv[++i], nullptr, 10) * 1024 * 1024;
+         } else if (strcmp(argv[i], "--huge-pages") == 0) {
+             g_hugePages = true;
+         } else if (strcmp(argv[i], "--mlock") == 0) {
+             lockMemory = true;
+         } else if (strcmp(argv[i], "--simulate") == 0 && i + 2 < argc) {
+             simInterfaces = atoi(argv[++i]);
+             simSeconds = atol(argv[++i]);
+         } else if (strcmp(argv[i], "--sketch-bench") == 0 && i + 1 < argc) {
+             benchFlows = atoi(argv[++i]);
+         } else if (strcmp(argv[i], "--restore-bench") == 0 && i + 1 < argc) {
+             restoreStacks = argv[++i];
+         } else if (strcmp(argv[i], "--jsonl-bench") == 0 && i + 1 < argc) {
+             benchLines = atol(argv[++i]);
+         } else if (strcmp(argv[i], "--jsonl") == 0 && i + 1 < argc) {
+             try {
+                 openJsonLines(argv[++i], g_jsonLines);
+             } catch (const std::runtime_error& e) {
+                 std::cerr << e.what() << std::endl;
+                 return EXIT_FAILURE;
+             }
+         } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+             simSeed = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+         } else if (strcmp(argv[i], "--counters") == 0 && i + 1 < argc) {
+             if (!parseCounterList(argv[++i], g_counterMask)) {
+                 return EXIT_FAILURE;
+             }
+         } else if ((strcmp(argv[i], "--derive") == 0 || strcmp(argv[i], "--group") == 0) && i + 1 < argc) {
+             std::string error;
+             bool metric = strcmp(argv[i], "--derive") == 0;
+             if (!(metric ? addDerivedMetric(argv[i + 1], error) : addInterfaceGroup(argv[i + 1], error))) {
+                 std::cerr << "!!! networkMonitor.cpp !!!- Invalid " << argv[i] << " '" << argv[i + 1] << "': "
+                           << error << std::endl;
+                 return EXIT_FAILURE;
+             }
+             ++i;
+         } else if (strcmp(argv[i], "--top-talkers") == 0 && i + 1 < argc &&
+                    (strcmp(argv[i + 1], "flows") == 0 || strcmp(argv[i + 1], "sources") == 0)) {
+             enableTalkers = true;
+             talkerGrouping = strcmp(argv[++i], "sources") == 0 ? TALKERS_BY_SOURCE : TALKERS_BY_FLOW;
+         } else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+             if (!parseCaptureRule(argv[++i], g_captureTrigger)) {
+                 return EXIT_FAILURE;
+             }
+         } else {
+             std::cerr << "Usage: " << argv[0] << " [--memory-budget <MiB>] [--huge-pages] [--mlock]"
+                       << " [--counters <name,...>] [--derive <name>=<expression>[><threshold>]]..."
+                       << " [--group <name>=<interface>,...]... [--capture <metric>[:<seconds>[:<MiB>]]]"
+                       << " [--top-talkers flows|sources] [--jsonl <file>]"
+                       << " [--simulate <interfaces> <seconds> [--seed <n>]] [--sketch-bench <flows> [--seed <n>]]"
+                       << " [--jsonl-bench <lines>] [--restore-bench <interface>,...]"
+                       << std::endl;
+             return EXIT_FAILURE;
+         }
+     }
+     if (!g_captureTrigger.metricName.empty()) {
+         g_captureTrigger.metric = findDerivedMetric(g_captureTrigger.metricName);
+         if (g_captureTrigger.metric < 0 || !g_derived.metrics[g_captureTrigger.metric].hasThreshold) {
+             std::cerr << "!!! networkMonitor.cpp !!!- --capture needs a --derive metric with a threshold, got '"
+                       << g_captureTrigger.metricName << "'" << std::endl;
+             return EXIT_FAILURE;
+         }
+     }
+     g_counterMask |= derivedInputs(); // Whatever the derived metrics read must be collected
+     if (g_jsonLines.fd >= 0) {
+         g_eventSink = dispatchEvent;
+     }
+ 
+     // Keep the main loop from page faulting on history it has not touched in a while
+     if (lockMemory && mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+         std::cerr << "!!! networkMonitor.cpp !!!- Failed to lock memory, continuing unlocked: "
+                   << strerror(errno) << std::endl;
+     }
+ 
+     if (simInterfaces > 0) {
+         runSimulation(simInterfaces, simSeconds, simSeed);
+         closeJsonLines(g_jsonLines);
+         return EXIT_SUCCESS;
+     }
+     if (benchFlows > 0) {
+         runSketchBenchmark(benchFlows, simSeed);
+         return EXIT_SUCCESS;
+     }
+     if (benchLines > 0) {
+         runJsonLinesBenchmark(benchLines, simSeed);
+         return EXIT_SUCCESS;
+     }
+     if (restoreStacks != nullptr) {
+         runRestoreBenchmark(restoreStacks);
+         return EXIT_SUCCESS;
+     }
+ 
+     // Unbuffered, so reading the interface list does not pull console commands
+     // typed after it into stdio, where readConsole() would never see them
+     setvbuf(stdin, nullptr, _IONBF, 0);
      int numInterfaces;
      std::cout << "Enter number of interfaces to monitor: ";
      std::cin >> numInterfaces;
@@ -237,6 +1880,14 @@
          std::cout << "Interface " << i + 1 << ": ";
          std::cin >> interfaceNames[i];
      }
+     // Console history queries take a group name where an interface name goes
+     for (const InterfaceGroup& group : g_derived.groups) {
+         if (std::find(interfaceNames.begin(), interfaceNames.end(), group.name) != interfaceNames.end()) {
+             std::cerr << "!!! networkMonitor.cpp !!!- Group " << group.name
+                       << " has the name of a monitored interface" << std::endl;
+             return EXIT_FAILURE;
+         }
+     }
  
      // Set up signal handling
      struct sigaction sa;
@@ -251,7 +1902,7 @@
      };
  
      // Initialize server
-     int serverFd = createServerSocket();
+     int serverFd = createServerSocket(SOCKET_PATH);
      if (serverFd < 0) {
          return EXIT_FAILURE;
      }
@@ -260,24 +1911,58 @@
      fd_set masterSet, readSet;
      FD_ZERO(&masterSet);
      FD_SET(serverFd, &masterSet);
+     FD_SET(STDIN_FILENO, &masterSet);
+     std::cin.ignore(); // Drop the newline left after the last interface name
  
-     int clientFds[MAX_CONNECTIONS];
+     std::vector<int> clientFds(numInterfaces, -1);
+     g_reportBuffers.resize(numInterfaces);
      int activeClients = 0;
+     resizeSlots(numInterfaces);
  
-     // Start interface monitoring
-     startMonitoring(interfaceNames, g_childProcesses);
- 
-     if (listen(serverFd, MAX_CONNECTIONS) == -1) {
+     // Listen before spawning so no monitor can connect to a socket that is not accepting yet
+     if (listen(serverFd, std::max(numInterfaces, 1)) == -1) {
          std::cerr << "!!! networkMonitor.cpp !!!- Error starting listener: " 
                    << strerror(errno) << std::endl;
          cleanup(serverFd, activeClients, clientFds, masterSet, g_childProcesses);
          return EXIT_FAILURE;
      }
  
-     // Main server loop
+     // Interfaces the classifier cannot attach to are monitored without top talkers
+     if (enableTalkers) {
+         for (const std::string& name : interfaceNames) {
+             g_talkers.emplace_back();
+             try {
+                 attachTalkerTracker(name.c_str(), talkerGrouping, g_talkers.back());
+             } catch (const std::runtime_error& e) {
+                 std::cerr << e.what() << std::endl;
+                 g_talkers.pop_back();
+             }
+         }
+     }
+ 
+     // The control socket is optional; without it the console still works
+     int controlFd = openControlSocket();
+     if (controlFd >= 0) {
+         FD_SET(controlFd, &masterSet);
+         maxFd = std::max(maxFd, controlFd);
+         g_eventSink = dispatchEvent;
+     }
+ 
+     // Start interface monitoring
+     startMonitoring(interfaceNames, g_childProcesses);
+ 
+     // Main server loop; the select timeout keeps compaction running while idle
+     time_t lastCompaction = g_clock->wallTime();
      while (g_isRunning) {
+         time_t now = g_clock->wallTime();
+         if (now != lastCompaction) {
+             runPeriodicTasks(now, activeClients, clientFds);
+             lastCompaction = now;
+         }
+ 
          readSet = masterSet;
-         int result = select(maxFd + 1, &readSet, nullptr, nullptr, nullptr);
+         struct timeval timeout = {1, 0};
+         int result = select(maxFd + 1, &readSet, nullptr, nullptr, &timeout);
  
          if (result < 0) {
              if (errno == EINTR) continue;
@@ -286,14 +1971,32 @@
              break;
          }
  
+         if (FD_ISSET(STDIN_FILENO, &readSet) && !readConsole()) {
+             FD_CLR(STDIN_FILENO, &masterSet);
+         }
+ 
+         if (controlFd >= 0 && FD_ISSET(controlFd, &readSet)) {
+             acceptControlClient(controlFd, masterSet, maxFd);
+         }
+         processControlRequests(readSet, masterSet, activeClients, clientFds);
+ 
          if (FD_ISSET(serverFd, &readSet)) {
              handleNewConnection(serverFd, masterSet, maxFd, clientFds, activeClients);
          } else {
-             processMonitorData(activeClients, clientFds, readSet);
+             processMonitorData(activeClients, clientFds, readSet, masterSet);
+         }
+         if (g_jsonLines.fd >= 0) {
+             flushJsonLinesIfDue(g_jsonLines);
          }
      }
  
      // Cleanup and exit
+     for (TalkerTracker& tracker : g_talkers) {
+         detachTalkerTracker(tracker);
+     }
+     closeControlSocket(controlFd, masterSet);
      cleanup(serverFd, activeClients, clientFds, masterSet, g_childProcesses);
+     g_eventSink = nullptr;
+     closeJsonLines(g_jsonLines);
      return EXIT_SUCCESS;
  }
\ No newline at end of file
@@ -0,0 +1,157 @@
+/**
+ * @file perfCounters.h
+ * @brief Optional hardware counter instrumentation for pipeline stages
+ * @details Build with PERF=1 (-DENABLE_PERF_COUNTERS) to wrap stages in
+ *          perf_event_open counters. Without it PERF_BEGIN/PERF_END expand to
+ *          nothing, so instrumented code is identical to uninstrumented code.
+ */
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <cstring>
+#include <iostream>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Hardware events counted per stage
+enum PerfEvent {
+    PERF_CYCLES, PERF_INSTRUCTIONS, PERF_CACHE_MISSES, PERF_BRANCH_MISSES,
+    NUM_PERF_EVENTS
+};
+
+/**
+ * @brief Counter totals accumulated over every run of one stage
+ */
+struct PerfStage {
+    const char* name;
+    unsigned long long runs;
+    unsigned long long totals[NUM_PERF_EVENTS];
+};
+
+#ifdef ENABLE_PERF_COUNTERS
+const bool PERF_COUNTERS_ENABLED = true;
+
+/**
+ * @brief Counter values read at the start of a stage
+ */
+struct PerfSample {
+    unsigned long long values[NUM_PERF_EVENTS];
+};
+
+/**
+ * @brief Opens one counter of the event group for this thread
+ * @param config PERF_COUNT_HW_* event
+ * @param groupFd Group leader, -1 to open the leader itself
+ * @return File descriptor of the counter, -1 if unavailable
+ */
+inline int perfOpenEvent(unsigned long long config, int groupFd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0));
+}
+
+/**
+ * @brief Group leader of the stage counters, opened on first use
+ * @details The members stay open for the life of the process, read through the
+ *          leader. If any of them cannot be opened, every counter opened so far
+ *          is closed again.
+ * @return File descriptor of the group, -1 if the PMU is not available
+ */
+inline int perfGroupFd() {
+    static int groupFd = [] {
+        const unsigned long long configs[NUM_PERF_EVENTS] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+        };
+        int fds[NUM_PERF_EVENTS];
+        int opened = 0;
+        for (; opened < NUM_PERF_EVENTS; ++opened) {
+            fds[opened] = perfOpenEvent(configs[opened], opened == 0 ? -1 : fds[0]);
+            if (fds[opened] < 0) {
+                break;
+            }
+        }
+        if (opened < NUM_PERF_EVENTS) {
+            int error = errno;
+            while (opened > 0) {
+                close(fds[--opened]);
+            }
+            std::cerr << "!!! perfCounters.h !!!- Hardware counters unavailable, stages report zeros: "
+                      << strerror(error) << std::endl;
+            return -1;
+        }
+        return fds[0];
+    }();
+    return groupFd;
+}
+
+/**
+ * @brief Reads the current value of every counter in the group
+ * @param sample Reference to the sample to fill, zeroed if counters are unavailable
+ */
+inline void perfRead(PerfSample& sample) {
+    struct {
+        unsigned long long count;
+        unsigned long long values[NUM_PERF_EVENTS];
+    } group;
+    int fd = perfGroupFd();
+    if (fd < 0 || read(fd, &group, sizeof(group)) != static_cast<ssize_t>(sizeof(group))) {
+        memset(&sample, 0, sizeof(sample));
+        return;
+    }
+    memcpy(sample.values, group.values, sizeof(sample.values));
+}
+
+/**
+ * @brief Adds the counts since a stage began to the stage totals
+ * @param stage Stage being measured
+ * @param start Sample taken by PERF_BEGIN
+ */
+inline void perfAccumulate(PerfStage& stage, const PerfSample& start) {
+    PerfSample end;
+    perfRead(end);
+    for (int e = 0; e < NUM_PERF_EVENTS; ++e) {
+        stage.totals[e] += end.values[e] - start.values[e];
+    }
+    ++stage.runs;
+}
+
+#define PERF_BEGIN(sample) PerfSample sample; perfRead(sample)
+#define PERF_END(stage, sample) perfAccumulate(stage, sample)
+#else
+const bool PERF_COUNTERS_ENABLED = false;
+
+#define PERF_BEGIN(sample)
+#define PERF_END(stage, sample)
+#endif
+
+/**
+ * @brief Prints per-run averages of each stage
+ * @param out Stream to print to
+ * @param stages Stages to print
+ * @param count Number of stages
+ */
+inline void printPerfStages(std::ostream& out, const PerfStage* stages, int count) {
+    if (!PERF_COUNTERS_ENABLED) {
+        out << "perf: hardware counters disabled (build with PERF=1)" << std::endl;
+        return;
+    }
+    for (int s = 0; s < count; ++s) {
+        const PerfStage& stage = stages[s];
+        double runs = stage.runs != 0 ? static_cast<double>(stage.runs) : 1.0;
+        out << "perf " << stage.name << ": " << stage.runs << " runs, per run "
+            << stage.totals[PERF_CYCLES] / runs << " cycles, "
+            << stage.totals[PERF_INSTRUCTIONS] / runs << " instructions, "
+            << stage.totals[PERF_CACHE_MISSES] / runs << " cache misses, "
+            << stage.totals[PERF_BRANCH_MISSES] / runs << " branch misses" << std::endl;
+    }
+}
+
+#endif // PERF_COUNTERS_H
@@ -0,0 +1,29 @@
+/**
+ * @file probes.h
+ * @brief USDT (SDT) tracepoints at the key points of the monitoring pipeline
+ * @details Probes are emitted under the "netwatch" provider when <sys/sdt.h>
+ *          (systemtap-sdt-dev) is available. An unattached probe is a single nop;
+ *          without the header the macros expand to nothing. Attach on demand with
+ *          e.g. bpftrace -e 'usdt:./networkMonitor:netwatch:ingest { ... }'.
+ */
+#ifndef PROBES_H
+#define PROBES_H
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define NETWATCH_HAVE_SDT 1
+#endif
+#endif
+
+#ifdef NETWATCH_HAVE_SDT
+#define NETWATCH_PROBE1(name, a) DTRACE_PROBE1(netwatch, name, a)
+#define NETWATCH_PROBE2(name, a, b) DTRACE_PROBE2(netwatch, name, a, b)
+#define NETWATCH_PROBE3(name, a, b, c) DTRACE_PROBE3(netwatch, name, a, b, c)
+#else
+#define NETWATCH_PROBE1(name, a) do { } while (0)
+#define NETWATCH_PROBE2(name, a, b) do { } while (0)
+#define NETWATCH_PROBE3(name, a, b, c) do { } while (0)
+#endif
+
+#endif // PROBES_H
@@ -0,0 +1,273 @@
+/**
+ * @file sketch.cpp
+ * @brief Count-Min and weighted Space-Saving summaries of per-flow bytes
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+
+#include "sketch.h"
+
+static_assert(sizeof(TalkerKey) % sizeof(uint64_t) == 0, "hashFlow() reads the key as 64-bit words");
+
+size_t g_sketchBytes = 0;
+
+// Odd multipliers giving each Count-Min row its own multiply-shift hash of the flow hash
+const uint64_t ROW_MULTIPLIERS[SKETCH_DEPTH] = {
+    0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL, 0xd6e8feb86659fd93ULL
+};
+
+/**
+ * @brief Hashes a flow key
+ * @param key Flow key
+ * @return 64-bit hash
+ */
+uint64_t hashFlow(const TalkerKey& key) {
+    uint64_t words[sizeof(TalkerKey) / sizeof(uint64_t)];
+    memcpy(words, &key, sizeof(words));
+    uint64_t hash = 0x9e3779b97f4a7c15ULL;
+    for (uint64_t word : words) {
+        hash = (hash ^ word) * 0xbf58476d1ce4e5b9ULL;
+        hash ^= hash >> 31;
+    }
+    return hash;
+}
+
+/**
+ * @brief Column of a Count-Min row for a flow
+ * @param hash hashFlow() of the flow
+ * @param row Row index
+ * @return Column index
+ */
+inline uint32_t sketchColumn(uint64_t hash, int row) {
+    // Rows must collide independently: with double hashing one flow in a million
+    // shares every column with the heaviest flow
+    return static_cast<uint32_t>((hash * ROW_MULTIPLIERS[row]) >> (64 - SKETCH_WIDTH_BITS));
+}
+
+/**
+ * @brief Empties a summary
+ * @param summary Summary to reset
+ * @param start First wall-clock second it will cover
+ * @param end Second after the last one it will cover
+ */
+void clearSummary(FlowSummary& summary, int64_t start, int64_t end) {
+    memset(&summary, 0, sizeof(summary));
+    summary.start = start;
+    summary.end = end;
+}
+
+/**
+ * @brief Finds a flow in the Space-Saving list
+ * @param summary Summary to search
+ * @param key Flow key
+ * @param hash hashFlow() of the key
+ * @return Heap index of the flow, -1 if it is not listed
+ */
+int findHitter(const FlowSummary& summary, const TalkerKey& key, uint64_t hash) {
+    for (uint32_t i = 0; i < summary.hitterCount; ++i) {
+        if (summary.hitterHashes[i] == hash && memcmp(&summary.hitters[i].key, &key, sizeof(key)) == 0) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Swaps two heap entries with their hashes
+ */
+inline void swapHitters(FlowSummary& summary, uint32_t a, uint32_t b) {
+    std::swap(summary.hitters[a], summary.hitters[b]);
+    std::swap(summary.hitterHashes[a], summary.hitterHashes[b]);
+}
+
+/**
+ * @brief Restores the min-heap after an entry's bytes grew
+ * @param summary Summary
+ * @param i Heap index of the entry
+ */
+void siftHitterDown(FlowSummary& summary, uint32_t i) {
+    for (;;) {
+        uint32_t smallest = i, left = 2 * i + 1, right = left + 1;
+        if (left < summary.hitterCount && summary.hitters[left].bytes < summary.hitters[smallest].bytes) {
+            smallest = left;
+        }
+        if (right < summary.hitterCount && summary.hitters[right].bytes < summary.hitters[smallest].bytes) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+        swapHitters(summary, i, smallest);
+        i = smallest;
+    }
+}
+
+/**
+ * @brief Restores the min-heap after appending an entry
+ * @param summary Summary
+ * @param i Heap index of the entry
+ */
+void siftHitterUp(FlowSummary& summary, uint32_t i) {
+    while (i > 0 && summary.hitters[i].bytes < summary.hitters[(i - 1) / 2].bytes) {
+        swapHitters(summary, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+/**
+ * @brief Appends an entry to a Space-Saving list that has room
+ */
+void pushHitter(FlowSummary& summary, const HeavyHitter& hitter, uint64_t hash) {
+    uint32_t i = summary.hitterCount++;
+    summary.hitters[i] = hitter;
+    summary.hitterHashes[i] = hash;
+    siftHitterUp(summary, i);
+}
+
+/**
+ * @brief Adds bytes of one flow to a summary
+ * @details An unlisted flow takes over the lightest entry of a full list and
+ *          inherits its bytes as error, as in Space-Saving.
+ * @param summary Summary to update
+ * @param key Flow key
+ * @param hash hashFlow() of the key
+ * @param bytes Bytes to add
+ */
+void addFlow(FlowSummary& summary, const TalkerKey& key, uint64_t hash, uint64_t bytes) {
+    summary.totalBytes += bytes;
+    for (int row = 0; row < SKETCH_DEPTH; ++row) {
+        summary.counts[row][sketchColumn(hash, row)] += bytes;
+    }
+    int listed = findHitter(summary, key, hash);
+    if (listed >= 0) {
+        summary.hitters[listed].bytes += bytes;
+        siftHitterDown(summary, static_cast<uint32_t>(listed));
+    } else if (summary.hitterCount < static_cast<uint32_t>(SPACE_SAVING_SLOTS)) {
+        pushHitter(summary, {key, bytes, 0}, hash);
+    } else {
+        uint64_t lightest = summary.hitters[0].bytes;
+        summary.hitters[0] = {key, lightest + bytes, lightest};
+        summary.hitterHashes[0] = hash;
+        siftHitterDown(summary, 0);
+    }
+}
+
+/**
+ * @brief Estimates the bytes of any flow
+ * @param summary Summary to query
+ * @param key Flow key
+ * @return Upper bound on the flow's bytes, see sketch.h for how tight it is
+ */
+uint64_t estimateFlow(const FlowSummary& summary, const TalkerKey& key) {
+    uint64_t hash = hashFlow(key);
+    uint64_t estimate = UINT64_MAX;
+    for (int row = 0; row < SKETCH_DEPTH; ++row) {
+        estimate = std::min(estimate, summary.counts[row][sketchColumn(hash, row)]);
+    }
+    int listed = findHitter(summary, key, hash);
+    return listed >= 0 ? std::min(estimate, summary.hitters[listed].bytes) : estimate;
+}
+
+/**
+ * @brief Merges one summary into another
+ * @details Count-Min cells add up. A flow listed in only one Space-Saving list may
+ *          have had up to the other full list's minimum there, which is added to
+ *          both its bytes and its error before the heaviest SPACE_SAVING_SLOTS are
+ *          kept, so the merged list keeps the Space-Saving guarantee.
+ * @param into Summary receiving the merge
+ * @param from Summary merged in, unchanged
+ */
+void mergeSummary(FlowSummary& into, const FlowSummary& from) {
+    if (from.start == 0 && from.totalBytes == 0) {
+        return;
+    }
+    if (into.start == 0 && into.totalBytes == 0) {
+        into = from;
+        return;
+    }
+    into.start = std::min(into.start, from.start);
+    into.end = std::max(into.end, from.end);
+    into.totalBytes += from.totalBytes;
+    for (int row = 0; row < SKETCH_DEPTH; ++row) {
+        for (int column = 0; column < SKETCH_WIDTH; ++column) {
+            into.counts[row][column] += from.counts[row][column];
+        }
+    }
+
+    struct Candidate {
+        HeavyHitter hitter;
+        uint64_t hash;
+    } candidates[2 * SPACE_SAVING_SLOTS];
+    size_t count = 0;
+    bool intoFull = into.hitterCount == static_cast<uint32_t>(SPACE_SAVING_SLOTS);
+    bool fromFull = from.hitterCount == static_cast<uint32_t>(SPACE_SAVING_SLOTS);
+    uint64_t intoMinimum = intoFull ? into.hitters[0].bytes : 0;
+    uint64_t fromMinimum = fromFull ? from.hitters[0].bytes : 0;
+    for (uint32_t i = 0; i < into.hitterCount; ++i) {
+        Candidate& candidate = candidates[count++];
+        candidate = {into.hitters[i], into.hitterHashes[i]};
+        int other = findHitter(from, into.hitters[i].key, into.hitterHashes[i]);
+        candidate.hitter.bytes += other >= 0 ? from.hitters[other].bytes : fromMinimum;
+        candidate.hitter.error += other >= 0 ? from.hitters[other].error : fromMinimum;
+    }
+    for (uint32_t i = 0; i < from.hitterCount; ++i) {
+        if (findHitter(into, from.hitters[i].key, from.hitterHashes[i]) < 0) {
+            Candidate& candidate = candidates[count++];
+            candidate = {from.hitters[i], from.hitterHashes[i]};
+            candidate.hitter.bytes += intoMinimum;
+            candidate.hitter.error += intoMinimum;
+        }
+    }
+    into.hitterCount = 0;
+    // Summaries of idle minutes have a start but list no flows
+    if (count == 0) {
+        return;
+    }
+    size_t kept = std::min(count, static_cast<size_t>(SPACE_SAVING_SLOTS));
+    std::nth_element(candidates, candidates + kept - 1, candidates + count,
+                     [](const Candidate& a, const Candidate& b) { return a.hitter.bytes > b.hitter.bytes; });
+    for (size_t i = 0; i < kept; ++i) {
+        pushHitter(into, candidates[i].hitter, candidates[i].hash);
+    }
+}
+
+/**
+ * @brief Lists the Space-Saving flows of a summary, heaviest first
+ * @param summary Summary to read
+ * @param flows Receives the flows
+ */
+void heaviestFlows(const FlowSummary& summary, std::vector<HeavyHitter>& flows) {
+    flows.assign(summary.hitters, summary.hitters + summary.hitterCount);
+    std::sort(flows.begin(), flows.end(), [](const HeavyHitter& a, const HeavyHitter& b) { return a.bytes > b.bytes; });
+}
+
+/**
+ * @brief Prints the heaviest flows of a summary with the range their bytes lie in
+ * @param out Output stream
+ * @param name Interface, host or file the summary describes
+ * @param summary Summary to print
+ * @param limit Maximum number of flows to print
+ */
+void printSummary(std::ostream& out, const std::string& name, const FlowSummary& summary, size_t limit) {
+    if (summary.totalBytes == 0) {
+        out << name << ": no flows" << std::endl;
+        return;
+    }
+    char line[160];
+    snprintf(line, sizeof(line), "%s: %llu bytes over %llds, heaviest %u flows tracked\n", name.c_str(),
+             static_cast<unsigned long long>(summary.totalBytes), static_cast<long long>(summary.end - summary.start),
+             summary.hitterCount);
+    out << line;
+    std::vector<HeavyHitter> flows;
+    heaviestFlows(summary, flows);
+    for (size_t i = 0; i < flows.size() && i < limit; ++i) {
+        // The lower bound is Space-Saving's, the upper one the tighter of both structures
+        snprintf(line, sizeof(line), "  %-60s %14llu .. %llu B\n", formatTalker(flows[i].key).c_str(),
+                 static_cast<unsigned long long>(flows[i].bytes - flows[i].error),
+                 static_cast<unsigned long long>(estimateFlow(summary, flows[i].key)));
+        out << line;
+    }
+    out << std::flush;
+}
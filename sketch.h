@@ -0,0 +1,67 @@
+/**
+ * @file sketch.h
+ * @brief Fixed-size, mergeable summaries of a per-flow byte feed
+ * @details A FlowSummary pairs a Count-Min sketch, which estimates the bytes of any
+ *          flow, with a weighted Space-Saving list of the heaviest flows. With N
+ *          bytes summarized:
+ *          - a Count-Min estimate never undercounts and exceeds the true value by
+ *            more than e/SKETCH_WIDTH * N with probability at most e^-SKETCH_DEPTH
+ *            (0.27% of N, 1.8% of the time);
+ *          - every flow above N/SPACE_SAVING_SLOTS bytes (1.6% of N) is listed, and a
+ *            listed count overestimates by at most its recorded error.
+ *          Summaries of adjacent intervals, or of other hosts, merge into one with
+ *          the same guarantees over the combined N. The struct is plain data, so it
+ *          travels over the control socket and to files as is.
+ */
+#ifndef SKETCH_H
+#define SKETCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "talkers.h"
+
+const int SKETCH_DEPTH = 4;
+const int SKETCH_WIDTH_BITS = 10;
+const int SKETCH_WIDTH = 1 << SKETCH_WIDTH_BITS;
+const int SPACE_SAVING_SLOTS = 64;
+const int64_t SKETCH_INTERVAL = 60;   // Seconds summarized by one FlowSummary of a tracker
+const int SKETCH_INTERVALS = 60;      // Summaries kept per tracker
+
+/**
+ * @brief A flow of the Space-Saving list; its true bytes lie in [bytes - error, bytes]
+ */
+struct HeavyHitter {
+    TalkerKey key;
+    uint64_t bytes;
+    uint64_t error;
+};
+
+/**
+ * @brief Count-Min sketch and Space-Saving heavy hitters of one or more intervals
+ */
+struct FlowSummary {
+    int64_t start;       // Wall-clock seconds covered, [start, end); 0 when empty
+    int64_t end;
+    uint64_t totalBytes;
+    uint32_t hitterCount;
+    uint32_t padding;
+    uint64_t counts[SKETCH_DEPTH][SKETCH_WIDTH];
+    uint64_t hitterHashes[SPACE_SAVING_SLOTS]; // Scanned before comparing keys
+    HeavyHitter hitters[SPACE_SAVING_SLOTS];   // Min-heap on bytes
+};
+
+extern size_t g_sketchBytes; // Held by every tracker's summaries, for the memory account
+
+uint64_t hashFlow(const TalkerKey& key);
+void clearSummary(FlowSummary& summary, int64_t start, int64_t end);
+void addFlow(FlowSummary& summary, const TalkerKey& key, uint64_t hash, uint64_t bytes);
+uint64_t estimateFlow(const FlowSummary& summary, const TalkerKey& key);
+void mergeSummary(FlowSummary& into, const FlowSummary& from);
+void heaviestFlows(const FlowSummary& summary, std::vector<HeavyHitter>& flows);
+void printSummary(std::ostream& out, const std::string& name, const FlowSummary& summary, size_t limit);
+
+#endif // SKETCH_H
@@ -0,0 +1,498 @@
+/**
+ * @file talkers.cpp
+ * @brief eBPF top talkers: a hand-assembled tc classifier and batched map draining
+ * @details The classifier is assembled here rather than compiled from C so the
+ *          build needs neither clang nor libbpf. It is equivalent to:
+ *
+ *          int count(struct __sk_buff* skb) {
+ *              struct TalkerKey key = {};
+ *              // Parse Ethernet, then IPv4 or IPv6; copy the addresses and, for a
+ *              // first fragment of TCP or UDP, the ports (flows only)
+ *              struct TalkerCounts* counts = bpf_map_lookup_elem(&map, &key);
+ *              if (counts) { counts->bytes += skb->len; counts->packets += 1; }
+ *              else { struct TalkerCounts first = {skb->len, 1}; bpf_map_update_elem(&map, &key, &first, BPF_ANY); }
+ *              return TCX_NEXT;
+ *          }
+ */
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <linux/bpf.h>
+#include <net/if.h>
+#include <stdexcept>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "sketch.h"
+#include "talkers.h"
+
+const uint32_t TALKER_MAP_ENTRIES = 1 << 20; // Allocated on demand, see BPF_F_NO_PREALLOC
+const uint32_t TALKER_BATCH = 4096;          // Entries per lookup-and-delete call
+const int TALKER_READ_BATCHES = 16;          // Batches per read, so a full map drains over 16 reads
+const size_t VERIFIER_LOG_SIZE = 64 * 1024;
+
+// tcx attach types and verdict; not yet in pre-6.6 uapi headers
+const uint32_t ATTACH_TCX_INGRESS = 46;
+const uint32_t ATTACH_TCX_EGRESS = 47;
+const int32_t TCX_CONTINUE = -1;
+
+// One batch of a read, shared by every tracker since reads run one at a time
+std::vector<TalkerKey> g_batchKeys;
+std::vector<TalkerCounts> g_batchValues; // possibleCpus values per key
+
+// Stack slots of the classifier, relative to the frame pointer r10
+const int16_t KEY_SLOT = -40;   // struct TalkerKey
+const int16_t VALUE_SLOT = -56; // struct TalkerCounts
+
+/**
+ * @brief Invokes the bpf() system call
+ * @param command BPF command
+ * @param attr Command attributes
+ * @return Syscall result, -1 with errno set on failure
+ */
+int bpfCall(int command, union bpf_attr& attr) {
+    return static_cast<int>(syscall(SYS_bpf, command, &attr, sizeof(attr)));
+}
+
+/**
+ * @brief Collects BPF instructions, resolving jumps to labels placed later
+ */
+class BpfAssembler {
+public:
+    /**
+     * @brief Appends one instruction
+     */
+    void emit(uint8_t code, uint8_t dst, uint8_t src, int16_t offset, int32_t imm) {
+        struct bpf_insn insn;
+        memset(&insn, 0, sizeof(insn));
+        insn.code = code;
+        insn.dst_reg = dst;
+        insn.src_reg = src;
+        insn.off = offset;
+        insn.imm = imm;
+        m_insns.push_back(insn);
+    }
+
+    /**
+     * @brief Appends a conditional jump comparing a register to an immediate, or BPF_JA
+     */
+    void jump(uint8_t op, uint8_t dst, int32_t imm, int label) {
+        m_fixups.push_back({m_insns.size(), label});
+        emit(BPF_JMP | op | BPF_K, dst, 0, 0, imm);
+    }
+
+    /**
+     * @brief Appends a conditional jump comparing two registers
+     */
+    void jumpReg(uint8_t op, uint8_t dst, uint8_t src, int label) {
+        m_fixups.push_back({m_insns.size(), label});
+        emit(BPF_JMP | op | BPF_X, dst, src, 0, 0);
+    }
+
+    /**
+     * @brief Binds a label to the next instruction
+     */
+    void place(int label) {
+        if (static_cast<size_t>(label) >= m_labels.size()) {
+            m_labels.resize(label + 1, 0);
+        }
+        m_labels[label] = m_insns.size();
+    }
+
+    /**
+     * @brief Resolves the jumps
+     * @return The program
+     */
+    const std::vector<struct bpf_insn>& finish() {
+        for (const Fixup& fixup : m_fixups) {
+            m_insns[fixup.at].off = static_cast<int16_t>(m_labels[fixup.label] - fixup.at - 1);
+        }
+        return m_insns;
+    }
+
+private:
+    struct Fixup {
+        size_t at;
+        int label;
+    };
+    std::vector<struct bpf_insn> m_insns;
+    std::vector<size_t> m_labels;
+    std::vector<Fixup> m_fixups;
+};
+
+/**
+ * @brief Assembles the counting classifier
+ * @param mapFd Per-CPU hash map of TalkerKey to TalkerCounts
+ * @param grouping Whether keys are whole 5-tuples or source addresses only
+ * @return The program
+ */
+std::vector<struct bpf_insn> assembleTalkerProgram(int mapFd, TalkerGrouping grouping) {
+    enum { IPV4, IPV6, PORTS, HAVE_PORTS, COUNT, INSERT, PASS };
+    const uint8_t LDX = BPF_LDX | BPF_MEM, STX = BPF_STX | BPF_MEM;
+    const uint8_t MOV = BPF_ALU64 | BPF_MOV, ADD = BPF_ALU64 | BPF_ADD;
+    const int16_t PORTS_AT = KEY_SLOT + static_cast<int16_t>(offsetof(TalkerKey, sourcePort));
+    const int16_t PROTOCOL_AT = KEY_SLOT + static_cast<int16_t>(offsetof(TalkerKey, protocol));
+    const int16_t VERSION_AT = KEY_SLOT + static_cast<int16_t>(offsetof(TalkerKey, ipVersion));
+    const int16_t DESTINATION_AT = KEY_SLOT + static_cast<int16_t>(offsetof(TalkerKey, destination));
+    bool flows = grouping == TALKERS_BY_FLOW;
+    BpfAssembler a;
+
+    // r6 = skb, r7 = packet start, r8 = packet end; zero the key
+    a.emit(MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0);
+    a.emit(LDX | BPF_W, BPF_REG_7, BPF_REG_6, offsetof(struct __sk_buff, data), 0);
+    a.emit(LDX | BPF_W, BPF_REG_8, BPF_REG_6, offsetof(struct __sk_buff, data_end), 0);
+    a.emit(MOV | BPF_K, BPF_REG_0, 0, 0, 0);
+    for (int16_t slot = KEY_SLOT; slot < 0; slot += 8) {
+        a.emit(STX | BPF_DW, BPF_REG_10, BPF_REG_0, slot, 0);
+    }
+
+    // Ethernet: the EtherType read as a little-endian u16 is byte swapped
+    a.emit(MOV | BPF_X, BPF_REG_2, BPF_REG_7, 0, 0);
+    a.emit(ADD | BPF_K, BPF_REG_2, 0, 0, 14);
+    a.jumpReg(BPF_JGT, BPF_REG_2, BPF_REG_8, PASS);
+    a.emit(LDX | BPF_H, BPF_REG_3, BPF_REG_7, 12, 0);
+    a.jump(BPF_JEQ, BPF_REG_3, htons(0x0800), IPV4);
+    a.jump(BPF_JEQ, BPF_REG_3, htons(0x86dd), IPV6);
+    a.jump(BPF_JA, 0, 0, PASS);
+
+    // IPv4: addresses, protocol, and the transport header offset in r5
+    a.place(IPV4);
+    a.emit(MOV | BPF_X, BPF_REG_2, BPF_REG_7, 0, 0);
+    a.emit(ADD | BPF_K, BPF_REG_2, 0, 0, 14 + 20);
+    a.jumpReg(BPF_JGT, BPF_REG_2, BPF_REG_8, PASS);
+    a.emit(LDX | BPF_W, BPF_REG_3, BPF_REG_7, 14 + 12, 0);
+    a.emit(STX | BPF_W, BPF_REG_10, BPF_REG_3, KEY_SLOT, 0);
+    a.emit(MOV | BPF_K, BPF_REG_3, 0, 0, 4);
+    a.emit(STX | BPF_B, BPF_REG_10, BPF_REG_3, VERSION_AT, 0);
+    if (flows) {
+        a.emit(LDX | BPF_W, BPF_REG_3, BPF_REG_7, 14 + 16, 0);
+        a.emit(STX | BPF_W, BPF_REG_10, BPF_REG_3, DESTINATION_AT, 0);
+        a.emit(LDX | BPF_B, BPF_REG_4, BPF_REG_7, 14 + 9, 0);
+        a.emit(STX | BPF_B, BPF_REG_10, BPF_REG_4, PROTOCOL_AT, 0);
+        // Later fragments carry no transport header
+        a.emit(LDX | BPF_H, BPF_REG_3, BPF_REG_7, 14 + 6, 0);
+        a.emit(BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_3, 0, 0, htons(0x1fff));
+        a.jump(BPF_JNE, BPF_REG_3, 0, COUNT);
+        a.emit(LDX | BPF_B, BPF_REG_5, BPF_REG_7, 14, 0);
+        a.emit(BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_5, 0, 0, 0x0f);
+        a.emit(BPF_ALU64 | BPF_LSH | BPF_K, BPF_REG_5, 0, 0, 2);
+        a.emit(ADD | BPF_K, BPF_REG_5, 0, 0, 14);
+        a.jump(BPF_JA, 0, 0, PORTS);
+    } else {
+        a.jump(BPF_JA, 0, 0, COUNT);
+    }
+
+    // IPv6: extension headers are not followed, so only plain TCP and UDP get ports
+    a.place(IPV6);
+    a.emit(MOV | BPF_X, BPF_REG_2, BPF_REG_7, 0, 0);
+    a.emit(ADD | BPF_K, BPF_REG_2, 0, 0, 14 + 40);
+    a.jumpReg(BPF_JGT, BPF_REG_2, BPF_REG_8, PASS);
+    for (int16_t word = 0; word < (flows ? 8 : 4); ++word) {
+        a.emit(LDX | BPF_W, BPF_REG_3, BPF_REG_7, 14 + 8 + 4 * word, 0);
+        a.emit(STX | BPF_W, BPF_REG_10, BPF_REG_3, KEY_SLOT + 4 * word, 0);
+    }
+    a.emit(MOV | BPF_K, BPF_REG_3, 0, 0, 6);
+    a.emit(STX | BPF_B, BPF_REG_10, BPF_REG_3, VERSION_AT, 0);
+    if (flows) {
+        a.emit(LDX | BPF_B, BPF_REG_4, BPF_REG_7, 14 + 6, 0);
+        a.emit(STX | BPF_B, BPF_REG_10, BPF_REG_4, PROTOCOL_AT, 0);
+        a.emit(MOV | BPF_K, BPF_REG_5, 0, 0, 14 + 40);
+
+        // Ports of TCP and UDP: r4 = protocol, r5 = transport header offset
+        a.place(PORTS);
+        a.jump(BPF_JEQ, BPF_REG_4, IPPROTO_TCP, HAVE_PORTS);
+        a.jump(BPF_JEQ, BPF_REG_4, IPPROTO_UDP, HAVE_PORTS);
+        a.jump(BPF_JA, 0, 0, COUNT);
+        a.place(HAVE_PORTS);
+        a.emit(MOV | BPF_X, BPF_REG_2, BPF_REG_7, 0, 0);
+        a.emit(ADD | BPF_X, BPF_REG_2, BPF_REG_5, 0, 0);
+        a.emit(MOV | BPF_X, BPF_REG_3, BPF_REG_2, 0, 0);
+        a.emit(ADD | BPF_K, BPF_REG_3, 0, 0, 4);
+        a.jumpReg(BPF_JGT, BPF_REG_3, BPF_REG_8, COUNT);
+        a.emit(LDX | BPF_W, BPF_REG_3, BPF_REG_2, 0, 0);
+        a.emit(STX | BPF_W, BPF_REG_10, BPF_REG_3, PORTS_AT, 0);
+    }
+
+    // Count the packet in this CPU's value, creating the entry on first sight
+    a.place(COUNT);
+    a.emit(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, mapFd);
+    a.emit(0, 0, 0, 0, 0);
+    a.emit(MOV | BPF_X, BPF_REG_2, BPF_REG_10, 0, 0);
+    a.emit(ADD | BPF_K, BPF_REG_2, 0, 0, KEY_SLOT);
+    a.emit(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem);
+    a.jump(BPF_JEQ, BPF_REG_0, 0, INSERT);
+    a.emit(LDX | BPF_W, BPF_REG_3, BPF_REG_6, offsetof(struct __sk_buff, len), 0);
+    a.emit(LDX | BPF_DW, BPF_REG_4, BPF_REG_0, offsetof(TalkerCounts, bytes), 0);
+    a.emit(ADD | BPF_X, BPF_REG_4, BPF_REG_3, 0, 0);
+    a.emit(STX | BPF_DW, BPF_REG_0, BPF_REG_4, offsetof(TalkerCounts, bytes), 0);
+    a.emit(LDX | BPF_DW, BPF_REG_4, BPF_REG_0, offsetof(TalkerCounts, packets), 0);
+    a.emit(ADD | BPF_K, BPF_REG_4, 0, 0, 1);
+    a.emit(STX | BPF_DW, BPF_REG_0, BPF_REG_4, offsetof(TalkerCounts, packets), 0);
+    a.jump(BPF_JA, 0, 0, PASS);
+    a.place(INSERT);
+    a.emit(LDX | BPF_W, BPF_REG_3, BPF_REG_6, offsetof(struct __sk_buff, len), 0);
+    a.emit(STX | BPF_DW, BPF_REG_10, BPF_REG_3, VALUE_SLOT + static_cast<int16_t>(offsetof(TalkerCounts, bytes)), 0);
+    a.emit(MOV | BPF_K, BPF_REG_3, 0, 0, 1);
+    a.emit(STX | BPF_DW, BPF_REG_10, BPF_REG_3, VALUE_SLOT + static_cast<int16_t>(offsetof(TalkerCounts, packets)), 0);
+    a.emit(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, mapFd);
+    a.emit(0, 0, 0, 0, 0);
+    a.emit(MOV | BPF_X, BPF_REG_2, BPF_REG_10, 0, 0);
+    a.emit(ADD | BPF_K, BPF_REG_2, 0, 0, KEY_SLOT);
+    a.emit(MOV | BPF_X, BPF_REG_3, BPF_REG_10, 0, 0);
+    a.emit(ADD | BPF_K, BPF_REG_3, 0, 0, VALUE_SLOT);
+    a.emit(MOV | BPF_K, BPF_REG_4, 0, 0, BPF_ANY);
+    a.emit(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_update_elem);
+
+    a.place(PASS);
+    a.emit(MOV | BPF_K, BPF_REG_0, 0, 0, TCX_CONTINUE);
+    a.emit(BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+    return a.finish();
+}
+
+/**
+ * @brief Counts the CPUs the kernel may bring online, the length of per-CPU map values
+ * @return Highest possible CPU number plus one
+ */
+int countPossibleCpus() {
+    std::ifstream file("/sys/devices/system/cpu/possible");
+    std::string ranges;
+    file >> ranges;
+    int highest = 0;
+    // e.g. "0-7" or "0,2-3"; the last number is the highest
+    size_t last = ranges.find_last_of(",-");
+    highest = atoi(ranges.c_str() + (last == std::string::npos ? 0 : last + 1));
+    return highest + 1;
+}
+
+/**
+ * @brief Creates the map, loads the classifier and attaches it to both directions of an interface
+ * @param interface Name of the interface
+ * @param grouping Whether to count per 5-tuple or per source address
+ * @param tracker Receives the attachment; detach with detachTalkerTracker()
+ * @throws runtime_error if the kernel rejects any step
+ */
+void attachTalkerTracker(const char* interface, TalkerGrouping grouping, TalkerTracker& tracker) {
+    tracker.interface = interface;
+    unsigned ifindex = if_nametoindex(interface);
+    if (ifindex == 0) {
+        throw std::runtime_error("!!! talkers.cpp !!!- No interface " + tracker.interface);
+    }
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_PERCPU_HASH;
+    attr.key_size = sizeof(TalkerKey);
+    attr.value_size = sizeof(TalkerCounts);
+    attr.max_entries = TALKER_MAP_ENTRIES;
+    attr.map_flags = BPF_F_NO_PREALLOC;
+    tracker.mapFd = bpfCall(BPF_MAP_CREATE, attr);
+    if (tracker.mapFd < 0) {
+        throw std::runtime_error("!!! talkers.cpp !!!- Map creation failed: " + std::string(strerror(errno)));
+    }
+
+    std::vector<struct bpf_insn> program = assembleTalkerProgram(tracker.mapFd, grouping);
+    std::vector<char> log(VERIFIER_LOG_SIZE, '\0');
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_SCHED_CLS;
+    attr.insns = reinterpret_cast<uint64_t>(program.data());
+    attr.insn_cnt = static_cast<uint32_t>(program.size());
+    attr.license = reinterpret_cast<uint64_t>("GPL");
+    attr.log_buf = reinterpret_cast<uint64_t>(log.data());
+    attr.log_size = static_cast<uint32_t>(log.size());
+    attr.log_level = 1;
+    tracker.programFd = bpfCall(BPF_PROG_LOAD, attr);
+    if (tracker.programFd < 0) {
+        std::string reason = strerror(errno);
+        detachTalkerTracker(tracker);
+        throw std::runtime_error("!!! talkers.cpp !!!- Classifier rejected: " + reason + "\n" + log.data());
+    }
+
+    const uint32_t directions[2] = {ATTACH_TCX_INGRESS, ATTACH_TCX_EGRESS};
+    for (int d = 0; d < 2; ++d) {
+        memset(&attr, 0, sizeof(attr));
+        attr.link_create.prog_fd = tracker.programFd;
+        attr.link_create.target_ifindex = ifindex;
+        attr.link_create.attach_type = directions[d];
+        tracker.linkFds[d] = bpfCall(BPF_LINK_CREATE, attr);
+        if (tracker.linkFds[d] < 0) {
+            std::string reason = strerror(errno);
+            detachTalkerTracker(tracker);
+            throw std::runtime_error("!!! talkers.cpp !!!- Failed to attach to " + std::string(interface) +
+                                     " (tcx needs Linux 6.6 or later): " + reason);
+        }
+    }
+
+    tracker.possibleCpus = countPossibleCpus();
+    g_batchKeys.resize(TALKER_BATCH);
+    g_batchValues.resize(std::max(g_batchValues.size(), static_cast<size_t>(TALKER_BATCH) * tracker.possibleCpus));
+    tracker.top.reserve(TOP_TALKERS + 1);
+    tracker.next.reserve(TOP_TALKERS + 1);
+    tracker.lastRead = 0.0;
+    tracker.draining = false;
+    tracker.summaries = new FlowSummary[SKETCH_INTERVALS](); // Zeroed summaries are empty
+    g_sketchBytes += sizeof(FlowSummary) * SKETCH_INTERVALS;
+}
+
+/**
+ * @brief Orders heavy hitters so a heap keeps the lightest on top
+ */
+bool heavierTalker(const TopTalker& a, const TopTalker& b) {
+    return a.bytesPerSecond > b.bytesPerSecond;
+}
+
+/**
+ * @brief Drains part of the map, keeping the heaviest talkers of the interval
+ * @details Entries are deleted as they are read, so each drain sees one interval and
+ *          the map never fills with idle flows. A packet counted between the read
+ *          and the delete of its entry is lost, which top-K ranking tolerates. A
+ *          drain reads at most TALKER_READ_BATCHES batches per call and picks up
+ *          where it stopped on the next call; a bucket is revisited about one drain
+ *          period later, so rates divide by the time between drain starts. Every
+ *          flow is also added to the summary of the current wall-clock interval.
+ * @param tracker Attached tracker
+ * @param now Current Clock::monotonic() time
+ * @param wallTime Current Clock::wallTime()
+ */
+void readTopTalkers(TalkerTracker& tracker, double now, int64_t wallTime) {
+    if (tracker.mapFd < 0) {
+        return;
+    }
+    if (!tracker.draining) {
+        tracker.drainSeconds = tracker.lastRead > 0.0 ? now - tracker.lastRead : 1.0;
+        if (tracker.drainSeconds <= 0.0) {
+            return;
+        }
+        tracker.lastRead = now;
+        tracker.next.clear();
+        tracker.nextFlows = 0;
+    }
+    int64_t start = wallTime - wallTime % SKETCH_INTERVAL;
+    FlowSummary& summary = tracker.summaries[(start / SKETCH_INTERVAL) % SKETCH_INTERVALS];
+    if (summary.start != start) {
+        clearSummary(summary, start, start + SKETCH_INTERVAL); // Recycles the summary of an hour ago
+    }
+    double seconds = tracker.drainSeconds;
+    for (int batch = 0; batch < TALKER_READ_BATCHES; ++batch) {
+        TalkerKey token;
+        union bpf_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.batch.map_fd = tracker.mapFd;
+        attr.batch.in_batch = tracker.draining ? reinterpret_cast<uint64_t>(&tracker.resumeToken) : 0;
+        attr.batch.out_batch = reinterpret_cast<uint64_t>(&token);
+        attr.batch.keys = reinterpret_cast<uint64_t>(g_batchKeys.data());
+        attr.batch.values = reinterpret_cast<uint64_t>(g_batchValues.data());
+        attr.batch.count = TALKER_BATCH;
+        bool done = bpfCall(BPF_MAP_LOOKUP_AND_DELETE_BATCH, attr) < 0;
+        if (done && errno != ENOENT) {
+            tracker.draining = false; // Nothing was read; end the drain with what it has so far
+            break;
+        }
+        tracker.resumeToken = token;
+        tracker.draining = !done;
+        for (uint32_t e = 0; e < attr.batch.count; ++e) {
+            TopTalker talker = {g_batchKeys[e], 0.0, 0.0};
+            const TalkerCounts* counts = &g_batchValues[static_cast<size_t>(e) * tracker.possibleCpus];
+            for (int cpu = 0; cpu < tracker.possibleCpus; ++cpu) {
+                talker.bytesPerSecond += counts[cpu].bytes;
+                talker.packetsPerSecond += counts[cpu].packets;
+            }
+            addFlow(summary, talker.key, hashFlow(talker.key), static_cast<uint64_t>(talker.bytesPerSecond));
+            talker.bytesPerSecond /= seconds;
+            talker.packetsPerSecond /= seconds;
+            // Min-heap of the K heaviest
+            std::vector<TopTalker>& heap = tracker.next;
+            if (heap.size() < static_cast<size_t>(TOP_TALKERS)) {
+                heap.push_back(talker);
+                std::push_heap(heap.begin(), heap.end(), heavierTalker);
+            } else if (talker.bytesPerSecond > heap.front().bytesPerSecond) {
+                std::pop_heap(heap.begin(), heap.end(), heavierTalker);
+                heap.back() = talker;
+                std::push_heap(heap.begin(), heap.end(), heavierTalker);
+            }
+        }
+        tracker.nextFlows += attr.batch.count;
+        if (done) {
+            break;
+        }
+    }
+    if (!tracker.draining) {
+        std::sort_heap(tracker.next.begin(), tracker.next.end(), heavierTalker);
+        tracker.top.swap(tracker.next);
+        tracker.flows = tracker.nextFlows;
+    }
+}
+
+/**
+ * @brief Merges the summaries of the last intervals of a tracker
+ * @param tracker Attached tracker
+ * @param wallTime Current Clock::wallTime()
+ * @param intervals Number of intervals, the current one included, at most SKETCH_INTERVALS
+ * @param summary Receives the merge; empty if the tracker saw no traffic
+ */
+void summarizeTalkers(const TalkerTracker& tracker, int64_t wallTime, int intervals, FlowSummary& summary) {
+    clearSummary(summary, 0, 0);
+    int64_t current = wallTime - wallTime % SKETCH_INTERVAL;
+    int64_t oldest = current - (std::min(intervals, SKETCH_INTERVALS) - 1) * SKETCH_INTERVAL;
+    for (int i = 0; tracker.summaries != nullptr && i < SKETCH_INTERVALS; ++i) {
+        const FlowSummary& interval = tracker.summaries[i];
+        if (interval.start >= oldest && interval.start <= current) {
+            mergeSummary(summary, interval);
+        }
+    }
+}
+
+/**
+ * @brief Detaches the classifier and releases the map
+ * @param tracker Tracker to release; safe on a partly attached one
+ */
+void detachTalkerTracker(TalkerTracker& tracker) {
+    for (int& fd : tracker.linkFds) {
+        if (fd >= 0) {
+            close(fd); // Closing an unpinned link detaches it
+            fd = -1;
+        }
+    }
+    if (tracker.programFd >= 0) {
+        close(tracker.programFd);
+        tracker.programFd = -1;
+    }
+    if (tracker.mapFd >= 0) {
+        close(tracker.mapFd);
+        tracker.mapFd = -1;
+    }
+    if (tracker.summaries != nullptr) {
+        delete[] tracker.summaries;
+        tracker.summaries = nullptr;
+        g_sketchBytes -= sizeof(FlowSummary) * SKETCH_INTERVALS;
+    }
+}
+
+/**
+ * @brief Formats a key as "proto source:port > destination:port", or the source alone
+ * @param key Map key
+ * @return Printable form
+ */
+std::string formatTalker(const TalkerKey& key) {
+    int family = key.ipVersion == 6 ? AF_INET6 : AF_INET;
+    char source[INET6_ADDRSTRLEN], destination[INET6_ADDRSTRLEN];
+    inet_ntop(family, key.source, source, sizeof(source));
+    static const uint8_t NONE[16] = {};
+    if (key.protocol == 0 && memcmp(key.destination, NONE, sizeof(NONE)) == 0) {
+        return source; // Grouped by source
+    }
+    inet_ntop(family, key.destination, destination, sizeof(destination));
+    const char* protocol = key.protocol == IPPROTO_TCP ? "tcp" : key.protocol == IPPROTO_UDP ? "udp"
+                         : key.protocol == IPPROTO_ICMP ? "icmp" : key.protocol == IPPROTO_ICMPV6 ? "icmpv6" : nullptr;
+    std::string text = protocol != nullptr ? protocol : "proto " + std::to_string(key.protocol);
+    text += std::string(" ") + source;
+    if (key.sourcePort != 0 || key.destinationPort != 0) {
+        text += ":" + std::to_string(ntohs(key.sourcePort));
+    }
+    text += std::string(" > ") + destination;
+    if (key.sourcePort != 0 || key.destinationPort != 0) {
+        text += ":" + std::to_string(ntohs(key.destinationPort));
+    }
+    return text;
+}
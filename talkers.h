@@ -0,0 +1,85 @@
+/**
+ * @file talkers.h
+ * @brief Top talkers of an interface from an eBPF classifier counting bytes per flow
+ * @details A tc classifier attached to both directions of the interface (tcx,
+ *          Linux 6.6+) counts bytes and packets per 5-tuple, or per source address,
+ *          in a per-CPU hash map. Reads drain the map with batched
+ *          lookup-and-delete calls, merge the per-CPU values and keep the K
+ *          heaviest entries of the interval, so the cost is a few syscalls per
+ *          thousands of flows and the map only ever holds one interval. A read
+ *          drains at most TALKER_READ_BATCHES batches; a larger map is drained
+ *          over several reads, each resuming from the batch token of the last, and
+ *          top is replaced when a drain completes. Every drained flow also feeds
+ *          the tracker's per-minute FlowSummary (sketch.h), which answers top-flow
+ *          queries over the last hour.
+ */
+#ifndef TALKERS_H
+#define TALKERS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+const int TOP_TALKERS = 10;
+
+enum TalkerGrouping { TALKERS_BY_FLOW, TALKERS_BY_SOURCE };
+
+/**
+ * @brief Map key filled by the classifier; fields it does not group by stay zero
+ */
+struct TalkerKey {
+    uint8_t source[16];      // IPv4 addresses use the first 4 bytes
+    uint8_t destination[16];
+    uint16_t sourcePort;     // Network byte order, zero unless TCP or UDP
+    uint16_t destinationPort;
+    uint8_t protocol;
+    uint8_t ipVersion;       // 4 or 6
+    uint8_t padding[2];
+};
+
+/**
+ * @brief Per-CPU map value
+ */
+struct TalkerCounts {
+    uint64_t bytes;
+    uint64_t packets;
+};
+
+/**
+ * @brief One heavy hitter of the last interval
+ */
+struct TopTalker {
+    TalkerKey key;
+    double bytesPerSecond;
+    double packetsPerSecond;
+};
+
+struct FlowSummary;
+
+/**
+ * @brief Classifier, map and read buffers of one interface
+ */
+struct TalkerTracker {
+    std::string interface;
+    int mapFd = -1;
+    int programFd = -1;
+    int linkFds[2] = {-1, -1};     // Ingress and egress attachments
+    int possibleCpus = 0;
+    std::vector<TopTalker> top;    // Heaviest first, from the last completed drain
+    size_t flows = 0;              // Entries seen in the last completed drain
+    double lastRead = 0.0;         // Clock::monotonic() when the last drain started
+    bool draining = false;         // A drain is under way and resumes from resumeToken
+    TalkerKey resumeToken;         // Batch position of the drain; a bucket index for hash maps
+    double drainSeconds = 0.0;     // Time the counts of the drain under way cover
+    std::vector<TopTalker> next;   // Min-heap of the heaviest of the drain under way
+    size_t nextFlows = 0;
+    FlowSummary* summaries = nullptr; // Ring of SKETCH_INTERVALS summaries, by wall-clock interval
+};
+
+void attachTalkerTracker(const char* interface, TalkerGrouping grouping, TalkerTracker& tracker);
+void readTopTalkers(TalkerTracker& tracker, double now, int64_t wallTime);
+void summarizeTalkers(const TalkerTracker& tracker, int64_t wallTime, int intervals, FlowSummary& summary);
+void detachTalkerTracker(TalkerTracker& tracker);
+std::string formatTalker(const TalkerKey& key);
+
+#endif // TALKERS_H
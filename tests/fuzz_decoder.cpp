@@ -0,0 +1,34 @@
+/**
+ * @file fuzz_decoder.cpp
+ * @brief libFuzzer target for decodeSample, the parser of intfMonitor reports
+ * @details Besides running the decoder under the sanitizers, checks the two
+ *          properties networkMonitor's report reassembly relies on: a decoded
+ *          report is never longer than the input, and the same report cut short by
+ *          any number of bytes never decodes. Build with make fuzz_decoder (needs
+ *          clang) and run ./fuzz_decoder [corpus directory].
+ */
+#include <cstdlib>
+#include <cstring>
+
+#include "monitorState.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const unsigned char* data, size_t size) {
+    const char* report = reinterpret_cast<const char*>(data);
+    InterfaceSample sample;
+    size_t consumed = decodeSample(report, size, sample);
+    if (consumed == 0) {
+        return 0;
+    }
+    if (consumed > size || strnlen(sample.name, sizeof(sample.name)) == sizeof(sample.name) ||
+        strnlen(sample.owner, sizeof(sample.owner)) == sizeof(sample.owner) ||
+        sample.irqCount < 0 || sample.irqCount > MAX_QUEUE_IRQS) {
+        abort();
+    }
+    for (size_t length = 0; length < consumed; ++length) {
+        InterfaceSample truncated;
+        if (decodeSample(report, length, truncated) != 0) {
+            abort();
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,114 @@
+/**
+ * @file ingest_allocations.cpp
+ * @brief Checks that ingesting a sample and serializing it to JSON Lines make no heap allocations
+ * @details Replaces the global operator new with a counting one, which only this
+ *          test links, feeds libnetwatch synthetic samples on a virtual clock under a
+ *          memory budget until both history tiers recycle pool blocks instead of
+ *          growing, and then fails if any further tick of ingestion, compaction,
+ *          budget enforcement or JSON Lines output allocates.
+ *          Build and run with make check, or make ingest_allocations.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <unistd.h>
+
+#include "jsonLines.h"
+#include "monitorState.h"
+
+const int INTERFACES = 64;
+const size_t MEMORY_BUDGET = 1 << 20;          // Small, so history stops growing within the warm-up
+const long WARMUP_TICKS = 3 * SEGMENT_RECORDS; // Cycles segments and blocks through the pools
+const long MEASURED_TICKS = 2 * SEGMENT_RECORDS;
+
+size_t g_allocations = 0;
+
+/**
+ * @brief Counts heap allocations made by the code under test
+ */
+void* operator new(size_t size) {
+    ++g_allocations;
+    void* memory = malloc(size != 0 ? size : 1);
+    if (memory == nullptr) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void* memory) noexcept {
+    free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    free(memory);
+}
+
+/**
+ * @brief Runs one second: a sample and a JSON line per interface, then the periodic history upkeep
+ * @param clock Virtual clock, advanced by one second
+ * @param samples Last sample of each interface, counters advanced in place
+ * @param writer JSON Lines sink writing to /dev/null
+ */
+void runTick(VirtualClock& clock, InterfaceSample samples[], JsonLinesWriter& writer) {
+    clock.advance(1.0);
+    for (int i = 0; i < INTERFACES; ++i) {
+        samples[i].sampledAt = clock.monotonic();
+        for (int c = 0; c < NUM_COUNTERS; ++c) {
+            samples[i].counters[c] += (c == RX_BYTES || c == TX_BYTES) ? 1000000 + i * 1000 : 1 + c;
+        }
+        ingestSample(i, samples[i]);
+        appendSampleJson(writer, i, clock.wallTime());
+    }
+    compactHistory(clock.wallTime());
+    enforceMemoryBudget(clock.wallTime());
+    flushJsonLinesIfDue(writer);
+}
+
+int main() {
+    static VirtualClock clock(1700000000);
+    static InterfaceSample samples[INTERFACES];
+    static JsonLinesWriter writer;
+    g_clock = &clock;
+    g_printSamples = false;
+    g_memoryBudget = MEMORY_BUDGET;
+    resizeSlots(INTERFACES);
+
+    writer.fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (writer.fd < 0) {
+        perror("!!! ingest_allocations.cpp !!!- /dev/null");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < INTERFACES; ++i) {
+        memset(&samples[i], 0, sizeof(samples[i]));
+        snprintf(samples[i].name, sizeof(samples[i].name), "test%d", i);
+        strcpy(samples[i].state, "up");
+        samples[i].counterMask = ALL_COUNTERS;
+        samples[i].ifindex = i + 1;
+        samples[i].speedMbps = 10000;
+        samples[i].mtu = 1500;
+    }
+
+    for (long t = 0; t < WARMUP_TICKS; ++t) {
+        runTick(clock, samples, writer);
+    }
+    size_t warmupAllocations = g_allocations;
+    long allocatingTicks = 0;
+    for (long t = 0; t < MEASURED_TICKS; ++t) {
+        size_t before = g_allocations;
+        runTick(clock, samples, writer);
+        allocatingTicks += g_allocations != before;
+    }
+    size_t allocations = g_allocations - warmupAllocations;
+    close(writer.fd);
+
+    printf("%d interfaces, %ld ticks after %ld of warm-up: %zu heap allocations in %ld ticks\n",
+           INTERFACES, MEASURED_TICKS, WARMUP_TICKS, allocations, allocatingTicks);
+    if (allocations != 0) {
+        printf("FAIL: steady-state ingestion allocated\n");
+        return EXIT_FAILURE;
+    }
+    printf("PASS\n");
+    return EXIT_SUCCESS;
+}
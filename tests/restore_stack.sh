@@ -0,0 +1,39 @@
+#!/bin/sh
+# Benchmarks restoring stacked interfaces: builds 4-level stacks in a scratch
+# network namespace and runs networkMonitor --restore-bench on their tops.
+#
+#   veth x<n> -> macvlan m<n> -> bridge br<n> -> macvlan t<n>
+#
+# Usage (as root, after make): tests/restore_stack.sh [stacks]
+set -e
+
+STACKS=${1:-8}
+NS=netwatch-restore-$$
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+
+cleanup() {
+    ip netns del "$NS" 2>/dev/null || true
+}
+trap cleanup EXIT
+
+ip netns add "$NS"
+TOPS=
+i=0
+while [ "$i" -lt "$STACKS" ]; do
+    ip -n "$NS" link add "x$i" type veth peer name "y$i"
+    ip -n "$NS" link add link "x$i" name "m$i" type macvlan
+    ip -n "$NS" link add "br$i" type bridge
+    ip -n "$NS" link set "m$i" master "br$i"
+    ip -n "$NS" link add link "br$i" name "t$i" type macvlan
+    TOPS="$TOPS${TOPS:+,}t$i"
+    i=$((i + 1))
+done
+
+ip netns exec "$NS" "$ROOT/networkMonitor" --restore-bench "$TOPS" | tee /tmp/restore_stack.$$
+if ! grep -q "devices left down or failing: 0$" /tmp/restore_stack.$$; then
+    rm -f /tmp/restore_stack.$$
+    echo "FAIL: not every device came back up" >&2
+    exit 1
+fi
+rm -f /tmp/restore_stack.$$
+echo "PASS"
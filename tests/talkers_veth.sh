@@ -0,0 +1,70 @@
+#!/bin/sh
+# Checks top talkers end to end: monitors one end of a veth pair with
+# --top-talkers flows, sends one heavy UDP flow and many light ones across the
+# pair and checks that netwatchctl talkers ranks the heavy flow first.
+#
+#   netns A: nwt<pid> 10.99.1.1  <-- veth -->  netns B: nwq<pid> 10.99.1.2
+#
+# Usage (as root, after make, on Linux 6.6 or later): tests/talkers_veth.sh [seconds]
+set -e
+
+SECONDS_OF_TRAFFIC=${1:-5}
+NS=netwatch-talkers-$$
+PEER_NS=netwatch-peer-$$
+IF=nwt$$
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+PID=
+
+cleanup() {
+    if [ -n "$PID" ]; then
+        kill -INT "$PID" 2>/dev/null || true
+        wait "$PID" 2>/dev/null || true
+    fi
+    ip netns del "$NS" 2>/dev/null || true
+    ip netns del "$PEER_NS" 2>/dev/null || true
+    rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+ip netns add "$NS"
+ip netns add "$PEER_NS"
+ip link add "$IF" netns "$NS" type veth peer name "nwq$$" netns "$PEER_NS"
+ip -n "$NS" addr add 10.99.1.1/24 dev "$IF"
+ip -n "$PEER_NS" addr add 10.99.1.2/24 dev "nwq$$"
+ip -n "$NS" link set "$IF" up
+ip -n "$PEER_NS" link set "nwq$$" up
+
+# networkMonitor reads the interfaces from stdin and runs ./intfMonitor
+mkfifo "$WORK/stdin"
+cd "$ROOT"
+ip netns exec "$NS" ./networkMonitor --top-talkers flows < "$WORK/stdin" > "$WORK/monitor.log" 2>&1 &
+PID=$!
+exec 3> "$WORK/stdin"
+printf '1\n%s\n' "$IF" >&3
+
+# One socket sends ten 1400-byte datagrams for every datagram of a new light flow
+ip netns exec "$NS" bash -c "
+    exec 4> /dev/udp/10.99.1.2/7777
+    end=\$((SECONDS + $SECONDS_OF_TRAFFIC))
+    while [ \$SECONDS -lt \$end ]; do
+        for i in 1 2 3 4 5 6 7 8 9 10; do printf '%1400s' x >&4 2>/dev/null; done
+        echo x > /dev/udp/10.99.1.2/\$((RANDOM % 50000 + 10000))
+    done" &
+TRAFFIC=$!
+sleep $((SECONDS_OF_TRAFFIC - 1))
+./netwatchctl talkers "$IF" > "$WORK/talkers" || true
+wait "$TRAFFIC"
+
+cat "$WORK/talkers"
+if grep -q "attach" "$WORK/monitor.log"; then
+    grep "attach" "$WORK/monitor.log" >&2
+    echo "FAIL: classifier not attached" >&2
+    exit 1
+fi
+FLOWS=$(head -n 1 "$WORK/talkers" | sed -n 's/.* of \([0-9]*\) flows$/\1/p')
+if ! head -n 1 "$WORK/talkers" | grep -q "> 10.99.1.2:7777 " || [ "${FLOWS:-0}" -lt 10 ]; then
+    echo "FAIL: the heavy flow is not ranked first among the light ones" >&2
+    exit 1
+fi
+echo "PASS"